@@ -49,6 +49,67 @@
  * applied, followed by the user-set properties, fast first pass restrictions and
  * finally the profile restrictions.
  *
+ * While playing, the bitrate, quantizer and vbv-buf-capacity properties and
+ * the ref, me, subme, analyse, trellis, noise-reduction and option-string
+ * properties can be changed without restarting the encoder. They take effect
+ * through x264_encoder_reconfig(), which also limits what can change, e.g.
+ * never more reference frames than the encoder started with. Deblocking and
+ * psy-rd strength can be changed through the option-string, its options that
+ * x264_encoder_reconfig() does not take over wait for the next restart.
+ *
+ * With #GstX264Enc:adaptive-speed, the encoder makes these changes itself.
+ * It compares the encoding time of each frame with the frame duration, or the
+ * time QoS leaves for it, and steps between the settings of the speed
+ * presets as far as needed to keep up. #GstX264Enc:timing-stats reports
+ * the measurements.
+ *
+ * Additional renditions of the input, e.g. for an ABR ladder, are encoded by
+ * requesting src_%u pads. Every rendition gets an encoder of its own with the
+ * settings of the element, except for the #GstX264EncPad:width,
+ * #GstX264EncPad:height, #GstX264EncPad:bitrate and #GstX264EncPad:profile
+ * set on its pad. The renditions share the mapping of the input and the
+ * scaling to each size, and are encoded next to each other on a shared pool
+ * of workers. They are always in byte-stream format.
+ *
+ * #GstX264Enc:low-latency goes further than tune=zerolatency: the main
+ * stream is cut into slices of at most #GstX264Enc:slice-max-size bytes,
+ * which are pushed from the x264 slice threads as soon as each is encoded
+ * instead of after the whole frame. The first frame after a serialized event
+ * like a new segment goes out whole, after the event. The output has NAL
+ * alignment, and the MARKER flag marks the last buffer of every frame.
+ *
+ * Regions of interest, given as #GstVideoRegionOfInterestMeta on the input
+ * buffers, are encoded at a different quantizer than the rest of the
+ * frame: #GstX264Enc:roi-types sets the offset for each type of region and
+ * #GstX264Enc:roi-delta-qp for all others. This works on top of adaptive
+ * quantization, so it has no effect with aq-mode=0 in the option-string.
+ *
+ * With pass=two-pass, both passes of a VBR encoding run in one pipeline for
+ * finite inputs. The first pass writes its statistics to a private
+ * directory, on tmpfs where available, instead of the multipass-cache-file.
+ * At EOS all frames are encoded again with these statistics, so nothing is
+ * output before then. When upstream is seekable, the EOS of the first pass
+ * is dropped and upstream is seeked back to the start of the segment for
+ * the second pass. Otherwise the first pass keeps a copy of every frame,
+ * and inputs larger than #GstX264Enc:two-pass-max-size fail with an error.
+ *
+ * Offline encodes can use more cores with #GstX264Enc:chunk-frames. The
+ * input is then cut into chunks at scene changes, or after at most that
+ * many frames, and #GstX264Enc:chunk-encoders chunks are encoded at the same
+ * time on encoders of their own. All encoders have the same settings, so
+ * the chunks share the SPS and PPS. They are output in order, with DTS that
+ * continue from one chunk to the next. Additional renditions, ROI and
+ * multipass or low-latency encoding are not available in this mode. With
+ * VBV, every chunk starts from a nearly empty VBV buffer, so that the
+ * stream stays within the VBV limits across chunk boundaries at the cost
+ * of some quality at the start of each chunk. The latency includes the
+ * frames that wait for their chunk.
+ *
+ * #GstX264Enc:frame-stats sends what x264 tells about every frame (type,
+ * size, average QP, latency, and SSIM and PSNR when the option-string has
+ * ssim=1 or psnr=1) downstream in a custom event after its buffer, and
+ * #GstX264Enc:rolling-stats sums them up over the last frames.
+ *
  * <note>Some settings, including the default settings, may lead to quite
  * some latency (i.e. frame buffering) in the encoder. This may cause problems
  * with pipeline stalling in non-trivial pipelines, because the encoder latency
@@ -106,9 +167,11 @@
 #include <gst/video/gstvideometa.h>
 #include <gst/video/gstvideopool.h>
 
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <gmodule.h>
+#include <glib/gstdio.h>
 
 GST_DEBUG_CATEGORY_STATIC (x264_enc_debug);
 #define GST_CAT_DEFAULT x264_enc_debug
@@ -129,6 +192,7 @@ struct _GstX264EncVTable
   x264_t *(*x264_encoder_open) (x264_param_t *);
   int (*x264_encoder_reconfig) (x264_t *, x264_param_t *);
   const x264_level_t (*x264_levels)[];
+  void (*x264_nal_encode) (x264_t *, uint8_t * dst, x264_nal_t * nal);
   void (*x264_param_apply_fastfirstpass) (x264_param_t *);
   int (*x264_param_apply_profile) (x264_param_t *, const char *);
   void (*x264_param_default) (x264_param_t *);
@@ -181,6 +245,7 @@ load_x264 (const gchar * filename)
   LOAD_SYMBOL (x264_encoder_maximum_delayed_frames);
   LOAD_SYMBOL (x264_encoder_reconfig);
   LOAD_SYMBOL (x264_levels);
+  LOAD_SYMBOL (x264_nal_encode);
   LOAD_SYMBOL (x264_param_apply_fastfirstpass);
   LOAD_SYMBOL (x264_param_apply_profile);
   LOAD_SYMBOL (x264_param_default);
@@ -368,6 +433,17 @@ enum
   ARG_TUNE,
   ARG_FRAME_PACKING,
   ARG_INSERT_VUI,
+  ARG_ADAPTIVE_SPEED,
+  ARG_TIMING_STATS,
+  ARG_LOW_LATENCY,
+  ARG_SLICE_MAX_SIZE,
+  ARG_ROI_DELTA_QP,
+  ARG_ROI_TYPES,
+  ARG_CHUNK_FRAMES,
+  ARG_CHUNK_ENCODERS,
+  ARG_FRAME_STATS,
+  ARG_ROLLING_STATS,
+  ARG_TWO_PASS_MAX_SIZE,
 };
 
 #define ARG_THREADS_DEFAULT            0        /* 0 means 'auto' which is 1.5x number of CPU cores */
@@ -410,6 +486,70 @@ static GString *x264enc_defaults;
 #define ARG_TUNE_DEFAULT               0        /* no tuning */
 #define ARG_FRAME_PACKING_DEFAULT      -1       /* automatic (none, or from input caps) */
 #define ARG_INSERT_VUI_DEFAULT         TRUE
+#define ARG_ADAPTIVE_SPEED_DEFAULT     FALSE
+#define ARG_LOW_LATENCY_DEFAULT        FALSE
+#define ARG_SLICE_MAX_SIZE_DEFAULT     1200     /* fits in an Ethernet MTU */
+#define ARG_ROI_DELTA_QP_DEFAULT       -6.0
+#define ARG_CHUNK_FRAMES_DEFAULT       0        /* no chunks */
+#define ARG_CHUNK_ENCODERS_DEFAULT     0        /* automatic */
+#define ARG_FRAME_STATS_DEFAULT        FALSE
+#define ARG_TWO_PASS_MAX_SIZE_DEFAULT  (G_GUINT64_CONSTANT (2) << 30)  /* 2 GiB */
+
+/* The parts of the x264 speed presets that x264_encoder_reconfig() can
+ * change, from ultrafast to veryslow */
+typedef struct
+{
+  const gchar *name;
+  gint me;
+  gint subme;
+  gint ref;
+  gint trellis;
+  guint inter;
+  gboolean mixed_refs;
+  gint me_range;
+} GstX264EncSpeedLevel;
+
+#define X264_INTER_DEFAULT (X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8 | \
+    X264_ANALYSE_PSUB16x16 | X264_ANALYSE_BSUB16x16)
+
+static const GstX264EncSpeedLevel speed_levels[] = {
+  {"ultrafast", X264_ME_DIA, 0, 1, 0, 0, FALSE, 16},
+  {"superfast", X264_ME_DIA, 1, 1, 0, X264_ANALYSE_I4x4 | X264_ANALYSE_I8x8,
+      FALSE, 16},
+  {"veryfast", X264_ME_HEX, 2, 1, 0, X264_INTER_DEFAULT, FALSE, 16},
+  {"faster", X264_ME_HEX, 4, 2, 1, X264_INTER_DEFAULT, FALSE, 16},
+  {"fast", X264_ME_HEX, 6, 2, 1, X264_INTER_DEFAULT, TRUE, 16},
+  {"medium", X264_ME_HEX, 7, 3, 1, X264_INTER_DEFAULT, TRUE, 16},
+  {"slow", X264_ME_UMH, 8, 5, 1, X264_INTER_DEFAULT, TRUE, 16},
+  {"slower", X264_ME_UMH, 9, 8, 2, X264_INTER_DEFAULT | X264_ANALYSE_PSUB8x8,
+      TRUE, 16},
+  {"veryslow", X264_ME_UMH, 10, 16, 2,
+      X264_INTER_DEFAULT | X264_ANALYSE_PSUB8x8, TRUE, 24},
+};
+
+/* go faster when encoding takes more than this share of the frame budget,
+ * and slower again below the other one. Going slower waits longer, so
+ * that we don't keep switching back and forth */
+#define SPEED_LOAD_HIGH                0.9
+#define SPEED_LOAD_LOW                 0.6
+#define SPEED_FASTER_FRAMES            8
+#define SPEED_SLOWER_FRAMES            60
+
+/* whether @level is faster than @param in the settings that cost the
+ * most, i.e. slower in none of them and faster in at least one */
+static gboolean
+gst_x264_enc_speed_level_is_faster (const GstX264EncSpeedLevel * level,
+    const x264_param_t * param)
+{
+  if (level->me > param->analyse.i_me_method ||
+      level->subme > param->analyse.i_subpel_refine ||
+      level->ref > param->i_frame_reference)
+    return FALSE;
+
+  return level->me < param->analyse.i_me_method ||
+      level->subme < param->analyse.i_subpel_refine ||
+      level->ref < param->i_frame_reference;
+}
 
 enum
 {
@@ -425,7 +565,8 @@ enum
   GST_X264_ENC_PASS_QUAL,
   GST_X264_ENC_PASS_PASS1 = 0x11,
   GST_X264_ENC_PASS_PASS2,
-  GST_X264_ENC_PASS_PASS3
+  GST_X264_ENC_PASS_PASS3,
+  GST_X264_ENC_PASS_TWO_PASS = 0x20
 };
 
 #define GST_X264_ENC_PASS_TYPE (gst_x264_enc_pass_get_type())
@@ -441,6 +582,8 @@ gst_x264_enc_pass_get_type (void)
     {GST_X264_ENC_PASS_PASS1, "VBR Encoding - Pass 1", "pass1"},
     {GST_X264_ENC_PASS_PASS2, "VBR Encoding - Pass 2", "pass2"},
     {GST_X264_ENC_PASS_PASS3, "VBR Encoding - Pass 3", "pass3"},
+    {GST_X264_ENC_PASS_TWO_PASS, "VBR Encoding - Both passes in one run",
+        "two-pass"},
     {0, NULL, NULL}
   };
 
@@ -665,12 +808,22 @@ static GstStaticPadTemplate src_factory = GST_STATIC_PAD_TEMPLATE ("src",
         "framerate = (fraction) [0/1, MAX], "
         "width = (int) [ 1, MAX ], " "height = (int) [ 1, MAX ], "
         "stream-format = (string) { avc, byte-stream }, "
-        "alignment = (string) au, "
+        "alignment = (string) { au, nal }, "
         "profile = (string) { high-4:4:4, high-4:2:2, high-10, high, main,"
         " baseline, constrained-baseline, high-4:4:4-intra, high-4:2:2-intra,"
         " high-10-intra }")
     );
 
+static GstStaticPadTemplate rendition_factory =
+GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS ("video/x-h264, "
+        "framerate = (fraction) [0/1, MAX], "
+        "width = (int) [ 1, MAX ], " "height = (int) [ 1, MAX ], "
+        "stream-format = (string) byte-stream, " "alignment = (string) au")
+    );
+
 static void gst_x264_enc_finalize (GObject * object);
 static gboolean gst_x264_enc_start (GstVideoEncoder * encoder);
 static gboolean gst_x264_enc_stop (GstVideoEncoder * encoder);
@@ -683,6 +836,7 @@ static GstFlowReturn gst_x264_enc_finish (GstVideoEncoder * encoder);
 static GstFlowReturn gst_x264_enc_handle_frame (GstVideoEncoder * encoder,
     GstVideoCodecFrame * frame);
 static void gst_x264_enc_flush_frames (GstX264Enc * encoder, gboolean send);
+static void gst_x264_enc_clear_chunks (GstX264Enc * encoder);
 static GstFlowReturn gst_x264_enc_encode_frame (GstX264Enc * encoder,
     x264_picture_t * pic_in, GstVideoCodecFrame * input_frame, int *i_nal,
     gboolean send);
@@ -690,6 +844,20 @@ static gboolean gst_x264_enc_set_format (GstVideoEncoder * video_enc,
     GstVideoCodecState * state);
 static gboolean gst_x264_enc_propose_allocation (GstVideoEncoder * encoder,
     GstQuery * query);
+static gboolean gst_x264_enc_decide_allocation (GstVideoEncoder * encoder,
+    GstQuery * query);
+static gboolean gst_x264_enc_sink_event (GstVideoEncoder * encoder,
+    GstEvent * event);
+
+static GstPad *gst_x264_enc_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_x264_enc_release_pad (GstElement * element, GstPad * pad);
+static gboolean gst_x264_enc_open_renditions (GstX264Enc * encoder);
+static void gst_x264_enc_close_renditions (GstX264Enc * encoder);
+static void gst_x264_enc_flush_renditions (GstX264Enc * encoder,
+    gboolean send);
+static void gst_x264_enc_wait_jobs (GstX264Enc * encoder);
+static void gst_x264_enc_abort_chunks (GstX264Enc * encoder, gboolean abort);
 
 static void gst_x264_enc_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec);
@@ -700,6 +868,157 @@ static void gst_x264_enc_get_property (GObject * object, guint prop_id,
 G_DEFINE_TYPE_WITH_CODE (GstX264Enc, gst_x264_enc, GST_TYPE_VIDEO_ENCODER,
     G_IMPLEMENT_INTERFACE (GST_TYPE_PRESET, NULL));
 
+enum
+{
+  ARG_PAD_0,
+  ARG_PAD_BITRATE,
+  ARG_PAD_WIDTH,
+  ARG_PAD_HEIGHT,
+  ARG_PAD_PROFILE
+};
+
+#define ARG_PAD_BITRATE_DEFAULT        0
+#define ARG_PAD_WIDTH_DEFAULT          0
+#define ARG_PAD_HEIGHT_DEFAULT         0
+#define ARG_PAD_PROFILE_DEFAULT        NULL
+
+G_DEFINE_TYPE (GstX264EncPad, gst_x264_enc_pad, GST_TYPE_PAD);
+
+static void
+gst_x264_enc_pad_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstX264EncPad *pad = GST_X264_ENC_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+  switch (prop_id) {
+    case ARG_PAD_BITRATE:
+      pad->bitrate = g_value_get_uint (value);
+      break;
+    case ARG_PAD_WIDTH:
+      pad->width = g_value_get_int (value);
+      break;
+    case ARG_PAD_HEIGHT:
+      pad->height = g_value_get_int (value);
+      break;
+    case ARG_PAD_PROFILE:
+      g_free (pad->profile);
+      pad->profile = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_x264_enc_pad_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstX264EncPad *pad = GST_X264_ENC_PAD (object);
+
+  GST_OBJECT_LOCK (pad);
+  switch (prop_id) {
+    case ARG_PAD_BITRATE:
+      g_value_set_uint (value, pad->bitrate);
+      break;
+    case ARG_PAD_WIDTH:
+      g_value_set_int (value, pad->width);
+      break;
+    case ARG_PAD_HEIGHT:
+      g_value_set_int (value, pad->height);
+      break;
+    case ARG_PAD_PROFILE:
+      g_value_set_string (value, pad->profile);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (pad);
+}
+
+static void
+gst_x264_enc_pad_finalize (GObject * object)
+{
+  GstX264EncPad *pad = GST_X264_ENC_PAD (object);
+
+  g_free (pad->profile);
+  gst_caps_replace (&pad->caps, NULL);
+  gst_buffer_replace (&pad->out_buf, NULL);
+  g_array_free (pad->durations, TRUE);
+
+  G_OBJECT_CLASS (gst_x264_enc_pad_parent_class)->finalize (object);
+}
+
+static void
+gst_x264_enc_pad_class_init (GstX264EncPadClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gst_x264_enc_pad_set_property;
+  gobject_class->get_property = gst_x264_enc_pad_get_property;
+  gobject_class->finalize = gst_x264_enc_pad_finalize;
+
+  /**
+   * GstX264EncPad:bitrate:
+   *
+   * Bitrate of the rendition in kbit/sec, 0 for the bitrate of the element.
+   * Takes effect when the encoder is (re)configured.
+   */
+  g_object_class_install_property (gobject_class, ARG_PAD_BITRATE,
+      g_param_spec_uint ("bitrate", "Bitrate",
+          "Bitrate in kbit/sec (0 = same as the element)", 0, 2000 * 1024,
+          ARG_PAD_BITRATE_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264EncPad:width:
+   *
+   * Width of the rendition. When only one of width and height is set, the
+   * other follows the aspect ratio of the input.
+   */
+  g_object_class_install_property (gobject_class, ARG_PAD_WIDTH,
+      g_param_spec_int ("width", "Width",
+          "Width of the rendition (0 = input width)", 0, G_MAXINT,
+          ARG_PAD_WIDTH_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264EncPad:height:
+   *
+   * Height of the rendition.
+   */
+  g_object_class_install_property (gobject_class, ARG_PAD_HEIGHT,
+      g_param_spec_int ("height", "Height",
+          "Height of the rendition (0 = input height)", 0, G_MAXINT,
+          ARG_PAD_HEIGHT_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264EncPad:profile:
+   *
+   * x264 name of the profile to restrict the rendition to, e.g. "baseline",
+   * "main" or "high".
+   */
+  g_object_class_install_property (gobject_class, ARG_PAD_PROFILE,
+      g_param_spec_string ("profile", "Profile",
+          "x264 profile name (NULL = same as the element)",
+          ARG_PAD_PROFILE_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_x264_enc_pad_init (GstX264EncPad * pad)
+{
+  pad->bitrate = ARG_PAD_BITRATE_DEFAULT;
+  pad->width = ARG_PAD_WIDTH_DEFAULT;
+  pad->height = ARG_PAD_HEIGHT_DEFAULT;
+  pad->profile = g_strdup (ARG_PAD_PROFILE_DEFAULT);
+
+  pad->durations = g_array_new (FALSE, FALSE, sizeof (GstX264EncDuration));
+
+  pad->need_stream_start = TRUE;
+  pad->need_segment = TRUE;
+}
+
 /* don't forget to free the string after use */
 static const gchar *
 gst_x264_enc_build_partitions (gint analyse)
@@ -889,18 +1208,39 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
   gstencoder_class->getcaps = GST_DEBUG_FUNCPTR (gst_x264_enc_sink_getcaps);
   gstencoder_class->propose_allocation =
       GST_DEBUG_FUNCPTR (gst_x264_enc_propose_allocation);
+  gstencoder_class->decide_allocation =
+      GST_DEBUG_FUNCPTR (gst_x264_enc_decide_allocation);
   gstencoder_class->sink_query = GST_DEBUG_FUNCPTR (gst_x264_enc_sink_query);
+  gstencoder_class->sink_event = GST_DEBUG_FUNCPTR (gst_x264_enc_sink_event);
+
+  element_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_x264_enc_request_new_pad);
+  element_class->release_pad = GST_DEBUG_FUNCPTR (gst_x264_enc_release_pad);
 
   /* options for which we don't use string equivalents */
   g_object_class_install_property (gobject_class, ARG_PASS,
       g_param_spec_enum ("pass", "Encoding pass/type",
           "Encoding pass/type", GST_X264_ENC_PASS_TYPE,
           ARG_PASS_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264Enc:two-pass-max-size:
+   *
+   * The most input, in bytes, that pass=two-pass keeps for the second
+   * pass when upstream is not seekable. Encoding fails with an error when
+   * the input is larger. 0 means no limit.
+   */
+  g_object_class_install_property (gobject_class, ARG_TWO_PASS_MAX_SIZE,
+      g_param_spec_uint64 ("two-pass-max-size", "Two-pass maximum size",
+          "Most bytes of input to keep for the second pass (0 = unlimited)",
+          0, G_MAXUINT64, ARG_TWO_PASS_MAX_SIZE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
   g_object_class_install_property (gobject_class, ARG_QUANTIZER,
       g_param_spec_uint ("quantizer", "Constant Quantizer",
           "Constant quantizer or quality to apply",
           0, 50, ARG_QUANTIZER_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   g_object_class_install_property (gobject_class, ARG_BITRATE,
       g_param_spec_uint ("bitrate", "Bitrate", "Bitrate in kbit/sec", 1,
           2000 * 1024, ARG_BITRATE_DEFAULT,
@@ -932,7 +1272,8 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
       g_param_spec_string ("option-string", "Option string",
           "String of x264 options (overridden by element properties)",
           ARG_OPTION_STRING_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
 
   g_object_class_install_property (gobject_class, ARG_FRAME_PACKING,
       g_param_spec_enum ("frame-packing", "Frame Packing",
@@ -945,6 +1286,147 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
           "Insert VUI NAL in stream",
           ARG_INSERT_VUI_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstX264Enc:adaptive-speed:
+   *
+   * Measure the encoding time of every frame against the frame duration,
+   * or the time QoS leaves for it, and step between the settings of the
+   * speed presets to keep up in realtime. The encoder never gets slower
+   * than the settings it started with, and goes back to exactly those
+   * when it keeps up again or adaptive speed is disabled.
+   */
+  g_object_class_install_property (gobject_class, ARG_ADAPTIVE_SPEED,
+      g_param_spec_boolean ("adaptive-speed", "Adaptive speed",
+          "Trade quality for speed when encoding doesn't keep up",
+          ARG_ADAPTIVE_SPEED_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  /**
+   * GstX264Enc:timing-stats:
+   *
+   * Encoding time statistics, with the number of frames, the last,
+   * average and maximum encoding time and the budget of the last frame in
+   * nanoseconds, the load (the average share of the budget spent encoding)
+   * and the speed level of #GstX264Enc:adaptive-speed ("configured" for
+   * the settings it started with) with the number of times it changed.
+   */
+  g_object_class_install_property (gobject_class, ARG_TIMING_STATS,
+      g_param_spec_boxed ("timing-stats", "Timing statistics",
+          "Encoding time statistics", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264Enc:low-latency:
+   *
+   * Encode for the lowest latency: no lookahead or B-frames, sliced threads
+   * and intra refresh instead of IDR frames. Slices are limited to
+   * #GstX264Enc:slice-max-size and pushed as soon as x264 finished them,
+   * in byte-stream format with NAL alignment. The last buffer of each
+   * frame has the MARKER flag set.
+   */
+  g_object_class_install_property (gobject_class, ARG_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Push slices as soon as they are encoded",
+          ARG_LOW_LATENCY_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264Enc:slice-max-size:
+   *
+   * Maximum size of a slice in bytes in #GstX264Enc:low-latency mode, e.g.
+   * the MTU minus the packet headers.
+   */
+  g_object_class_install_property (gobject_class, ARG_SLICE_MAX_SIZE,
+      g_param_spec_uint ("slice-max-size", "Slice max size",
+          "Maximum slice size in bytes in low-latency mode (0 = unlimited)",
+          0, G_MAXINT, ARG_SLICE_MAX_SIZE_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264Enc:roi-delta-qp:
+   *
+   * Quantizer offset for the macroblocks in a #GstVideoRegionOfInterestMeta
+   * of the input buffers, when neither #GstX264Enc:roi-types nor the meta
+   * itself gives one. Negative values spend more bits on the region.
+   */
+  g_object_class_install_property (gobject_class, ARG_ROI_DELTA_QP,
+      g_param_spec_float ("roi-delta-qp", "ROI delta QP",
+          "Quantizer offset for regions of interest", -51.0, 51.0,
+          ARG_ROI_DELTA_QP_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  /**
+   * GstX264Enc:roi-types:
+   *
+   * Quantizer offsets per region of interest type, as a structure with a
+   * double field for each type, e.g.
+   * "roi-types,face=(double)-8,license-plate=(double)-10".
+   *
+   * A "roi/x264enc" parameter with a "delta-qp" double field on a
+   * #GstVideoRegionOfInterestMeta takes precedence for that region.
+   */
+  g_object_class_install_property (gobject_class, ARG_ROI_TYPES,
+      g_param_spec_boxed ("roi-types", "ROI types",
+          "Quantizer offsets per region of interest type", GST_TYPE_STRUCTURE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  /**
+   * GstX264Enc:chunk-frames:
+   *
+   * Cut the input into chunks of at most this many frames that are encoded
+   * in parallel, each starting with an IDR frame. Scene changes and
+   * keyframes that are asked for end a chunk early. Meant for offline
+   * encoding, the output waits for whole chunks.
+   */
+  g_object_class_install_property (gobject_class, ARG_CHUNK_FRAMES,
+      g_param_spec_uint ("chunk-frames", "Chunk frames",
+          "Encode chunks of up to this many frames in parallel (0 = disabled)",
+          0, G_MAXINT, ARG_CHUNK_FRAMES_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264Enc:chunk-encoders:
+   *
+   * Number of chunks of #GstX264Enc:chunk-frames that are encoded at the
+   * same time, each with a share of the threads.
+   */
+  g_object_class_install_property (gobject_class, ARG_CHUNK_ENCODERS,
+      g_param_spec_uint ("chunk-encoders", "Chunk encoders",
+          "Number of chunks to encode at the same time (0 = automatic)",
+          0, 256, ARG_CHUNK_ENCODERS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstX264Enc:frame-stats:
+   *
+   * Send a custom downstream event after every buffer, with a
+   * "x264enc-frame-stats" structure: the pts, the frame type, the size in
+   * bytes, the average qp, the latency of the frame in the encoder in
+   * nanoseconds, and the ssim and psnr when the option-string enables
+   * them.
+   */
+  g_object_class_install_property (gobject_class, ARG_FRAME_STATS,
+      g_param_spec_boolean ("frame-stats", "Frame statistics",
+          "Send an event with statistics after every frame",
+          ARG_FRAME_STATS_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
+
+  /**
+   * GstX264Enc:rolling-stats:
+   *
+   * Statistics over the last frames: the number of frames, the average
+   * qp (and ssim and psnr when enabled), the bitrate in bits per second,
+   * the 50th, 90th and 99th percentile of the latency in the encoder in
+   * nanoseconds, and the number of frames that were still in the encoder.
+   */
+  g_object_class_install_property (gobject_class, ARG_ROLLING_STATS,
+      g_param_spec_boxed ("rolling-stats", "Rolling statistics",
+          "Statistics over the last frames", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   /* options for which we _do_ use string equivalents */
   g_object_class_install_property (gobject_class, ARG_THREADS,
       g_param_spec_uint ("threads", "Threads",
@@ -991,19 +1473,23 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
   g_object_class_install_property (gobject_class, ARG_ME,
       g_param_spec_enum ("me", "Motion Estimation",
           "Integer pixel motion estimation method", GST_X264_ENC_ME_TYPE,
-          ARG_ME_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          ARG_ME_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   g_string_append_printf (x264enc_defaults, ":me=%s",
       x264_motion_est_names[ARG_ME_DEFAULT]);
   g_object_class_install_property (gobject_class, ARG_SUBME,
       g_param_spec_uint ("subme", "Subpixel Motion Estimation",
           "Subpixel motion estimation and partition decision quality: 1=fast, 10=best",
           1, 10, ARG_SUBME_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   g_string_append_printf (x264enc_defaults, ":subme=%d", ARG_SUBME_DEFAULT);
   g_object_class_install_property (gobject_class, ARG_ANALYSE,
       g_param_spec_flags ("analyse", "Analyse", "Partitions to consider",
           GST_X264_ENC_ANALYSE_TYPE, ARG_ANALYSE_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   partitions = gst_x264_enc_build_partitions (ARG_ANALYSE_DEFAULT);
   if (partitions) {
     g_string_append_printf (x264enc_defaults, ":partitions=%s", partitions);
@@ -1017,7 +1503,9 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
   g_object_class_install_property (gobject_class, ARG_REF,
       g_param_spec_uint ("ref", "Reference Frames",
           "Number of reference frames",
-          1, 12, ARG_REF_DEFAULT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          1, 12, ARG_REF_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   g_string_append_printf (x264enc_defaults, ":ref=%d", ARG_REF_DEFAULT);
   g_object_class_install_property (gobject_class, ARG_BFRAMES,
       g_param_spec_uint ("bframes", "B-Frames",
@@ -1055,7 +1543,8 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
   g_object_class_install_property (gobject_class, ARG_TRELLIS,
       g_param_spec_boolean ("trellis", "Trellis quantization",
           "Enable trellis searched quantization", ARG_TRELLIS_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   g_string_append_printf (x264enc_defaults, ":trellis=%d", ARG_TRELLIS_DEFAULT);
   g_object_class_install_property (gobject_class, ARG_KEYINT_MAX,
       g_param_spec_uint ("key-int-max", "Key-frame maximal interval",
@@ -1114,7 +1603,8 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
       g_param_spec_uint ("noise-reduction", "Noise Reduction",
           "Noise reduction strength",
           0, 100000, ARG_NR_DEFAULT,
-          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_PLAYING));
   g_string_append_printf (x264enc_defaults, ":nr=%d", ARG_NR_DEFAULT);
   g_object_class_install_property (gobject_class, ARG_INTERLACED,
       g_param_spec_boolean ("interlaced", "Interlaced",
@@ -1148,6 +1638,9 @@ gst_x264_enc_class_init (GstX264EncClass * klass)
 
   gst_element_class_add_pad_template (element_class, sink_templ);
   gst_element_class_add_static_pad_template (element_class, &src_factory);
+  gst_element_class_add_pad_template (element_class,
+      gst_pad_template_new_from_static_pad_template_with_gtype
+      (&rendition_factory, GST_TYPE_X264_ENC_PAD));
 }
 
 static void
@@ -1231,12 +1724,40 @@ gst_x264_enc_init (GstX264Enc * encoder)
   encoder->tune = ARG_TUNE_DEFAULT;
   encoder->frame_packing = ARG_FRAME_PACKING_DEFAULT;
   encoder->insert_vui = ARG_INSERT_VUI_DEFAULT;
+  encoder->adaptive_speed = ARG_ADAPTIVE_SPEED_DEFAULT;
+  encoder->low_latency = ARG_LOW_LATENCY_DEFAULT;
+  encoder->slice_max_size = ARG_SLICE_MAX_SIZE_DEFAULT;
+  encoder->roi_delta_qp = ARG_ROI_DELTA_QP_DEFAULT;
+  encoder->chunk_frames = ARG_CHUNK_FRAMES_DEFAULT;
+  encoder->chunk_encoders = ARG_CHUNK_ENCODERS_DEFAULT;
+  encoder->frame_stats = ARG_FRAME_STATS_DEFAULT;
+  encoder->two_pass_max_size = ARG_TWO_PASS_MAX_SIZE_DEFAULT;
+  encoder->speed_level = -1;
+  encoder->events_frame = -1;
+
+  g_queue_init (&encoder->pending_frames);
+  g_queue_init (&encoder->free_frames);
+  g_queue_init (&encoder->chunks);
+
+  g_mutex_init (&encoder->jobs_lock);
+  g_cond_init (&encoder->jobs_cond);
+  g_mutex_init (&encoder->slice_lock);
+
+  /* the main stream and the renditions only stop together */
+  encoder->flow_combiner = gst_flow_combiner_new ();
+  gst_flow_combiner_add_pad (encoder->flow_combiner,
+      GST_VIDEO_ENCODER_SRC_PAD (encoder));
 }
 
+/* Passed to x264 as the opaque pointer of the picture, so that the output
+ * picture leads straight back to its frame */
 typedef struct
 {
+  GstX264Enc *encoder;
   GstVideoCodecFrame *frame;
   GstVideoFrame vframe;
+  GstClockTime start;           /* when it went into the encoder */
+  GList link;                   /* in pending_frames or free_frames */
 } FrameData;
 
 static FrameData *
@@ -1245,155 +1766,589 @@ gst_x264_enc_queue_frame (GstX264Enc * enc, GstVideoCodecFrame * frame,
 {
   GstVideoFrame vframe;
   FrameData *fdata;
+  GList *link;
 
   if (!gst_video_frame_map (&vframe, info, frame->input_buffer, GST_MAP_READ))
     return NULL;
 
-  fdata = g_slice_new (FrameData);
+  if ((link = g_queue_pop_head_link (&enc->free_frames))) {
+    fdata = link->data;
+  } else {
+    fdata = g_slice_new0 (FrameData);
+    fdata->link.data = fdata;
+  }
+  fdata->encoder = enc;
   fdata->frame = gst_video_codec_frame_ref (frame);
   fdata->vframe = vframe;
+  fdata->start = gst_util_get_timestamp ();
 
-  enc->pending_frames = g_list_prepend (enc->pending_frames, fdata);
+  g_queue_push_tail_link (&enc->pending_frames, &fdata->link);
 
   return fdata;
 }
 
 static void
-gst_x264_enc_dequeue_frame (GstX264Enc * enc, GstVideoCodecFrame * frame)
+gst_x264_enc_dequeue_frame (GstX264Enc * enc, FrameData * fdata)
 {
-  GList *l;
-
-  for (l = enc->pending_frames; l; l = l->next) {
-    FrameData *fdata = l->data;
+  gst_video_frame_unmap (&fdata->vframe);
+  gst_video_codec_frame_unref (fdata->frame);
+  fdata->frame = NULL;
 
-    if (fdata->frame != frame)
-      continue;
-
-    gst_video_frame_unmap (&fdata->vframe);
-    gst_video_codec_frame_unref (fdata->frame);
-    g_slice_free (FrameData, fdata);
-
-    enc->pending_frames = g_list_delete_link (enc->pending_frames, l);
-    return;
-  }
+  g_queue_unlink (&enc->pending_frames, &fdata->link);
+  g_queue_push_head_link (&enc->free_frames, &fdata->link);
 }
 
 static void
 gst_x264_enc_dequeue_all_frames (GstX264Enc * enc)
 {
-  GList *l;
+  GList *link;
 
-  for (l = enc->pending_frames; l; l = l->next) {
-    FrameData *fdata = l->data;
+  while ((link = enc->pending_frames.head))
+    gst_x264_enc_dequeue_frame (enc, link->data);
+}
 
-    gst_video_frame_unmap (&fdata->vframe);
-    gst_video_codec_frame_unref (fdata->frame);
-    g_slice_free (FrameData, fdata);
+static const gchar *
+gst_x264_enc_frame_type_name (gint type)
+{
+  switch (type) {
+    case X264_TYPE_IDR:
+      return "IDR";
+    case X264_TYPE_I:
+    case X264_TYPE_KEYFRAME:
+      return "I";
+    case X264_TYPE_P:
+      return "P";
+    case X264_TYPE_BREF:
+      return "Bref";
+    case X264_TYPE_B:
+      return "B";
+    default:
+      return "unknown";
   }
-  g_list_free (enc->pending_frames);
-  enc->pending_frames = NULL;
 }
 
-static gboolean
-gst_x264_enc_start (GstVideoEncoder * encoder)
+static void
+gst_x264_enc_get_frame_stats (GstX264EncFrameStats * stats,
+    const x264_param_t * param, const x264_picture_t * pic_out, gsize size,
+    GstClockTime start)
 {
-  GstX264Enc *x264enc = GST_X264_ENC (encoder);
-
-  x264enc->current_byte_stream = GST_X264_ENC_STREAM_FORMAT_FROM_PROPERTY;
-
-  /* make sure that we have enough time for first DTS,
-     this is probably overkill for most streams */
-  gst_video_encoder_set_min_pts (encoder, GST_SECOND * 60 * 60 * 1000);
-
-  return TRUE;
+  stats->pts = pic_out->i_pts;
+  stats->type = pic_out->i_type;
+  stats->qp = pic_out->i_qpplus1 - 1;
+  stats->size = size;
+  stats->ssim = param->analyse.b_ssim ? pic_out->prop.f_ssim : -1;
+  stats->psnr = param->analyse.b_psnr ? pic_out->prop.f_psnr_avg : -1;
+  stats->latency = gst_util_get_timestamp () - start;
 }
 
-static gboolean
-gst_x264_enc_stop (GstVideoEncoder * encoder)
+/* account for a frame that was just output, and tell downstream about it
+ * when asked to */
+static void
+gst_x264_enc_add_frame_stats (GstX264Enc * enc, GstX264EncFrameStats * stats,
+    gint delayed)
 {
-  GstX264Enc *x264enc = GST_X264_ENC (encoder);
+  GstStructure *s;
+  gboolean send;
+
+  GST_OBJECT_LOCK (enc);
+  enc->stats_window[enc->stats_window_pos] = *stats;
+  enc->stats_window_pos = (enc->stats_window_pos + 1) %
+      GST_X264_ENC_STATS_WINDOW;
+  enc->stats_window_len = MIN (enc->stats_window_len + 1,
+      GST_X264_ENC_STATS_WINDOW);
+  enc->stats_delayed = delayed;
+  send = enc->frame_stats;
+  GST_OBJECT_UNLOCK (enc);
+
+  if (!send)
+    return;
 
-  gst_x264_enc_flush_frames (x264enc, FALSE);
-  gst_x264_enc_close_encoder (x264enc);
-  gst_x264_enc_dequeue_all_frames (x264enc);
+  s = gst_structure_new ("x264enc-frame-stats",
+      "pts", G_TYPE_UINT64, stats->pts,
+      "type", G_TYPE_STRING, gst_x264_enc_frame_type_name (stats->type),
+      "size", G_TYPE_UINT, (guint) stats->size,
+      "latency", G_TYPE_UINT64, stats->latency, NULL);
+  if (stats->qp >= 0)
+    gst_structure_set (s, "qp", G_TYPE_DOUBLE, stats->qp, NULL);
+  if (stats->ssim >= 0)
+    gst_structure_set (s, "ssim", G_TYPE_DOUBLE, stats->ssim, NULL);
+  if (stats->psnr >= 0)
+    gst_structure_set (s, "psnr", G_TYPE_DOUBLE, stats->psnr, NULL);
+
+  gst_pad_push_event (GST_VIDEO_ENCODER_SRC_PAD (enc),
+      gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM, s));
+}
 
-  if (x264enc->input_state)
-    gst_video_codec_state_unref (x264enc->input_state);
-  x264enc->input_state = NULL;
+static gint
+gst_x264_enc_compare_latency (const void *a, const void *b)
+{
+  GstClockTime la = *(const GstClockTime *) a;
+  GstClockTime lb = *(const GstClockTime *) b;
 
-  return TRUE;
+  return la < lb ? -1 : la > lb;
 }
 
-
-static gboolean
-gst_x264_enc_flush (GstVideoEncoder * encoder)
+/* with the object lock */
+static GstStructure *
+gst_x264_enc_get_rolling_stats (GstX264Enc * enc)
 {
-  GstX264Enc *x264enc = GST_X264_ENC (encoder);
+  GstClockTime latency[GST_X264_ENC_STATS_WINDOW];
+  GstClockTime min_pts = G_MAXUINT64, max_pts = 0;
+  gdouble qp = 0, ssim = 0, psnr = 0;
+  guint n_qp = 0, n_ssim = 0, n_psnr = 0;
+  guint i, n = enc->stats_window_len;
+  guint64 bits = 0, bitrate = 0;
+  GstStructure *s;
 
-  gst_x264_enc_flush_frames (x264enc, FALSE);
-  gst_x264_enc_close_encoder (x264enc);
-  gst_x264_enc_dequeue_all_frames (x264enc);
+  for (i = 0; i < n; i++) {
+    GstX264EncFrameStats *stats = &enc->stats_window[i];
 
-  gst_x264_enc_init_encoder (x264enc);
+    latency[i] = stats->latency;
+    bits += stats->size * 8;
+    if (GST_CLOCK_TIME_IS_VALID (stats->pts)) {
+      min_pts = MIN (min_pts, stats->pts);
+      max_pts = MAX (max_pts, stats->pts);
+    }
+    if (stats->qp >= 0) {
+      qp += stats->qp;
+      n_qp++;
+    }
+    if (stats->ssim >= 0) {
+      ssim += stats->ssim;
+      n_ssim++;
+    }
+    if (stats->psnr >= 0) {
+      psnr += stats->psnr;
+      n_psnr++;
+    }
+  }
 
-  return TRUE;
+  /* the frames span one frame duration more than their PTS */
+  if (n > 1 && max_pts > min_pts)
+    bitrate = gst_util_uint64_scale (bits, GST_SECOND * (n - 1),
+        (max_pts - min_pts) * n);
+
+  qsort (latency, n, sizeof (GstClockTime), gst_x264_enc_compare_latency);
+
+  s = gst_structure_new ("x264enc-stats",
+      "frames", G_TYPE_UINT, n,
+      "bitrate", G_TYPE_UINT64, bitrate,
+      "latency-p50", G_TYPE_UINT64, n ? latency[n / 2] : 0,
+      "latency-p90", G_TYPE_UINT64, n ? latency[n * 9 / 10] : 0,
+      "latency-p99", G_TYPE_UINT64, n ? latency[n * 99 / 100] : 0,
+      "delayed-frames", G_TYPE_INT, enc->stats_delayed, NULL);
+  if (n_qp)
+    gst_structure_set (s, "average-qp", G_TYPE_DOUBLE, qp / n_qp, NULL);
+  if (n_ssim)
+    gst_structure_set (s, "average-ssim", G_TYPE_DOUBLE, ssim / n_ssim, NULL);
+  if (n_psnr)
+    gst_structure_set (s, "average-psnr", G_TYPE_DOUBLE, psnr / n_psnr, NULL);
+
+  return s;
 }
 
 static void
-gst_x264_enc_finalize (GObject * object)
+gst_x264_enc_free_frame_pool (GstX264Enc * enc)
 {
-  GstX264Enc *encoder = GST_X264_ENC (object);
+  GList *link;
 
-  if (encoder->input_state)
-    gst_video_codec_state_unref (encoder->input_state);
-  encoder->input_state = NULL;
+  while ((link = g_queue_pop_head_link (&enc->free_frames)))
+    g_slice_free (FrameData, link->data);
+}
 
-#define FREE_STRING(ptr) \
-  if (ptr) \
-    g_string_free (ptr, TRUE);
+static void
+gst_x264_enc_clear_output_pool (GstX264Enc * enc)
+{
+  if (enc->output_pool) {
+    gst_buffer_pool_set_active (enc->output_pool, FALSE);
+    gst_object_unref (enc->output_pool);
+    enc->output_pool = NULL;
+  }
+  enc->output_pool_size = 0;
+}
 
-  FREE_STRING (encoder->tunings);
-  FREE_STRING (encoder->option_string);
-  FREE_STRING (encoder->option_string_prop);
+/* make a pool for output buffers of at least @size bytes. Buffers of the
+ * old pool that are still downstream are freed when they come back. */
+static void
+gst_x264_enc_configure_output_pool (GstX264Enc * enc, gsize size)
+{
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstAllocator *allocator;
+  GstAllocationParams params;
+
+  gst_x264_enc_clear_output_pool (enc);
+
+  /* leave room for bigger frames so that this doesn't happen often */
+  size = GST_ROUND_UP_N (MAX (size + size / 2, 64 * 1024), 4096);
+
+  gst_video_encoder_get_allocator (GST_VIDEO_ENCODER (enc), &allocator,
+      &params);
+
+  pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, NULL, size, 0, 0);
+  gst_buffer_pool_config_set_allocator (config, allocator, &params);
+  if (allocator)
+    gst_object_unref (allocator);
+
+  /* don't retry before a frame needs more */
+  enc->output_pool_size = size;
+
+  if (!gst_buffer_pool_set_config (pool, config) ||
+      !gst_buffer_pool_set_active (pool, TRUE)) {
+    GST_WARNING_OBJECT (enc, "failed to set up pool of %" G_GSIZE_FORMAT
+        " bytes buffers", size);
+    gst_object_unref (pool);
+    return;
+  }
 
-#undef FREE_STRING
+  GST_DEBUG_OBJECT (enc, "output pool of %" G_GSIZE_FORMAT " bytes buffers",
+      size);
+  enc->output_pool = pool;
+}
 
-  g_free (encoder->mp_cache_file);
-  encoder->mp_cache_file = NULL;
+static GstBuffer *
+gst_x264_enc_alloc_output_buffer (GstX264Enc * enc, gsize size)
+{
+  GstBuffer *buf = NULL;
 
-  gst_x264_enc_close_encoder (encoder);
+  if (size > enc->output_pool_size)
+    gst_x264_enc_configure_output_pool (enc, size);
 
-  G_OBJECT_CLASS (parent_class)->finalize (object);
+  if (enc->output_pool &&
+      gst_buffer_pool_acquire_buffer (enc->output_pool, &buf,
+          NULL) == GST_FLOW_OK) {
+    gst_buffer_set_size (buf, size);
+    return buf;
+  }
+
+  return gst_video_encoder_allocate_output_buffer (GST_VIDEO_ENCODER (enc),
+      size);
 }
 
-/*
- * gst_x264_enc_parse_options
- * @encoder: Encoder to which options are assigned
- * @str: Option string
- *
- * Parse option string and assign to x264 parameters
- *
- */
-static gboolean
-gst_x264_enc_parse_options (GstX264Enc * encoder, const gchar * str)
+static gint
+gst_x264_enc_compare_first_mb (gconstpointer a, gconstpointer b)
 {
-  GStrv kvpairs;
-  guint npairs, i;
-  gint parse_result = 0, ret = 0;
-  gchar *options = (gchar *) str;
+  return (gint) GST_BUFFER_OFFSET (a) - (gint) GST_BUFFER_OFFSET (b);
+}
 
-  while (*options == ':')
-    options++;
+/* with the slice lock. Keep @buf back, and send out the previous slice */
+static void
+gst_x264_enc_output_slice (GstX264Enc * enc, GstBuffer * buf)
+{
+  GstBuffer *prev = enc->held_slice;
 
-  kvpairs = g_strsplit (options, ":", 0);
-  npairs = g_strv_length (kvpairs);
+  enc->held_slice = buf;
+  if (!prev)
+    return;
 
-  for (i = 0; i < npairs; i++) {
-    GStrv key_val = g_strsplit (kvpairs[i], "=", 2);
+  if (!enc->push_slices) {
+    enc->slice_au = enc->slice_au ? gst_buffer_append (enc->slice_au,
+        prev) : prev;
+  } else if (enc->slice_flow == GST_FLOW_OK) {
+    enc->slice_flow = gst_pad_push (GST_VIDEO_ENCODER_SRC_PAD (enc), prev);
+  } else {
+    gst_buffer_unref (prev);
+  }
+}
 
-    parse_result =
-        encoder->vtable->x264_param_parse (&encoder->x264param, key_val[0],
-        key_val[1]);
+/* with the slice lock. Output the waiting slices that are next in
+ * macroblock order, or all of them */
+static void
+gst_x264_enc_output_pending_slices (GstX264Enc * enc, gboolean all)
+{
+  GstBuffer *buf;
+
+  while (enc->pending_slices) {
+    buf = enc->pending_slices->data;
+    if (!all && GST_BUFFER_OFFSET (buf) != enc->next_mb)
+      break;
+
+    enc->pending_slices = g_list_delete_link (enc->pending_slices,
+        enc->pending_slices);
+    enc->next_mb = GST_BUFFER_OFFSET_END (buf) + 1;
+    GST_BUFFER_OFFSET (buf) = GST_BUFFER_OFFSET_NONE;
+    GST_BUFFER_OFFSET_END (buf) = GST_BUFFER_OFFSET_NONE;
+    gst_x264_enc_output_slice (enc, buf);
+  }
+}
+
+/* Called by x264 for every NAL unit as soon as it is encoded, from the
+ * slice threads and in any order */
+static void
+gst_x264_enc_nalu_process (x264_t * h, x264_nal_t * nal, void *opaque)
+{
+  FrameData *fdata = opaque;
+  GstX264Enc *enc = fdata->encoder;
+  GstBuffer *buf;
+  GstMapInfo map;
+
+  /* the size x264 asks for */
+  buf = gst_buffer_new_allocate (NULL, nal->i_payload * 3 / 2 + 5 + 64, NULL);
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  enc->vtable->x264_nal_encode (h, map.data, nal);
+  gst_buffer_unmap (buf, &map);
+  gst_buffer_set_size (buf, nal->i_payload);
+
+  /* there are no B-frames in low-latency mode */
+  GST_BUFFER_PTS (buf) = fdata->frame->pts;
+  GST_BUFFER_DTS (buf) = fdata->frame->pts;
+  if (nal->i_type == NAL_SPS || nal->i_type == NAL_PPS)
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_HEADER);
+  else if (nal->i_type != NAL_SLICE_IDR)
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  g_mutex_lock (&enc->slice_lock);
+  if (nal->i_type == NAL_SLICE || nal->i_type == NAL_SLICE_IDR) {
+    GST_BUFFER_OFFSET (buf) = nal->i_first_mb;
+    GST_BUFFER_OFFSET_END (buf) = nal->i_last_mb;
+    enc->pending_slices = g_list_insert_sorted (enc->pending_slices, buf,
+        gst_x264_enc_compare_first_mb);
+    gst_x264_enc_output_pending_slices (enc, FALSE);
+  } else {
+    /* headers and SEI, which come before the slices */
+    gst_x264_enc_output_slice (enc, buf);
+  }
+  g_mutex_unlock (&enc->slice_lock);
+}
+
+static void
+gst_x264_enc_clear_slices (GstX264Enc * enc)
+{
+  g_mutex_lock (&enc->slice_lock);
+  g_list_free_full (enc->pending_slices, (GDestroyNotify) gst_buffer_unref);
+  enc->pending_slices = NULL;
+  gst_buffer_replace (&enc->held_slice, NULL);
+  gst_buffer_replace (&enc->slice_au, NULL);
+  enc->next_mb = 0;
+  enc->slice_flow = GST_FLOW_OK;
+  g_mutex_unlock (&enc->slice_lock);
+}
+
+/* the rest of the frame after encoding, with the MARKER flag set */
+static GstBuffer *
+gst_x264_enc_take_slices (GstX264Enc * enc, GstFlowReturn * flow)
+{
+  GstBuffer *buf;
+
+  g_mutex_lock (&enc->slice_lock);
+  gst_x264_enc_output_pending_slices (enc, TRUE);
+
+  buf = enc->held_slice;
+  enc->held_slice = NULL;
+  if (enc->slice_au) {
+    buf = buf ? gst_buffer_append (enc->slice_au, buf) : enc->slice_au;
+    enc->slice_au = NULL;
+  }
+  *flow = enc->slice_flow;
+  g_mutex_unlock (&enc->slice_lock);
+
+  if (buf) {
+    buf = gst_buffer_make_writable (buf);
+    GST_BUFFER_FLAG_UNSET (buf, GST_BUFFER_FLAG_HEADER);
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_MARKER);
+  }
+
+  return buf;
+}
+
+/* with the object lock. A private directory for the statistics of the
+ * first pass, on tmpfs where the system has a runtime directory */
+static gboolean
+gst_x264_enc_make_stats_dir (GstX264Enc * encoder)
+{
+  gchar *dir;
+
+  dir = g_build_filename (g_get_user_runtime_dir (), "x264enc-XXXXXX", NULL);
+  if (!g_mkdtemp (dir)) {
+    GST_ERROR_OBJECT (encoder, "Could not create %s for the first pass "
+        "statistics: %s", dir, g_strerror (errno));
+    g_free (dir);
+    return FALSE;
+  }
+
+  encoder->stats_dir = dir;
+  encoder->stats_file = g_build_filename (dir, "x264.log", NULL);
+  GST_DEBUG_OBJECT (encoder, "first pass statistics in %s",
+      encoder->stats_file);
+
+  return TRUE;
+}
+
+static void
+gst_x264_enc_remove_stats_dir (GstX264Enc * encoder)
+{
+  /* x264 writes to a temporary file first, and the MB-tree data next to
+   * the statistics */
+  static const gchar *suffixes[] = { "", ".temp", ".mbtree", ".mbtree.temp" };
+  gchar *path;
+  guint i;
+
+  if (!encoder->stats_dir)
+    return;
+
+  for (i = 0; i < G_N_ELEMENTS (suffixes); i++) {
+    path = g_strconcat (encoder->stats_file, suffixes[i], NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  g_rmdir (encoder->stats_dir);
+
+  g_free (encoder->stats_dir);
+  encoder->stats_dir = NULL;
+  g_free (encoder->stats_file);
+  encoder->stats_file = NULL;
+}
+
+static gboolean
+gst_x264_enc_start (GstVideoEncoder * encoder)
+{
+  GstX264Enc *x264enc = GST_X264_ENC (encoder);
+
+  x264enc->current_byte_stream = GST_X264_ENC_STREAM_FORMAT_FROM_PROPERTY;
+  x264enc->first_pass = (x264enc->pass == GST_X264_ENC_PASS_TWO_PASS);
+  x264enc->first_pass_size = 0;
+  gst_flow_combiner_reset (x264enc->flow_combiner);
+  x264enc->events_pending = FALSE;
+  x264enc->events_frame = -1;
+  gst_x264_enc_abort_chunks (x264enc, FALSE);
+
+  GST_OBJECT_LOCK (x264enc);
+  x264enc->stats_frames = 0;
+  x264enc->stats_last = 0;
+  x264enc->stats_average = 0;
+  x264enc->stats_max = 0;
+  x264enc->stats_speed_changes = 0;
+  x264enc->stats_window_pos = 0;
+  x264enc->stats_window_len = 0;
+  x264enc->stats_delayed = 0;
+  x264enc->frame_budget = GST_CLOCK_TIME_NONE;
+  GST_OBJECT_UNLOCK (x264enc);
+
+  /* make sure that we have enough time for first DTS,
+     this is probably overkill for most streams */
+  gst_video_encoder_set_min_pts (encoder, GST_SECOND * 60 * 60 * 1000);
+
+  return TRUE;
+}
+
+static gboolean
+gst_x264_enc_stop (GstVideoEncoder * encoder)
+{
+  GstX264Enc *x264enc = GST_X264_ENC (encoder);
+
+  gst_x264_enc_flush_frames (x264enc, FALSE);
+  gst_x264_enc_close_encoder (x264enc);
+  gst_x264_enc_dequeue_all_frames (x264enc);
+  gst_x264_enc_free_frame_pool (x264enc);
+  gst_x264_enc_clear_output_pool (x264enc);
+  gst_x264_enc_clear_slices (x264enc);
+  gst_x264_enc_remove_stats_dir (x264enc);
+
+  if (x264enc->input_state)
+    gst_video_codec_state_unref (x264enc->input_state);
+  x264enc->input_state = NULL;
+
+  return TRUE;
+}
+
+
+static gboolean
+gst_x264_enc_flush (GstVideoEncoder * encoder)
+{
+  GstX264Enc *x264enc = GST_X264_ENC (encoder);
+
+  gst_x264_enc_flush_frames (x264enc, FALSE);
+  gst_x264_enc_close_encoder (x264enc);
+  gst_x264_enc_dequeue_all_frames (x264enc);
+  gst_flow_combiner_reset (x264enc->flow_combiner);
+  x264enc->events_pending = FALSE;
+  x264enc->events_frame = -1;
+  gst_x264_enc_abort_chunks (x264enc, FALSE);
+
+  gst_x264_enc_init_encoder (x264enc);
+
+  return TRUE;
+}
+
+static void
+gst_x264_enc_finalize (GObject * object)
+{
+  GstX264Enc *encoder = GST_X264_ENC (object);
+
+  if (encoder->input_state)
+    gst_video_codec_state_unref (encoder->input_state);
+  encoder->input_state = NULL;
+
+#define FREE_STRING(ptr) \
+  if (ptr) \
+    g_string_free (ptr, TRUE);
+
+  FREE_STRING (encoder->tunings);
+  FREE_STRING (encoder->option_string);
+  FREE_STRING (encoder->option_string_prop);
+
+#undef FREE_STRING
+
+  g_free (encoder->mp_cache_file);
+  encoder->mp_cache_file = NULL;
+
+  gst_x264_enc_close_encoder (encoder);
+  gst_x264_enc_dequeue_all_frames (encoder);
+  gst_x264_enc_free_frame_pool (encoder);
+  gst_x264_enc_clear_output_pool (encoder);
+
+  g_list_free_full (encoder->renditions, gst_object_unref);
+  encoder->renditions = NULL;
+  gst_flow_combiner_free (encoder->flow_combiner);
+  gst_x264_enc_clear_chunks (encoder);
+  if (encoder->workers)
+    g_thread_pool_free (encoder->workers, FALSE, TRUE);
+  encoder->workers = NULL;
+  g_mutex_clear (&encoder->jobs_lock);
+  g_cond_clear (&encoder->jobs_cond);
+  gst_x264_enc_clear_slices (encoder);
+  g_mutex_clear (&encoder->slice_lock);
+
+  if (encoder->roi_types)
+    gst_structure_free (encoder->roi_types);
+  encoder->roi_types = NULL;
+  g_free (encoder->quant_offsets);
+  encoder->quant_offsets = NULL;
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/*
+ * gst_x264_enc_parse_options
+ * @encoder: Encoder to which options are assigned
+ * @param: Parameters of the encoder, or of one of its renditions
+ * @str: Option string
+ *
+ * Parse option string and assign to x264 parameters
+ *
+ */
+static gboolean
+gst_x264_enc_parse_options (GstX264Enc * encoder, x264_param_t * param,
+    const gchar * str)
+{
+  GStrv kvpairs;
+  guint npairs, i;
+  gint parse_result = 0, ret = 0;
+  gchar *options = (gchar *) str;
+
+  while (*options == ':')
+    options++;
+
+  kvpairs = g_strsplit (options, ":", 0);
+  npairs = g_strv_length (kvpairs);
+
+  for (i = 0; i < npairs; i++) {
+    GStrv key_val = g_strsplit (kvpairs[i], "=", 2);
+
+    parse_result =
+        encoder->vtable->x264_param_parse (param, key_val[0], key_val[1]);
 
     if (parse_result == X264_PARAM_BAD_NAME) {
       GST_ERROR_OBJECT (encoder, "Bad name for option %s=%s",
@@ -1515,7 +2470,7 @@ gst_x264_enc_init_encoder (GstX264Enc * encoder)
   if (!encoder->speed_preset && !encoder->tunings->len) {
     GST_DEBUG_OBJECT (encoder, "Applying x264enc_defaults");
     if (x264enc_defaults->len
-        && gst_x264_enc_parse_options (encoder,
+        && gst_x264_enc_parse_options (encoder, &encoder->x264param,
             x264enc_defaults->str) == FALSE) {
       GST_DEBUG_OBJECT (encoder,
           "x264enc_defaults string contains errors. This is a bug.");
@@ -1535,7 +2490,7 @@ gst_x264_enc_init_encoder (GstX264Enc * encoder)
   if (encoder->option_string_prop && encoder->option_string_prop->len) {
     GST_DEBUG_OBJECT (encoder, "Applying option-string: %s",
         encoder->option_string_prop->str);
-    if (gst_x264_enc_parse_options (encoder,
+    if (gst_x264_enc_parse_options (encoder, &encoder->x264param,
             encoder->option_string_prop->str) == FALSE) {
       GST_DEBUG_OBJECT (encoder, "Your option-string contains errors.");
       goto unlock_and_return;
@@ -1545,7 +2500,7 @@ gst_x264_enc_init_encoder (GstX264Enc * encoder)
   if (encoder->option_string && encoder->option_string->len) {
     GST_DEBUG_OBJECT (encoder, "Applying user-set options: %s",
         encoder->option_string->str);
-    if (gst_x264_enc_parse_options (encoder,
+    if (gst_x264_enc_parse_options (encoder, &encoder->x264param,
             encoder->option_string->str) == FALSE) {
       GST_DEBUG_OBJECT (encoder, "Failed to parse internal option string. "
           "This could be due to use of an old libx264 version. Option string "
@@ -1702,8 +2657,6 @@ gst_x264_enc_init_encoder (GstX264Enc * encoder)
 
 skip_vui_parameters:
 
-  encoder->x264param.analyse.b_psnr = 0;
-
   /* FIXME 2.0 make configuration more sane and consistent with x264 cmdline:
    * + split pass property into a pass property (pass1/2/3 enum) and rc-method
    * + bitrate property should only be used in case of CBR method
@@ -1729,6 +2682,7 @@ skip_vui_parameters:
     case GST_X264_ENC_PASS_PASS1:
     case GST_X264_ENC_PASS_PASS2:
     case GST_X264_ENC_PASS_PASS3:
+    case GST_X264_ENC_PASS_TWO_PASS:
     default:
       encoder->x264param.rc.i_rc_method = X264_RC_ABR;
       encoder->x264param.rc.i_bitrate = encoder->bitrate;
@@ -1740,6 +2694,17 @@ skip_vui_parameters:
       break;
   }
 
+  /* both passes in this run, the statistics don't go to the
+   * multipass-cache-file */
+  if (encoder->pass == GST_X264_ENC_PASS_TWO_PASS) {
+    if (!encoder->stats_file && !gst_x264_enc_make_stats_dir (encoder))
+      goto unlock_and_return;
+
+    pass = encoder->first_pass ? 1 : 2;
+    encoder->x264param.rc.psz_stat_out = encoder->stats_file;
+    encoder->x264param.rc.psz_stat_in = encoder->stats_file;
+  }
+
   switch (pass) {
     case 0:
       encoder->x264param.rc.b_stat_read = 0;
@@ -1861,6 +2826,60 @@ skip_vui_parameters:
   GST_DEBUG_OBJECT (encoder, "Stereo frame packing = %d",
       encoder->x264param.i_frame_packing);
 
+  /* what tune=zerolatency does, with slices small enough for a packet
+   * that x264 hands over as soon as each is done */
+  if (encoder->low_latency) {
+    encoder->x264param.rc.i_lookahead = 0;
+    encoder->x264param.i_sync_lookahead = 0;
+    encoder->x264param.i_bframe = 0;
+    encoder->x264param.rc.b_mb_tree = 0;
+    encoder->x264param.b_sliced_threads = 1;
+    encoder->x264param.b_intra_refresh = 1;
+    encoder->x264param.i_slice_max_size = encoder->slice_max_size;
+    encoder->x264param.b_annexb = 1;
+    encoder->x264param.nalu_process = gst_x264_enc_nalu_process;
+  } else {
+    encoder->x264param.nalu_process = NULL;
+  }
+
+  /* each chunk encoder gets a share of the cores. The statistics of
+   * multipass encoding and the slices of low-latency encoding are for one
+   * encoder only */
+  encoder->chunk_workers = 0;
+  if (encoder->chunk_frames && !(encoder->pass & 0xF0)
+      && !encoder->low_latency) {
+    encoder->chunk_workers = encoder->chunk_encoders ?
+        encoder->chunk_encoders : MAX (2, g_get_num_processors () / 8);
+    if (!encoder->threads)
+      encoder->x264param.i_threads = MAX (1, g_get_num_processors () /
+          encoder->chunk_workers);
+    if (encoder->renditions)
+      GST_WARNING_OBJECT (encoder, "No renditions with chunked encoding");
+  } else if (encoder->chunk_frames) {
+    GST_WARNING_OBJECT (encoder, "Chunked encoding is not possible with "
+        "multipass or low-latency encoding");
+  }
+
+  /* the renditions encode at the same time, share the cores between
+   * all encoders instead of starting a full set of threads for each */
+  if (encoder->renditions && !encoder->threads && !encoder->chunk_workers)
+    encoder->x264param.i_threads = MAX (1, g_get_num_processors () /
+        (g_list_length (encoder->renditions) + 1));
+
+  /* adaptive speed steps down through the levels that are faster than
+   * the settings we start with, and the level above those is exactly
+   * these settings */
+  encoder->speed_param = encoder->x264param;
+  encoder->speed_level = 0;
+  while (encoder->speed_level < (gint) G_N_ELEMENTS (speed_levels)
+      && gst_x264_enc_speed_level_is_faster (&speed_levels[encoder->speed_level],
+          &encoder->x264param))
+    encoder->speed_level++;
+  encoder->max_speed_level = encoder->speed_level;
+  encoder->max_ref = encoder->x264param.i_frame_reference;
+  encoder->load = 0;
+  encoder->frames_since_switch = 0;
+
   encoder->reconfig = FALSE;
 
   GST_OBJECT_UNLOCK (encoder);
@@ -1872,6 +2891,11 @@ skip_vui_parameters:
     return FALSE;
   }
 
+  if (!gst_x264_enc_open_renditions (encoder)) {
+    gst_x264_enc_close_encoder (encoder);
+    return FALSE;
+  }
+
   return TRUE;
 
 unlock_and_return:
@@ -1887,6 +2911,8 @@ unlock_and_return:
 static void
 gst_x264_enc_close_encoder (GstX264Enc * encoder)
 {
+  gst_x264_enc_close_renditions (encoder);
+
   if (encoder->x264enc != NULL) {
     encoder->vtable->x264_encoder_close (encoder->x264enc);
     encoder->x264enc = NULL;
@@ -1894,97 +2920,1111 @@ gst_x264_enc_close_encoder (GstX264Enc * encoder)
   encoder->vtable = NULL;
 }
 
-static gboolean
-gst_x264_enc_set_profile_and_level (GstX264Enc * encoder, GstCaps * caps)
-{
-  x264_nal_t *nal;
-  int i_nal;
-  int header_return;
-  gint sps_ni = 0;
-  guint8 *sps;
-  GstStructure *s;
-  const gchar *profile;
-  GstCaps *allowed_caps;
-  GstStructure *s2;
-  const gchar *allowed_profile;
+/* Renditions
+ *
+ * Every request pad runs an encoder of its own on the same input. Inputs
+ * at the input size share the mapping of the input frame, the other sizes
+ * are scaled once per size. The scaling and the encoders run as jobs on a
+ * pool of workers, and the output is pushed from the streaming thread. */
 
-  header_return =
-      encoder->vtable->x264_encoder_headers (encoder->x264enc, &nal, &i_nal);
-  if (header_return < 0) {
-    GST_ELEMENT_ERROR (encoder, STREAM, ENCODE, ("Encode x264 header failed."),
-        ("x264_encoder_headers return code=%d", header_return));
-    return FALSE;
-  }
+struct _GstX264EncScaler
+{
+  GstX264EncJob job;
+  guint users;
 
-  /* old x264 returns SEI, SPS and PPS, newer one has SEI last */
-  if (i_nal == 3 && nal[sps_ni].i_type != 7)
-    sps_ni = 1;
+  gint width;
+  gint height;
+  GstVideoConverter *convert;
+  GstBuffer *buffer;
+  GstVideoFrame vframe;
+  x264_image_t img;
+};
 
-  sps = nal[sps_ni].p_payload + 4;
-  /* skip NAL unit type */
-  sps++;
+static void
+gst_x264_enc_worker (gpointer data, gpointer user_data)
+{
+  GstX264EncJob *job = data;
+  GstX264Enc *encoder = user_data;
 
-  gst_codec_utils_h264_caps_set_level_and_profile (caps, sps, 3);
+  job->func (encoder, job->data);
 
-  /* Constrained baseline is a strict subset of baseline. If downstream
-   * wanted baseline and we produced constrained baseline, we can just
-   * set the profile to baseline in the caps to make negotiation happy.
-   * Same goes for baseline as subset of main profile and main as a subset
-   * of high profile.
-   */
-  s = gst_caps_get_structure (caps, 0);
-  profile = gst_structure_get_string (s, "profile");
+  g_mutex_lock (&encoder->jobs_lock);
+  if (--encoder->jobs_pending == 0)
+    g_cond_signal (&encoder->jobs_cond);
+  g_mutex_unlock (&encoder->jobs_lock);
+}
 
-  allowed_caps = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+static void
+gst_x264_enc_push_job (GstX264Enc * encoder, GstX264EncJob * job)
+{
+  GError *err = NULL;
 
-  if (allowed_caps == NULL)
-    goto no_peer;
+  g_mutex_lock (&encoder->jobs_lock);
+  encoder->jobs_pending++;
+  g_mutex_unlock (&encoder->jobs_lock);
 
-  if (!gst_caps_can_intersect (allowed_caps, caps)) {
-    allowed_caps = gst_caps_make_writable (allowed_caps);
-    allowed_caps = gst_caps_truncate (allowed_caps);
-    s2 = gst_caps_get_structure (allowed_caps, 0);
-    gst_structure_fixate_field_string (s2, "profile", profile);
-    allowed_profile = gst_structure_get_string (s2, "profile");
-    if (!strcmp (allowed_profile, "high")) {
-      if (!strcmp (profile, "constrained-baseline")
-          || !strcmp (profile, "baseline") || !strcmp (profile, "main")) {
-        gst_structure_set (s, "profile", G_TYPE_STRING, "high", NULL);
-        GST_INFO_OBJECT (encoder, "downstream requested high profile, but "
-            "encoder will now output %s profile (which is a subset), due "
-            "to how it's been configured", profile);
-      }
-    } else if (!strcmp (allowed_profile, "main")) {
-      if (!strcmp (profile, "constrained-baseline")
-          || !strcmp (profile, "baseline")) {
-        gst_structure_set (s, "profile", G_TYPE_STRING, "main", NULL);
-        GST_INFO_OBJECT (encoder, "downstream requested main profile, but "
-            "encoder will now output %s profile (which is a subset), due "
-            "to how it's been configured", profile);
-      }
-    } else if (!strcmp (allowed_profile, "baseline")) {
-      if (!strcmp (profile, "constrained-baseline"))
-        gst_structure_set (s, "profile", G_TYPE_STRING, "baseline", NULL);
-    }
+  if (!g_thread_pool_push (encoder->workers, job, &err)) {
+    GST_WARNING_OBJECT (encoder, "failed to queue job: %s", err->message);
+    g_clear_error (&err);
+    gst_x264_enc_worker (job, encoder);
   }
-  gst_caps_unref (allowed_caps);
+}
 
-no_peer:
+static void
+gst_x264_enc_wait_jobs (GstX264Enc * encoder)
+{
+  g_mutex_lock (&encoder->jobs_lock);
+  while (encoder->jobs_pending)
+    g_cond_wait (&encoder->jobs_cond, &encoder->jobs_lock);
+  g_mutex_unlock (&encoder->jobs_lock);
+}
 
-  return TRUE;
+static void
+gst_x264_enc_scale_job (GstX264Enc * encoder, gpointer data)
+{
+  GstX264EncScaler *scaler = data;
+
+  gst_video_converter_frame (scaler->convert, encoder->rendition_src,
+      &scaler->vframe);
 }
 
-/*
- * Returns: Buffer with the stream headers.
- */
-static GstBuffer *
-gst_x264_enc_header_buf (GstX264Enc * encoder)
+static void
+gst_x264_enc_rendition_job (GstX264Enc * encoder, gpointer data)
 {
-  GstBuffer *buf;
+  GstX264EncPad *pad = data;
+  x264_picture_t pic_in, pic_out;
   x264_nal_t *nal;
   int i_nal;
-  int header_return;
-  int i_size;
+  GstX264EncDuration duration;
+  guint i;
+
+  GST_OBJECT_LOCK (encoder);
+  if (pad->reconfig) {
+    pad->reconfig = FALSE;
+    if (encoder->vtable->x264_encoder_reconfig (pad->x264enc,
+            &pad->x264param) < 0)
+      GST_WARNING_OBJECT (pad, "Could not reconfigure");
+  }
+  GST_OBJECT_UNLOCK (encoder);
+
+  if (encoder->rendition_pic_valid) {
+    pic_in = encoder->rendition_pic;
+    if (pad->scaler)
+      pic_in.img = pad->scaler->img;
+
+    /* x264 gives back the PTS of the output, but not the duration */
+    duration.pts = pic_in.i_pts;
+    duration.duration = encoder->rendition_duration;
+    g_array_append_val (pad->durations, duration);
+
+    if (encoder->rendition_force_keyframe) {
+      if (pad->x264param.b_intra_refresh)
+        encoder->vtable->x264_encoder_intra_refresh (pad->x264enc);
+      else
+        pic_in.i_type = X264_TYPE_IDR;
+    }
+  }
+
+  pad->encoder_return = encoder->vtable->x264_encoder_encode (pad->x264enc,
+      &nal, &i_nal, encoder->rendition_pic_valid ? &pic_in : NULL, &pic_out);
+
+  if (pad->encoder_return <= 0 || !i_nal)
+    return;
+
+  pad->out_buf = gst_buffer_new_allocate (NULL, pad->encoder_return, NULL);
+  gst_buffer_fill (pad->out_buf, 0, nal[0].p_payload, pad->encoder_return);
+
+  GST_BUFFER_PTS (pad->out_buf) = pic_out.i_pts;
+  if (pic_out.i_dts >= 0)
+    GST_BUFFER_DTS (pad->out_buf) = pic_out.i_dts;
+  for (i = 0; i < pad->durations->len; i++) {
+    duration = g_array_index (pad->durations, GstX264EncDuration, i);
+    if (duration.pts == pic_out.i_pts) {
+      GST_BUFFER_DURATION (pad->out_buf) = duration.duration;
+      g_array_remove_index (pad->durations, i);
+      break;
+    }
+  }
+  if (!pic_out.b_keyframe)
+    GST_BUFFER_FLAG_SET (pad->out_buf, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+static GstX264EncScaler *
+gst_x264_enc_get_scaler (GstX264Enc * encoder, gint width, gint height)
+{
+  GstVideoInfo *info = &encoder->input_state->info;
+  GstX264EncScaler *scaler;
+  GstVideoInfo out_info;
+  GList *l;
+  gint i, nplanes = 0;
+
+  for (l = encoder->scalers; l; l = l->next) {
+    scaler = l->data;
+    if (scaler->width == width && scaler->height == height) {
+      scaler->users++;
+      return scaler;
+    }
+  }
+
+  /* only the size changes, no colorspace conversion */
+  gst_video_info_set_format (&out_info, GST_VIDEO_INFO_FORMAT (info), width,
+      height);
+  out_info.colorimetry = info->colorimetry;
+  out_info.chroma_site = info->chroma_site;
+  out_info.fps_n = info->fps_n;
+  out_info.fps_d = info->fps_d;
+
+  scaler = g_slice_new0 (GstX264EncScaler);
+  scaler->job.func = gst_x264_enc_scale_job;
+  scaler->job.data = scaler;
+  scaler->users = 1;
+  scaler->width = width;
+  scaler->height = height;
+
+  scaler->convert = gst_video_converter_new (info, &out_info, NULL);
+  if (!scaler->convert)
+    goto no_converter;
+
+  scaler->buffer = gst_buffer_new_allocate (NULL, out_info.size, NULL);
+  if (!gst_video_frame_map (&scaler->vframe, &out_info, scaler->buffer,
+          GST_MAP_READWRITE))
+    goto map_failed;
+
+  scaler->img.i_csp =
+      gst_x264_enc_gst_to_x264_video_format (info->finfo->format, &nplanes);
+  scaler->img.i_plane = nplanes;
+  for (i = 0; i < nplanes; i++) {
+    scaler->img.plane[i] = GST_VIDEO_FRAME_COMP_DATA (&scaler->vframe, i);
+    scaler->img.i_stride[i] = GST_VIDEO_FRAME_COMP_STRIDE (&scaler->vframe, i);
+  }
+
+  GST_DEBUG_OBJECT (encoder, "scaling input to %dx%d", width, height);
+  encoder->scalers = g_list_prepend (encoder->scalers, scaler);
+
+  return scaler;
+
+  /* ERRORS */
+no_converter:
+  {
+    GST_ERROR_OBJECT (encoder, "can't scale input to %dx%d", width, height);
+    g_slice_free (GstX264EncScaler, scaler);
+    return NULL;
+  }
+map_failed:
+  {
+    GST_ERROR_OBJECT (encoder, "can't map %dx%d frame", width, height);
+    gst_video_converter_free (scaler->convert);
+    gst_buffer_unref (scaler->buffer);
+    g_slice_free (GstX264EncScaler, scaler);
+    return NULL;
+  }
+}
+
+static void
+gst_x264_enc_put_scaler (GstX264Enc * encoder, GstX264EncScaler * scaler)
+{
+  if (--scaler->users)
+    return;
+
+  encoder->scalers = g_list_remove (encoder->scalers, scaler);
+  gst_video_frame_unmap (&scaler->vframe);
+  gst_buffer_unref (scaler->buffer);
+  gst_video_converter_free (scaler->convert);
+  g_slice_free (GstX264EncScaler, scaler);
+}
+
+static gboolean
+gst_x264_enc_open_rendition (GstX264Enc * encoder, GstX264EncPad * pad)
+{
+  GstVideoInfo *info = &encoder->input_state->info;
+  x264_param_t *param = &pad->x264param;
+  gint width, height, sar_n, sar_d;
+  guint bitrate;
+  gchar *profile;
+
+  GST_OBJECT_LOCK (pad);
+  width = pad->width;
+  height = pad->height;
+  bitrate = pad->bitrate;
+  profile = g_strdup (pad->profile);
+  GST_OBJECT_UNLOCK (pad);
+
+  /* keep the aspect ratio of the input for a missing dimension */
+  if (!width && !height) {
+    width = info->width;
+    height = info->height;
+  } else if (!width) {
+    width = GST_ROUND_UP_2 (gst_util_uint64_scale_int (height, info->width,
+            info->height));
+  } else if (!height) {
+    height = GST_ROUND_UP_2 (gst_util_uint64_scale_int (width, info->height,
+            info->width));
+  }
+
+  /* and its display aspect ratio */
+  if (!gst_util_fraction_multiply (MAX (info->par_n, 1), MAX (info->par_d, 1),
+          info->width * height, info->height * width, &sar_n, &sar_d)) {
+    sar_n = 1;
+    sar_d = 1;
+  }
+
+  /* all of the element settings, but with the size, rate and profile of
+   * the rendition. The streams are independent, so byte-stream with the
+   * headers in front of every keyframe */
+  GST_OBJECT_LOCK (encoder);
+  *param = encoder->x264param;
+  pad->reconfig = FALSE;
+  GST_OBJECT_UNLOCK (encoder);
+  param->i_width = width;
+  param->i_height = height;
+  param->vui.i_sar_width = sar_n;
+  param->vui.i_sar_height = sar_d;
+  param->b_annexb = 1;
+  param->b_repeat_headers = 1;
+  param->nalu_process = NULL;
+  param->i_level_idc = -1;
+  param->rc.b_stat_read = 0;
+  param->rc.b_stat_write = 0;
+
+  if (bitrate) {
+    if (encoder->pass != GST_X264_ENC_PASS_QUAL)
+      param->rc.i_bitrate = bitrate;
+    param->rc.i_vbv_max_bitrate = bitrate;
+    param->rc.i_vbv_buffer_size = bitrate * encoder->vbv_buf_capacity / 1000;
+  }
+
+  if (profile && encoder->vtable->x264_param_apply_profile (param, profile))
+    GST_WARNING_OBJECT (pad, "Bad profile name: %s", profile);
+  g_free (profile);
+
+  if (width != info->width || height != info->height) {
+    pad->scaler = gst_x264_enc_get_scaler (encoder, width, height);
+    if (!pad->scaler)
+      goto no_scaler;
+  }
+
+  pad->x264enc = encoder->vtable->x264_encoder_open (param);
+  if (!pad->x264enc)
+    goto open_failed;
+
+  gst_caps_take (&pad->caps, gst_caps_new_simple ("video/x-h264",
+          "stream-format", G_TYPE_STRING, "byte-stream",
+          "alignment", G_TYPE_STRING, "au",
+          "width", G_TYPE_INT, width, "height", G_TYPE_INT, height,
+          "pixel-aspect-ratio", GST_TYPE_FRACTION, sar_n, sar_d,
+          "framerate", GST_TYPE_FRACTION, info->fps_n, info->fps_d, NULL));
+  pad->need_caps = TRUE;
+
+  GST_DEBUG_OBJECT (pad, "opened %dx%d rendition at %d kbit/sec", width,
+      height, param->rc.i_bitrate);
+
+  return TRUE;
+
+  /* ERRORS */
+no_scaler:
+  {
+    GST_ELEMENT_ERROR (encoder, CORE, NEGOTIATION, (NULL),
+        ("Can not scale the input to %dx%d for %s", width, height,
+            GST_PAD_NAME (pad)));
+    return FALSE;
+  }
+open_failed:
+  {
+    GST_ELEMENT_ERROR (encoder, STREAM, ENCODE,
+        ("Can not initialize x264 encoder."),
+        ("Failed to open the encoder of %s", GST_PAD_NAME (pad)));
+    if (pad->scaler)
+      gst_x264_enc_put_scaler (encoder, pad->scaler);
+    pad->scaler = NULL;
+    return FALSE;
+  }
+}
+
+static void
+gst_x264_enc_close_rendition (GstX264Enc * encoder, GstX264EncPad * pad)
+{
+  if (pad->x264enc) {
+    encoder->vtable->x264_encoder_close (pad->x264enc);
+    pad->x264enc = NULL;
+  }
+  if (pad->scaler) {
+    gst_x264_enc_put_scaler (encoder, pad->scaler);
+    pad->scaler = NULL;
+  }
+  gst_buffer_replace (&pad->out_buf, NULL);
+  g_array_set_size (pad->durations, 0);
+  pad->encoder_return = 0;
+}
+
+/* called with the encoder open, after the element settings are known */
+static gboolean
+gst_x264_enc_open_renditions (GstX264Enc * encoder)
+{
+  guint n_workers;
+  GList *l;
+
+  /* the chunks run on the same workers */
+  n_workers = g_list_length (encoder->renditions) + encoder->chunk_workers;
+  if (!n_workers)
+    return TRUE;
+
+  if (!encoder->workers)
+    encoder->workers = g_thread_pool_new (gst_x264_enc_worker, encoder,
+        n_workers, FALSE, NULL);
+  else
+    g_thread_pool_set_max_threads (encoder->workers, n_workers, NULL);
+
+  for (l = encoder->renditions; l; l = l->next) {
+    GstX264EncPad *pad = l->data;
+
+    if (!pad->x264enc && !gst_x264_enc_open_rendition (encoder, pad))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+gst_x264_enc_close_renditions (GstX264Enc * encoder)
+{
+  GList *l;
+
+  gst_x264_enc_wait_jobs (encoder);
+
+  for (l = encoder->renditions; l; l = l->next)
+    gst_x264_enc_close_rendition (encoder, l->data);
+}
+
+/* start encoding @pic_in, or draining the encoders without it. Returns the
+ * number of encoders that got a job */
+static guint
+gst_x264_enc_encode_renditions (GstX264Enc * encoder, x264_picture_t * pic_in,
+    GstVideoFrame * vframe, gboolean force_keyframe)
+{
+  guint n_jobs = 0;
+  GList *l;
+
+  if (pic_in) {
+    encoder->rendition_pic = *pic_in;
+    encoder->rendition_pic.opaque = NULL;
+    encoder->rendition_pic_valid = TRUE;
+    encoder->rendition_force_keyframe = force_keyframe;
+    encoder->rendition_src = vframe;
+
+    /* every encoder of a size needs its scaled frame */
+    for (l = encoder->scalers; l; l = l->next)
+      gst_x264_enc_push_job (encoder, &((GstX264EncScaler *) l->data)->job);
+    gst_x264_enc_wait_jobs (encoder);
+  } else {
+    encoder->rendition_pic_valid = FALSE;
+    encoder->rendition_force_keyframe = FALSE;
+    encoder->rendition_src = NULL;
+  }
+
+  for (l = encoder->renditions; l; l = l->next) {
+    GstX264EncPad *pad = l->data;
+
+    if (!pad->x264enc)
+      continue;
+    if (!pic_in
+        && encoder->vtable->x264_encoder_delayed_frames (pad->x264enc) <= 0)
+      continue;
+
+    pad->job.func = gst_x264_enc_rendition_job;
+    pad->job.data = pad;
+    gst_x264_enc_push_job (encoder, &pad->job);
+    n_jobs++;
+  }
+
+  return n_jobs;
+}
+
+static void
+gst_x264_enc_push_sticky_events (GstX264Enc * encoder, GstX264EncPad * pad)
+{
+  if (pad->need_stream_start) {
+    gchar *stream_id;
+
+    stream_id = gst_pad_create_stream_id (GST_PAD (pad),
+        GST_ELEMENT (encoder), GST_PAD_NAME (pad));
+    gst_pad_push_event (GST_PAD (pad), gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
+    pad->need_stream_start = FALSE;
+  }
+
+  if (pad->need_caps && pad->caps) {
+    gst_pad_push_event (GST_PAD (pad), gst_event_new_caps (pad->caps));
+    pad->need_caps = FALSE;
+  }
+
+  if (pad->need_segment) {
+    GstSegment segment;
+
+    /* the base class moves the timestamps for the first DTS, move the
+     * segment with them like it does for the main stream */
+    gst_segment_copy_into (&GST_VIDEO_ENCODER (encoder)->input_segment,
+        &segment);
+    if (segment.format == GST_FORMAT_TIME
+        && encoder->rendition_time_adjustment > 0) {
+      segment.start += encoder->rendition_time_adjustment;
+      if (GST_CLOCK_TIME_IS_VALID (segment.position))
+        segment.position += encoder->rendition_time_adjustment;
+      if (GST_CLOCK_TIME_IS_VALID (segment.stop))
+        segment.stop += encoder->rendition_time_adjustment;
+    }
+    gst_pad_push_event (GST_PAD (pad), gst_event_new_segment (&segment));
+    pad->need_segment = FALSE;
+  }
+}
+
+/* wait for the jobs of gst_x264_enc_encode_renditions() and push their
+ * output, or drop it when not @send */
+static GstFlowReturn
+gst_x264_enc_push_renditions (GstX264Enc * encoder, gboolean send)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstClockTime start;
+  GList *l;
+
+  /* waiting for the renditions is part of the encoding time */
+  start = gst_util_get_timestamp ();
+  gst_x264_enc_wait_jobs (encoder);
+  encoder->encode_time += gst_util_get_timestamp () - start;
+
+  for (l = encoder->renditions; l; l = l->next) {
+    GstX264EncPad *pad = l->data;
+    GstFlowReturn flow;
+
+    if (pad->encoder_return < 0) {
+      GST_ELEMENT_ERROR (encoder, STREAM, ENCODE,
+          ("Encode x264 frame failed."),
+          ("x264_encoder_encode return code=%d for %s", pad->encoder_return,
+              GST_PAD_NAME (pad)));
+      pad->encoder_return = 0;
+      ret = GST_FLOW_ERROR;
+      continue;
+    }
+
+    if (!pad->out_buf)
+      continue;
+
+    if (!send) {
+      gst_buffer_replace (&pad->out_buf, NULL);
+      continue;
+    }
+
+    gst_x264_enc_push_sticky_events (encoder, pad);
+    flow = gst_pad_push (GST_PAD (pad), pad->out_buf);
+    pad->out_buf = NULL;
+    if (flow != GST_FLOW_OK)
+      GST_DEBUG_OBJECT (pad, "push returned %s", gst_flow_get_name (flow));
+
+    /* one rendition ending or not being linked doesn't stop the others */
+    flow = gst_flow_combiner_update_pad_flow (encoder->flow_combiner,
+        GST_PAD (pad), flow);
+    if (flow != GST_FLOW_OK && ret == GST_FLOW_OK)
+      ret = flow;
+  }
+
+  return ret;
+}
+
+static void
+gst_x264_enc_flush_renditions (GstX264Enc * encoder, gboolean send)
+{
+  while (gst_x264_enc_encode_renditions (encoder, NULL, NULL, FALSE) > 0) {
+    if (gst_x264_enc_push_renditions (encoder, send) != GST_FLOW_OK)
+      break;
+  }
+  gst_x264_enc_wait_jobs (encoder);
+}
+
+/* create x264_picture_t from the mapped input of @frame */
+/* mostly taken from mplayer (file ve_x264.c) */
+static void
+gst_x264_enc_init_picture (x264_picture_t * pic, GstVideoInfo * info,
+    GstVideoFrame * vframe, GstVideoCodecFrame * frame)
+{
+  gint i, nplanes = 0;
+
+  memset (pic, 0, sizeof (*pic));
+
+  pic->img.i_csp =
+      gst_x264_enc_gst_to_x264_video_format (info->finfo->format, &nplanes);
+  pic->img.i_plane = nplanes;
+  for (i = 0; i < nplanes; i++) {
+    pic->img.plane[i] = GST_VIDEO_FRAME_COMP_DATA (vframe, i);
+    pic->img.i_stride[i] = GST_VIDEO_FRAME_COMP_STRIDE (vframe, i);
+  }
+
+  pic->i_type = X264_TYPE_AUTO;
+  pic->i_pts = frame->pts;
+
+  if (GST_VIDEO_INFO_INTERLACE_MODE (info) == GST_VIDEO_INTERLACE_MODE_MIXED) {
+    if ((vframe->flags & GST_VIDEO_FRAME_FLAG_INTERLACED) == 0) {
+      pic->i_pic_struct = PIC_STRUCT_PROGRESSIVE;
+    } else if ((vframe->flags & GST_VIDEO_FRAME_FLAG_RFF) != 0) {
+      if ((vframe->flags & GST_VIDEO_FRAME_FLAG_TFF) != 0) {
+        pic->i_pic_struct = PIC_STRUCT_TOP_BOTTOM_TOP;
+      } else {
+        pic->i_pic_struct = PIC_STRUCT_BOTTOM_TOP_BOTTOM;
+      }
+    } else {
+      if ((vframe->flags & GST_VIDEO_FRAME_FLAG_TFF) != 0) {
+        pic->i_pic_struct = PIC_STRUCT_TOP_BOTTOM;
+      } else {
+        pic->i_pic_struct = PIC_STRUCT_BOTTOM_TOP;
+      }
+    }
+  }
+}
+
+/* for frames that are kept around for a long time, so that upstream gets
+ * its memory back */
+static void
+gst_x264_enc_copy_input (GstVideoCodecFrame * frame)
+{
+  GstBuffer *copy = gst_buffer_copy_deep (frame->input_buffer);
+
+  gst_buffer_unref (frame->input_buffer);
+  frame->input_buffer = copy;
+}
+
+/* Chunked encoding: the input is cut into chunks of up to chunk-frames
+ * frames, at keyframes that are asked for and at scene changes. Every
+ * chunk is encoded from its first IDR frame to the end on an encoder of
+ * its own, as a job on the workers. The encoders have the settings of the
+ * main encoder, which only provides the headers, so that the chunks can be
+ * put back together in order into one stream. */
+
+struct _GstX264EncChunk
+{
+  GstX264EncJob job;
+  GstVideoInfo info;
+  x264_param_t param;
+
+  /* the frames in input order, with their references, and in output
+   * order when done */
+  GQueue frames;
+  GQueue output;
+
+  /* how far the DTS of the chunk are behind the PTS */
+  GstClockTimeDiff dts_offset;
+  gint encoder_return;
+  gboolean done;
+};
+
+#define SCENE_CUT_STEP        8
+#define SCENE_CUT_THRESHOLD   30        /* mean luma difference */
+
+/* a cheap scene change detection, on the luma of every 8th pixel of every
+ * 8th line compared to the previous frame */
+static gboolean
+gst_x264_enc_scene_cut (GstX264Enc * encoder, GstVideoCodecFrame * frame)
+{
+  GstVideoFrame vframe;
+  const guint8 *line, *p;
+  gint x, y, width, height, stride, pstride, shift;
+  guint64 diff = 0;
+  gsize size, n = 0;
+  gboolean have_prev;
+  guint8 v;
+
+  if (!gst_video_frame_map (&vframe, &encoder->input_state->info,
+          frame->input_buffer, GST_MAP_READ))
+    return FALSE;
+
+  width = GST_VIDEO_FRAME_COMP_WIDTH (&vframe, 0);
+  height = GST_VIDEO_FRAME_COMP_HEIGHT (&vframe, 0);
+  stride = GST_VIDEO_FRAME_COMP_STRIDE (&vframe, 0);
+  pstride = GST_VIDEO_FRAME_COMP_PSTRIDE (&vframe, 0);
+  shift = GST_VIDEO_FRAME_COMP_DEPTH (&vframe, 0) - 8;
+  size = ((width + SCENE_CUT_STEP - 1) / SCENE_CUT_STEP) *
+      ((height + SCENE_CUT_STEP - 1) / SCENE_CUT_STEP);
+
+  have_prev = (encoder->scene_luma_size == size);
+  if (!have_prev) {
+    g_free (encoder->scene_luma);
+    encoder->scene_luma = g_malloc (size);
+    encoder->scene_luma_size = size;
+  }
+
+  for (y = 0; y < height; y += SCENE_CUT_STEP) {
+    line = (const guint8 *) GST_VIDEO_FRAME_COMP_DATA (&vframe, 0) +
+        y * stride;
+    for (x = 0; x < width; x += SCENE_CUT_STEP) {
+      p = line + x * pstride;
+      v = shift > 0 ? GST_READ_UINT16_LE (p) >> shift : *p;
+      if (have_prev)
+        diff += ABS ((gint) v - encoder->scene_luma[n]);
+      encoder->scene_luma[n++] = v;
+    }
+  }
+  gst_video_frame_unmap (&vframe);
+
+  return have_prev && diff > SCENE_CUT_THRESHOLD * size;
+}
+
+static void
+gst_x264_enc_free_frame_stats (gpointer stats)
+{
+  g_slice_free (GstX264EncFrameStats, stats);
+}
+
+static void
+gst_x264_enc_chunk_output (GstX264EncChunk * chunk, x264_nal_t * nal,
+    gint size, x264_picture_t * pic_out)
+{
+  GstVideoCodecFrame *frame = pic_out->opaque;
+  GstX264EncFrameStats *stats = gst_video_codec_frame_get_user_data (frame);
+
+  /* the latency still holds the time the frame went in */
+  gst_x264_enc_get_frame_stats (stats, &chunk->param, pic_out, size,
+      stats->latency);
+
+  frame->output_buffer = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_fill (frame->output_buffer, 0, nal[0].p_payload, size);
+  frame->dts = pic_out->i_dts;
+  if (pic_out->b_keyframe)
+    GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
+
+  /* the IDR frame that comes first */
+  if (g_queue_is_empty (&chunk->output))
+    chunk->dts_offset = pic_out->i_pts - pic_out->i_dts;
+  g_queue_push_tail (&chunk->output, frame);
+}
+
+static void
+gst_x264_enc_chunk_job (GstX264Enc * encoder, gpointer data)
+{
+  GstX264EncChunk *chunk = data;
+  x264_picture_t pic_in, pic_out;
+  GstVideoFrame vframe;
+  GstX264EncFrameStats *stats;
+  x264_nal_t *nal;
+  x264_t *x264;
+  int i_nal, ret = -1;
+  GList *l;
+
+  if (g_atomic_int_get (&encoder->chunks_abort))
+    goto done;
+
+  x264 = encoder->vtable->x264_encoder_open (&chunk->param);
+  if (!x264)
+    goto done;
+
+  for (l = chunk->frames.head; l; l = l->next) {
+    GstVideoCodecFrame *frame = l->data;
+
+    if (g_atomic_int_get (&encoder->chunks_abort)) {
+      ret = -1;
+      break;
+    }
+
+    if (!gst_video_frame_map (&vframe, &chunk->info, frame->input_buffer,
+            GST_MAP_READ)) {
+      ret = -1;
+      break;
+    }
+
+    stats = g_slice_new0 (GstX264EncFrameStats);
+    stats->latency = gst_util_get_timestamp ();
+    gst_video_codec_frame_set_user_data (frame, stats,
+        gst_x264_enc_free_frame_stats);
+
+    gst_x264_enc_init_picture (&pic_in, &chunk->info, &vframe, frame);
+    pic_in.opaque = frame;
+    ret = encoder->vtable->x264_encoder_encode (x264, &nal, &i_nal, &pic_in,
+        &pic_out);
+    /* x264 made a copy of the picture */
+    gst_video_frame_unmap (&vframe);
+
+    if (ret < 0)
+      break;
+    if (ret > 0 && i_nal)
+      gst_x264_enc_chunk_output (chunk, nal, ret, &pic_out);
+  }
+
+  while (ret >= 0 && !g_atomic_int_get (&encoder->chunks_abort)
+      && encoder->vtable->x264_encoder_delayed_frames (x264) > 0) {
+    ret = encoder->vtable->x264_encoder_encode (x264, &nal, &i_nal, NULL,
+        &pic_out);
+    if (ret > 0 && i_nal)
+      gst_x264_enc_chunk_output (chunk, nal, ret, &pic_out);
+  }
+
+  encoder->vtable->x264_encoder_close (x264);
+
+done:
+  g_mutex_lock (&encoder->jobs_lock);
+  chunk->encoder_return = ret;
+  chunk->done = TRUE;
+  g_cond_signal (&encoder->jobs_cond);
+  g_mutex_unlock (&encoder->jobs_lock);
+}
+
+static void
+gst_x264_enc_free_chunk (GstX264EncChunk * chunk)
+{
+  g_queue_clear (&chunk->output);
+  g_queue_foreach (&chunk->frames, (GFunc) gst_video_codec_frame_unref, NULL);
+  g_queue_clear (&chunk->frames);
+  g_slice_free (GstX264EncChunk, chunk);
+}
+
+/* start encoding the chunk that is being collected, with the settings of
+ * this moment */
+static void
+gst_x264_enc_submit_chunk (GstX264Enc * encoder)
+{
+  GstX264EncChunk *chunk = encoder->chunk;
+
+  encoder->chunk = NULL;
+
+  GST_OBJECT_LOCK (encoder);
+  chunk->param = encoder->x264param;
+  GST_OBJECT_UNLOCK (encoder);
+
+  /* every chunk encoder has a VBV model of its own, and how full the
+   * previous chunk leaves the buffer is unknown. Start from the least it
+   * can hold, which x264 makes the bits of one frame, so that the decoder
+   * never has less than the encoder assumed at a chunk boundary */
+  if (chunk->param.rc.i_vbv_max_bitrate > 0
+      && chunk->param.rc.i_vbv_buffer_size > 0)
+    chunk->param.rc.f_vbv_buffer_init = 0;
+
+  GST_DEBUG_OBJECT (encoder, "encoding chunk of %u frames",
+      chunk->frames.length);
+  g_queue_push_tail (&encoder->chunks, chunk);
+  gst_x264_enc_push_job (encoder, &chunk->job);
+}
+
+static GstFlowReturn
+gst_x264_enc_output_chunk (GstX264Enc * encoder, GstX264EncChunk * chunk)
+{
+  GstVideoCodecFrame *frame;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstX264EncFrameStats stats;
+  gint delayed = 0;
+  GList *l;
+
+  if (chunk->encoder_return < 0)
+    goto encode_failed;
+
+  /* the frames in the later chunks are still in the encoders */
+  for (l = encoder->chunks.head; l; l = l->next)
+    delayed += ((GstX264EncChunk *) l->data)->frames.length;
+
+  /* the first chunk decides how far the DTS are behind the PTS, the
+   * others follow so that the DTS continue over the chunks */
+  if (!encoder->chunk_dts_offset_valid && chunk->output.length) {
+    encoder->chunk_dts_offset = chunk->dts_offset;
+    encoder->chunk_dts_offset_valid = TRUE;
+  }
+
+  while (ret == GST_FLOW_OK && (frame = g_queue_pop_head (&chunk->output))) {
+    frame->dts += chunk->dts_offset - encoder->chunk_dts_offset;
+
+    stats = *(GstX264EncFrameStats *) gst_video_codec_frame_get_user_data
+        (frame);
+
+    /* finishing takes over the reference of the chunk */
+    g_queue_remove (&chunk->frames, frame);
+    ret = gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (encoder), frame);
+
+    if (ret == GST_FLOW_OK)
+      gst_x264_enc_add_frame_stats (encoder, &stats, delayed);
+  }
+
+  return ret;
+
+  /* ERRORS */
+encode_failed:
+  {
+    GST_ELEMENT_ERROR (encoder, STREAM, ENCODE, ("Encode x264 frame failed."),
+        ("x264_encoder_encode return code=%d for a chunk of %u frames",
+            chunk->encoder_return, chunk->frames.length));
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* make the chunk encoders stop at their next frame, and the streaming
+ * thread stop waiting for them */
+static void
+gst_x264_enc_abort_chunks (GstX264Enc * encoder, gboolean abort)
+{
+  g_mutex_lock (&encoder->jobs_lock);
+  g_atomic_int_set (&encoder->chunks_abort, abort);
+  g_cond_broadcast (&encoder->jobs_cond);
+  g_mutex_unlock (&encoder->jobs_lock);
+}
+
+/* output the chunks that are done, in order. Waits for all chunks when
+ * @drain, or else only as long as there are more than the workers can
+ * encode at once */
+static GstFlowReturn
+gst_x264_enc_finish_chunks (GstX264Enc * encoder, gboolean drain)
+{
+  GstX264EncChunk *chunk;
+  GstFlowReturn ret = GST_FLOW_OK;
+  gboolean done, aborted;
+
+  if (drain && encoder->chunk)
+    gst_x264_enc_submit_chunk (encoder);
+
+  while ((chunk = g_queue_peek_head (&encoder->chunks))) {
+    g_mutex_lock (&encoder->jobs_lock);
+    while (!chunk->done && !encoder->chunks_abort && (drain
+            || encoder->chunks.length > encoder->chunk_workers))
+      g_cond_wait (&encoder->jobs_cond, &encoder->jobs_lock);
+    done = chunk->done;
+    aborted = encoder->chunks_abort;
+    g_mutex_unlock (&encoder->jobs_lock);
+
+    /* the chunks are dropped when the flush ends */
+    if (aborted) {
+      ret = GST_FLOW_FLUSHING;
+      break;
+    }
+
+    if (!done)
+      break;
+
+    g_queue_pop_head (&encoder->chunks);
+    if (ret == GST_FLOW_OK)
+      ret = gst_x264_enc_output_chunk (encoder, chunk);
+    gst_x264_enc_free_chunk (chunk);
+  }
+
+  return ret;
+}
+
+/* drop all chunks, without output */
+static void
+gst_x264_enc_clear_chunks (GstX264Enc * encoder)
+{
+  GstX264EncChunk *chunk;
+
+  /* without waiting for the chunks to be encoded */
+  gst_x264_enc_abort_chunks (encoder, TRUE);
+  gst_x264_enc_wait_jobs (encoder);
+  gst_x264_enc_abort_chunks (encoder, FALSE);
+
+  if (encoder->chunk)
+    gst_x264_enc_free_chunk (encoder->chunk);
+  encoder->chunk = NULL;
+  while ((chunk = g_queue_pop_head (&encoder->chunks)))
+    gst_x264_enc_free_chunk (chunk);
+
+  encoder->chunk_dts_offset_valid = FALSE;
+  g_free (encoder->scene_luma);
+  encoder->scene_luma = NULL;
+  encoder->scene_luma_size = 0;
+}
+
+static GstFlowReturn
+gst_x264_enc_handle_chunk_frame (GstX264Enc * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstX264EncChunk *chunk;
+  gboolean scene_cut;
+
+  scene_cut = gst_x264_enc_scene_cut (encoder, frame);
+
+  /* keyframes that are asked for start a new chunk, scene changes do
+   * once the chunk is half full */
+  if (encoder->chunk && (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)
+          || (scene_cut
+              && encoder->chunk->frames.length >= encoder->chunk_frames / 2)))
+    gst_x264_enc_submit_chunk (encoder);
+
+  if (!encoder->chunk) {
+    chunk = g_slice_new0 (GstX264EncChunk);
+    chunk->job.func = gst_x264_enc_chunk_job;
+    chunk->job.data = chunk;
+    chunk->info = encoder->input_state->info;
+    g_queue_init (&chunk->frames);
+    g_queue_init (&chunk->output);
+    encoder->chunk = chunk;
+  }
+
+  /* the frame waits for the rest of its chunk */
+  gst_x264_enc_copy_input (frame);
+  g_queue_push_tail (&encoder->chunk->frames, frame);
+
+  if (encoder->chunk->frames.length >= encoder->chunk_frames)
+    gst_x264_enc_submit_chunk (encoder);
+
+  return gst_x264_enc_finish_chunks (encoder, FALSE);
+}
+
+static GstPad *
+gst_x264_enc_request_new_pad (GstElement * element, GstPadTemplate * templ,
+    const gchar * name, const GstCaps * caps)
+{
+  GstX264Enc *encoder = GST_X264_ENC (element);
+  GstX264EncPad *pad;
+  gchar *pad_name;
+
+  GST_OBJECT_LOCK (encoder);
+  if (name)
+    pad_name = g_strdup (name);
+  else
+    pad_name = g_strdup_printf ("src_%u", encoder->next_rendition++);
+  GST_OBJECT_UNLOCK (encoder);
+
+  pad = g_object_new (GST_TYPE_X264_ENC_PAD, "name", pad_name,
+      "direction", GST_PAD_SRC, "template", templ, NULL);
+  g_free (pad_name);
+  gst_pad_use_fixed_caps (GST_PAD (pad));
+
+  /* the pad is active before the streaming thread can push on it */
+  if (!gst_element_add_pad (element, GST_PAD (pad)))
+    goto add_failed;
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+  GST_OBJECT_LOCK (encoder);
+  encoder->renditions = g_list_append (encoder->renditions,
+      gst_object_ref (pad));
+  GST_OBJECT_UNLOCK (encoder);
+  gst_flow_combiner_add_pad (encoder->flow_combiner, GST_PAD (pad));
+
+  /* join a running stream right away */
+  if (encoder->x264enc && !gst_x264_enc_open_renditions (encoder))
+    GST_WARNING_OBJECT (encoder, "failed to open %s", GST_PAD_NAME (pad));
+
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+
+  return GST_PAD (pad);
+
+  /* ERRORS */
+add_failed:
+  {
+    GST_ERROR_OBJECT (encoder, "failed to add %s", GST_PAD_NAME (pad));
+    gst_object_unref (pad);
+    return NULL;
+  }
+}
+
+static void
+gst_x264_enc_release_pad (GstElement * element, GstPad * pad)
+{
+  GstX264Enc *encoder = GST_X264_ENC (element);
+  GList *link;
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+  GST_OBJECT_LOCK (encoder);
+  link = g_list_find (encoder->renditions, pad);
+  if (link)
+    encoder->renditions = g_list_delete_link (encoder->renditions, link);
+  GST_OBJECT_UNLOCK (encoder);
+
+  if (!link) {
+    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+    return;
+  }
+
+  gst_x264_enc_wait_jobs (encoder);
+  gst_x264_enc_close_rendition (encoder, GST_X264_ENC_PAD (pad));
+  gst_flow_combiner_remove_pad (encoder->flow_combiner, pad);
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+
+  if (GST_OBJECT_PARENT (pad) == GST_OBJECT (element))
+    gst_element_remove_pad (element, pad);
+  gst_object_unref (pad);
+}
+
+static gboolean
+gst_x264_enc_set_profile_and_level (GstX264Enc * encoder, GstCaps * caps)
+{
+  x264_nal_t *nal;
+  int i_nal;
+  int header_return;
+  gint sps_ni = 0;
+  guint8 *sps;
+  GstStructure *s;
+  const gchar *profile;
+  GstCaps *allowed_caps;
+  GstStructure *s2;
+  const gchar *allowed_profile;
+
+  header_return =
+      encoder->vtable->x264_encoder_headers (encoder->x264enc, &nal, &i_nal);
+  if (header_return < 0) {
+    GST_ELEMENT_ERROR (encoder, STREAM, ENCODE, ("Encode x264 header failed."),
+        ("x264_encoder_headers return code=%d", header_return));
+    return FALSE;
+  }
+
+  /* old x264 returns SEI, SPS and PPS, newer one has SEI last */
+  if (i_nal == 3 && nal[sps_ni].i_type != 7)
+    sps_ni = 1;
+
+  sps = nal[sps_ni].p_payload + 4;
+  /* skip NAL unit type */
+  sps++;
+
+  gst_codec_utils_h264_caps_set_level_and_profile (caps, sps, 3);
+
+  /* Constrained baseline is a strict subset of baseline. If downstream
+   * wanted baseline and we produced constrained baseline, we can just
+   * set the profile to baseline in the caps to make negotiation happy.
+   * Same goes for baseline as subset of main profile and main as a subset
+   * of high profile.
+   */
+  s = gst_caps_get_structure (caps, 0);
+  profile = gst_structure_get_string (s, "profile");
+
+  allowed_caps = gst_pad_get_allowed_caps (GST_VIDEO_ENCODER_SRC_PAD (encoder));
+
+  if (allowed_caps == NULL)
+    goto no_peer;
+
+  if (!gst_caps_can_intersect (allowed_caps, caps)) {
+    allowed_caps = gst_caps_make_writable (allowed_caps);
+    allowed_caps = gst_caps_truncate (allowed_caps);
+    s2 = gst_caps_get_structure (allowed_caps, 0);
+    gst_structure_fixate_field_string (s2, "profile", profile);
+    allowed_profile = gst_structure_get_string (s2, "profile");
+    if (!strcmp (allowed_profile, "high")) {
+      if (!strcmp (profile, "constrained-baseline")
+          || !strcmp (profile, "baseline") || !strcmp (profile, "main")) {
+        gst_structure_set (s, "profile", G_TYPE_STRING, "high", NULL);
+        GST_INFO_OBJECT (encoder, "downstream requested high profile, but "
+            "encoder will now output %s profile (which is a subset), due "
+            "to how it's been configured", profile);
+      }
+    } else if (!strcmp (allowed_profile, "main")) {
+      if (!strcmp (profile, "constrained-baseline")
+          || !strcmp (profile, "baseline")) {
+        gst_structure_set (s, "profile", G_TYPE_STRING, "main", NULL);
+        GST_INFO_OBJECT (encoder, "downstream requested main profile, but "
+            "encoder will now output %s profile (which is a subset), due "
+            "to how it's been configured", profile);
+      }
+    } else if (!strcmp (allowed_profile, "baseline")) {
+      if (!strcmp (profile, "constrained-baseline"))
+        gst_structure_set (s, "profile", G_TYPE_STRING, "baseline", NULL);
+    }
+  }
+  gst_caps_unref (allowed_caps);
+
+no_peer:
+
+  return TRUE;
+}
+
+/*
+ * Returns: Buffer with the stream headers.
+ */
+static GstBuffer *
+gst_x264_enc_header_buf (GstX264Enc * encoder)
+{
+  GstBuffer *buf;
+  x264_nal_t *nal;
+  int i_nal;
+  int header_return;
+  int i_size;
   int nal_size;
   guint8 *buffer, *sps;
   gulong buffer_size;
@@ -2096,7 +4136,8 @@ gst_x264_enc_set_src_caps (GstX264Enc * encoder, GstCaps * caps)
     gst_structure_set (structure, "stream-format", G_TYPE_STRING, "byte-stream",
         NULL);
   }
-  gst_structure_set (structure, "alignment", G_TYPE_STRING, "au", NULL);
+  gst_structure_set (structure, "alignment", G_TYPE_STRING,
+      encoder->low_latency ? "nal" : "au", NULL);
 
   if (!gst_x264_enc_set_profile_and_level (encoder, outcaps)) {
     gst_caps_unref (outcaps);
@@ -2161,6 +4202,11 @@ gst_x264_enc_set_latency (GstX264Enc * encoder)
   max_delayed_frames =
       encoder->vtable->x264_encoder_maximum_delayed_frames (encoder->x264enc);
 
+  /* a frame also waits for the rest of its chunk, and for the chunks
+   * that are encoded before it */
+  if (encoder->chunk_workers)
+    max_delayed_frames += encoder->chunk_frames * (encoder->chunk_workers + 1);
+
   if (info->fps_n) {
     latency = gst_util_uint64_scale_ceil (GST_SECOND * info->fps_d,
         max_delayed_frames, info->fps_n);
@@ -2179,6 +4225,22 @@ gst_x264_enc_set_latency (GstX264Enc * encoder)
   gst_video_encoder_set_latency (GST_VIDEO_ENCODER (encoder), latency, latency);
 }
 
+static gboolean
+gst_x264_enc_upstream_seekable (GstX264Enc * encoder)
+{
+  GstQuery *query;
+  gboolean seekable = FALSE;
+
+  query = gst_query_new_seeking (GST_FORMAT_TIME);
+  if (gst_pad_peer_query (GST_VIDEO_ENCODER_SINK_PAD (encoder), query))
+    gst_query_parse_seeking (query, NULL, &seekable, NULL, NULL);
+  gst_query_unref (query);
+
+  GST_DEBUG_OBJECT (encoder, "upstream is %sseekable", seekable ? "" : "not ");
+
+  return seekable;
+}
+
 static gboolean
 gst_x264_enc_set_format (GstVideoEncoder * video_enc,
     GstVideoCodecState * state)
@@ -2202,6 +4264,10 @@ gst_x264_enc_set_format (GstVideoEncoder * video_enc,
       return TRUE;
     }
 
+    /* the statistics of the first pass are only valid for one format */
+    if (encoder->first_pass)
+      goto format_change_in_first_pass;
+
     /* clear out pending frames */
     gst_x264_enc_flush_frames (encoder, TRUE);
 
@@ -2288,28 +4354,159 @@ gst_x264_enc_set_format (GstVideoEncoder * video_enc,
       }
     }
 
-    gst_caps_unref (allowed_caps);
+    gst_caps_unref (allowed_caps);
+  }
+
+  gst_caps_unref (template_caps);
+
+  /* slices go out one by one */
+  if (encoder->low_latency)
+    encoder->current_byte_stream = GST_X264_ENC_STREAM_FORMAT_BYTE_STREAM;
+
+  /* the second pass reads the input again if it can, instead of keeping
+   * it in memory */
+  if (encoder->first_pass)
+    encoder->two_pass_seek = gst_x264_enc_upstream_seekable (encoder);
+
+  if (!gst_x264_enc_init_encoder (encoder))
+    return FALSE;
+
+  if (!gst_x264_enc_set_src_caps (encoder, state->caps)) {
+    gst_x264_enc_close_encoder (encoder);
+    return FALSE;
+  }
+
+  gst_x264_enc_set_latency (encoder);
+
+  return TRUE;
+
+  /* ERRORS */
+format_change_in_first_pass:
+  {
+    GST_WARNING_OBJECT (encoder, "Format changes are not supported with "
+        "two-pass encoding");
+    return FALSE;
+  }
+}
+
+static void
+gst_x264_enc_seek_upstream (GstElement * element, gpointer user_data)
+{
+  GstX264Enc *encoder = GST_X264_ENC (element);
+  GstEvent *seek = user_data;
+
+  if (!gst_pad_push_event (GST_VIDEO_ENCODER_SINK_PAD (encoder),
+          gst_event_ref (seek)))
+    GST_ELEMENT_ERROR (encoder, STREAM, FAILED,
+        ("Could not read the input again for the second pass."),
+        ("seek to the start of the segment failed"));
+}
+
+/* start the second pass at the EOS of the first one, and have upstream
+ * send the input again. The EOS is dropped, the one after the second pass
+ * goes downstream */
+static gboolean
+gst_x264_enc_rewind (GstX264Enc * encoder)
+{
+  GstSegment *segment = &GST_VIDEO_ENCODER (encoder)->input_segment;
+  GstClockTime start = 0, stop = GST_CLOCK_TIME_NONE;
+  GstEvent *seek;
+
+  GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+  gst_x264_enc_flush_frames (encoder, TRUE);
+
+  /* x264 writes the statistics out when the first pass encoder closes */
+  encoder->first_pass = FALSE;
+  gst_x264_enc_close_encoder (encoder);
+
+  /* the second pass has other headers */
+  if (!gst_x264_enc_init_encoder (encoder) ||
+      !gst_x264_enc_set_src_caps (encoder, encoder->input_state->caps))
+    goto init_failed;
+  gst_x264_enc_set_latency (encoder);
+
+  if (segment->format == GST_FORMAT_TIME) {
+    start = segment->start;
+    stop = segment->stop;
   }
+  GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
 
-  gst_caps_unref (template_caps);
+  GST_DEBUG_OBJECT (encoder, "second pass from %" GST_TIME_FORMAT,
+      GST_TIME_ARGS (start));
 
-  if (!gst_x264_enc_init_encoder (encoder))
-    return FALSE;
+  /* not from the streaming thread */
+  seek = gst_event_new_seek (1.0, GST_FORMAT_TIME,
+      GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE, GST_SEEK_TYPE_SET, start,
+      GST_SEEK_TYPE_SET, stop);
+  gst_element_call_async (GST_ELEMENT (encoder), gst_x264_enc_seek_upstream,
+      seek, (GDestroyNotify) gst_event_unref);
 
-  if (!gst_x264_enc_set_src_caps (encoder, state->caps)) {
-    gst_x264_enc_close_encoder (encoder);
+  return TRUE;
+
+  /* ERRORS */
+init_failed:
+  {
+    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+    GST_ELEMENT_ERROR (encoder, STREAM, ENCODE,
+        ("Can not initialize x264 encoder for the second pass."), (NULL));
     return FALSE;
   }
+}
+
+/* encode all frames again, with the statistics that x264 wrote out when
+ * the first pass encoder was closed */
+static GstFlowReturn
+gst_x264_enc_second_pass (GstX264Enc * encoder)
+{
+  GstVideoEncoder *video_enc = GST_VIDEO_ENCODER (encoder);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GList *frames, *l;
+
+  encoder->first_pass = FALSE;
+  gst_x264_enc_close_encoder (encoder);
 
+  /* the second pass has other headers */
+  if (!gst_x264_enc_init_encoder (encoder) ||
+      !gst_x264_enc_set_src_caps (encoder, encoder->input_state->caps))
+    goto init_failed;
   gst_x264_enc_set_latency (encoder);
 
-  return TRUE;
+  frames = gst_video_encoder_get_frames (video_enc);
+  GST_DEBUG_OBJECT (encoder, "second pass over %u frames",
+      g_list_length (frames));
+
+  for (l = frames; l; l = l->next) {
+    if (ret == GST_FLOW_OK)
+      ret = gst_x264_enc_handle_frame (video_enc, l->data);
+    else
+      gst_video_codec_frame_unref (l->data);
+  }
+  g_list_free (frames);
+
+  if (ret == GST_FLOW_OK)
+    gst_x264_enc_flush_frames (encoder, TRUE);
+
+  return ret;
+
+  /* ERRORS */
+init_failed:
+  {
+    GST_ELEMENT_ERROR (encoder, STREAM, ENCODE,
+        ("Can not initialize x264 encoder for the second pass."), (NULL));
+    return GST_FLOW_ERROR;
+  }
 }
 
 static GstFlowReturn
 gst_x264_enc_finish (GstVideoEncoder * encoder)
 {
-  gst_x264_enc_flush_frames (GST_X264_ENC (encoder), TRUE);
+  GstX264Enc *x264enc = GST_X264_ENC (encoder);
+
+  gst_x264_enc_flush_frames (x264enc, TRUE);
+
+  if (x264enc->first_pass && x264enc->x264enc)
+    return gst_x264_enc_second_pass (x264enc);
+
   return GST_FLOW_OK;
 }
 
@@ -2338,6 +4535,241 @@ gst_x264_enc_propose_allocation (GstVideoEncoder * encoder, GstQuery * query)
       query);
 }
 
+static gboolean
+gst_x264_enc_decide_allocation (GstVideoEncoder * encoder, GstQuery * query)
+{
+  GstX264Enc *self = GST_X264_ENC (encoder);
+
+  if (!GST_VIDEO_ENCODER_CLASS (parent_class)->decide_allocation (encoder,
+          query))
+    return FALSE;
+
+  /* the allocator might have changed, make a new pool when needed */
+  gst_x264_enc_clear_output_pool (self);
+
+  return TRUE;
+}
+
+static const gchar *
+gst_x264_enc_speed_level_name (GstX264Enc * encoder, gint speed_level)
+{
+  if (speed_level < 0)
+    return NULL;
+  if (speed_level == encoder->max_speed_level)
+    return "configured";
+  return speed_levels[speed_level].name;
+}
+
+/* with the object lock */
+static void
+gst_x264_enc_apply_speed_level (GstX264Enc * encoder, x264_param_t * param,
+    gint speed_level)
+{
+  const GstX264EncSpeedLevel *level;
+  const x264_param_t *configured = &encoder->speed_param;
+
+  /* the top level is what we were configured with */
+  if (speed_level == encoder->max_speed_level) {
+    param->analyse.i_me_method = configured->analyse.i_me_method;
+    param->analyse.i_me_range = configured->analyse.i_me_range;
+    if (param->analyse.i_subpel_refine)
+      param->analyse.i_subpel_refine =
+          MAX (configured->analyse.i_subpel_refine, 1);
+    param->i_frame_reference = MIN (configured->i_frame_reference,
+        encoder->max_ref);
+    param->analyse.i_trellis = configured->analyse.i_trellis;
+    param->analyse.inter = configured->analyse.inter;
+    param->analyse.b_mixed_references =
+        configured->analyse.b_mixed_references;
+    return;
+  }
+
+  level = &speed_levels[speed_level];
+  param->analyse.i_me_method = level->me;
+  param->analyse.i_me_range = level->me_range;
+  /* x264 can't switch out of subme=0 */
+  if (param->analyse.i_subpel_refine)
+    param->analyse.i_subpel_refine = MAX (level->subme, 1);
+  /* nor use more references than it started with */
+  param->i_frame_reference = MIN (level->ref, encoder->max_ref);
+  param->analyse.i_trellis = level->trellis;
+  param->analyse.inter = level->inter;
+  param->analyse.b_mixed_references = level->mixed_refs;
+}
+
+/* with the object lock */
+static void
+gst_x264_enc_set_speed_level (GstX264Enc * encoder, gint speed_level)
+{
+  GList *l;
+
+  GST_INFO_OBJECT (encoder, "Changing speed from %s to %s at load %.2f",
+      gst_x264_enc_speed_level_name (encoder, encoder->speed_level),
+      gst_x264_enc_speed_level_name (encoder, speed_level), encoder->load);
+
+  encoder->speed_level = speed_level;
+  encoder->frames_since_switch = 0;
+  encoder->stats_speed_changes++;
+
+  gst_x264_enc_apply_speed_level (encoder, &encoder->x264param, speed_level);
+  encoder->reconfig = TRUE;
+
+  for (l = encoder->renditions; l; l = l->next) {
+    GstX264EncPad *pad = l->data;
+
+    if (!pad->x264enc)
+      continue;
+    gst_x264_enc_apply_speed_level (encoder, &pad->x264param, speed_level);
+    pad->reconfig = TRUE;
+  }
+}
+
+/* account the encoding time of the last frame, and change speed when
+ * adaptive speed is enabled and it didn't fit in the budget for a while */
+static void
+gst_x264_enc_update_speed (GstX264Enc * encoder, GstClockTime budget)
+{
+  GstClockTime time = encoder->encode_time;
+  gdouble load;
+
+  GST_OBJECT_LOCK (encoder);
+  encoder->frame_budget = budget;
+  encoder->stats_frames++;
+  encoder->stats_last = time;
+  encoder->stats_max = MAX (encoder->stats_max, time);
+  if (encoder->stats_frames == 1)
+    encoder->stats_average = time;
+  else
+    encoder->stats_average = (encoder->stats_average * 7 + time) / 8;
+
+  if (!encoder->adaptive_speed || encoder->speed_level < 0
+      || !GST_CLOCK_TIME_IS_VALID (budget))
+    goto done;
+
+  load = budget ? (gdouble) time / budget : 2.0;
+  encoder->load = encoder->load * 0.875 + load * 0.125;
+  encoder->frames_since_switch++;
+
+  if (encoder->load > SPEED_LOAD_HIGH && encoder->speed_level > 0
+      && encoder->frames_since_switch >= SPEED_FASTER_FRAMES)
+    gst_x264_enc_set_speed_level (encoder, encoder->speed_level - 1);
+  else if (encoder->load < SPEED_LOAD_LOW
+      && encoder->speed_level < encoder->max_speed_level
+      && encoder->frames_since_switch >= SPEED_SLOWER_FRAMES)
+    gst_x264_enc_set_speed_level (encoder, encoder->speed_level + 1);
+
+done:
+  GST_OBJECT_UNLOCK (encoder);
+}
+
+/* the time there is for encoding @frame: its duration, or less when QoS
+ * says we are late already */
+static GstClockTime
+gst_x264_enc_get_frame_budget (GstX264Enc * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstVideoInfo *info = &encoder->input_state->info;
+  GstClockTime budget = GST_CLOCK_TIME_NONE;
+  GstClockTimeDiff max_time;
+
+  if (info->fps_n > 0 && info->fps_d > 0)
+    budget = gst_util_uint64_scale_int (GST_SECOND, info->fps_d, info->fps_n);
+  else if (GST_CLOCK_TIME_IS_VALID (frame->duration))
+    budget = frame->duration;
+
+  max_time = gst_video_encoder_get_max_encode_time (GST_VIDEO_ENCODER
+      (encoder), frame);
+  if (max_time < 0)
+    budget = 0;
+  else if (max_time != G_MAXINT64 && GST_CLOCK_TIME_IS_VALID (budget))
+    budget = MIN (budget, max_time);
+
+  return budget;
+}
+
+static void
+gst_x264_enc_forward_event (GstX264Enc * encoder, GstEvent * event)
+{
+  GList *pads, *l;
+
+  GST_OBJECT_LOCK (encoder);
+  pads = g_list_copy_deep (encoder->renditions, (GCopyFunc) gst_object_ref,
+      NULL);
+  GST_OBJECT_UNLOCK (encoder);
+
+  for (l = pads; l; l = l->next) {
+    GstX264EncPad *pad = l->data;
+
+    switch (GST_EVENT_TYPE (event)) {
+      case GST_EVENT_FLUSH_STOP:
+        pad->need_segment = TRUE;
+        break;
+      case GST_EVENT_EOS:
+        gst_x264_enc_push_sticky_events (encoder, pad);
+        break;
+      default:
+        break;
+    }
+    gst_pad_push_event (GST_PAD (pad), gst_event_ref (event));
+  }
+
+  g_list_free_full (pads, gst_object_unref);
+  gst_event_unref (event);
+}
+
+static gboolean
+gst_x264_enc_sink_event (GstVideoEncoder * encoder, GstEvent * event)
+{
+  GstX264Enc *self = GST_X264_ENC (encoder);
+  GstEvent *forward = NULL;
+  GList *l;
+  gboolean ret;
+
+  /* the input comes again for the second pass */
+  if (GST_EVENT_TYPE (event) == GST_EVENT_EOS && self->first_pass
+      && self->two_pass_seek && self->x264enc) {
+    gst_event_unref (event);
+    return gst_x264_enc_rewind (self);
+  }
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      /* the streaming thread might wait for a chunk */
+      gst_x264_enc_abort_chunks (self, TRUE);
+      forward = gst_event_ref (event);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+    case GST_EVENT_EOS:
+      forward = gst_event_ref (event);
+      break;
+    case GST_EVENT_SEGMENT:
+      GST_OBJECT_LOCK (self);
+      for (l = self->renditions; l; l = l->next)
+        GST_X264_ENC_PAD (l->data)->need_segment = TRUE;
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      break;
+  }
+
+  /* the base class keeps these for the next frame it finishes */
+  if (GST_EVENT_IS_SERIALIZED (event)
+      && GST_EVENT_TYPE (event) != GST_EVENT_EOS
+      && GST_EVENT_TYPE (event) != GST_EVENT_FLUSH_STOP) {
+    GST_VIDEO_ENCODER_STREAM_LOCK (encoder);
+    self->events_pending = TRUE;
+    GST_VIDEO_ENCODER_STREAM_UNLOCK (encoder);
+  }
+
+  /* the base class drains the encoders on EOS before this returns */
+  ret = GST_VIDEO_ENCODER_CLASS (parent_class)->sink_event (encoder, event);
+
+  if (forward)
+    gst_x264_enc_forward_event (self, forward);
+
+  return ret;
+}
+
 /* chain function
  * this function does the actual processing
  */
@@ -2349,55 +4781,71 @@ gst_x264_enc_handle_frame (GstVideoEncoder * video_enc,
   GstVideoInfo *info = &encoder->input_state->info;
   GstFlowReturn ret;
   x264_picture_t pic_in;
-  gint i_nal, i;
+  gint i_nal;
   FrameData *fdata;
-  gint nplanes = 0;
+  GstClockTime budget;
+  guint64 max_size;
 
   if (G_UNLIKELY (encoder->x264enc == NULL))
     goto not_inited;
 
-  /* create x264_picture_t from the buffer */
-  /* mostly taken from mplayer (file ve_x264.c) */
+  if (encoder->chunk_workers)
+    return gst_x264_enc_handle_chunk_frame (encoder, frame);
+
+  /* the frame might be gone after encoding */
+  encoder->encode_time = 0;
+  budget = gst_x264_enc_get_frame_budget (encoder, frame);
 
-  /* set up input picture */
-  memset (&pic_in, 0, sizeof (pic_in));
+  /* the frame stays around until the second pass */
+  if (encoder->first_pass && !encoder->two_pass_seek) {
+    encoder->first_pass_size += gst_buffer_get_size (frame->input_buffer);
+    GST_OBJECT_LOCK (encoder);
+    max_size = encoder->two_pass_max_size;
+    GST_OBJECT_UNLOCK (encoder);
+    if (max_size && encoder->first_pass_size > max_size)
+      goto first_pass_too_large;
+
+    gst_x264_enc_copy_input (frame);
+  }
 
   fdata = gst_x264_enc_queue_frame (encoder, frame, info);
   if (!fdata)
     goto invalid_frame;
 
-  pic_in.img.i_csp =
-      gst_x264_enc_gst_to_x264_video_format (info->finfo->format, &nplanes);
-  pic_in.img.i_plane = nplanes;
-  for (i = 0; i < nplanes; i++) {
-    pic_in.img.plane[i] = GST_VIDEO_FRAME_COMP_DATA (&fdata->vframe, i);
-    pic_in.img.i_stride[i] = GST_VIDEO_FRAME_COMP_STRIDE (&fdata->vframe, i);
-  }
+  gst_x264_enc_init_picture (&pic_in, info, &fdata->vframe, frame);
+  pic_in.opaque = fdata;
 
-  pic_in.i_type = X264_TYPE_AUTO;
-  pic_in.i_pts = frame->pts;
-  pic_in.opaque = GINT_TO_POINTER (frame->system_frame_number);
+  /* the renditions don't need the first pass */
+  if (encoder->renditions && !encoder->first_pass) {
+    GstBuffer *inbuf = frame->input_buffer;
 
-  if (GST_VIDEO_INFO_INTERLACE_MODE (info) == GST_VIDEO_INTERLACE_MODE_MIXED) {
-    if ((fdata->vframe.flags & GST_VIDEO_FRAME_FLAG_INTERLACED) == 0) {
-      pic_in.i_pic_struct = PIC_STRUCT_PROGRESSIVE;
-    } else if ((fdata->vframe.flags & GST_VIDEO_FRAME_FLAG_RFF) != 0) {
-      if ((fdata->vframe.flags & GST_VIDEO_FRAME_FLAG_TFF) != 0) {
-        pic_in.i_pic_struct = PIC_STRUCT_TOP_BOTTOM_TOP;
-      } else {
-        pic_in.i_pic_struct = PIC_STRUCT_BOTTOM_TOP_BOTTOM;
-      }
-    } else {
-      if ((fdata->vframe.flags & GST_VIDEO_FRAME_FLAG_TFF) != 0) {
-        pic_in.i_pic_struct = PIC_STRUCT_TOP_BOTTOM;
-      } else {
-        pic_in.i_pic_struct = PIC_STRUCT_BOTTOM_TOP;
-      }
-    }
+    if (GST_CLOCK_TIME_IS_VALID (frame->pts)
+        && GST_BUFFER_PTS_IS_VALID (inbuf))
+      encoder->rendition_time_adjustment =
+          GST_CLOCK_DIFF (GST_BUFFER_PTS (inbuf), frame->pts);
+    encoder->rendition_duration = frame->duration;
+
+    /* the renditions run next to the main encoder on the same mapping */
+    gst_x264_enc_encode_renditions (encoder, &pic_in, &fdata->vframe,
+        GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame));
   }
 
   ret = gst_x264_enc_encode_frame (encoder, &pic_in, frame, &i_nal, TRUE);
 
+  if (encoder->renditions && !encoder->first_pass) {
+    GstFlowReturn rendition_ret;
+
+    /* the main stream ending or not being linked doesn't stop the
+     * renditions either */
+    ret = gst_flow_combiner_update_pad_flow (encoder->flow_combiner,
+        GST_VIDEO_ENCODER_SRC_PAD (encoder), ret);
+    rendition_ret = gst_x264_enc_push_renditions (encoder, TRUE);
+    if (ret == GST_FLOW_OK)
+      ret = rendition_ret;
+  }
+
+  gst_x264_enc_update_speed (encoder, budget);
+
   /* input buffer is released later on */
   return ret;
 
@@ -2412,6 +4860,90 @@ invalid_frame:
     GST_ERROR_OBJECT (encoder, "Failed to map frame");
     return GST_FLOW_ERROR;
   }
+first_pass_too_large:
+  {
+    GST_ELEMENT_ERROR (encoder, RESOURCE, NO_SPACE_LEFT,
+        ("The input is too large for two-pass encoding."),
+        ("more than two-pass-max-size (%" G_GUINT64_FORMAT " bytes) of "
+            "input before EOS", max_size));
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_ERROR;
+  }
+}
+
+static gfloat
+gst_x264_enc_roi_delta_qp (GstX264Enc * encoder,
+    GstVideoRegionOfInterestMeta * roi)
+{
+  GstStructure *s;
+  gdouble delta;
+
+  s = gst_video_region_of_interest_meta_get_param (roi, "roi/x264enc");
+  if (s && gst_structure_get_double (s, "delta-qp", &delta))
+    return delta;
+
+  if (encoder->roi_types && gst_structure_get_double (encoder->roi_types,
+          g_quark_to_string (roi->roi_type), &delta))
+    return delta;
+
+  return encoder->roi_delta_qp;
+}
+
+/* with the object lock. The quant offsets for the regions of interest on
+ * @buf, or NULL if there are none. Where regions overlap, the one asking
+ * for the better quality wins. */
+static gfloat *
+gst_x264_enc_roi_quant_offsets (GstX264Enc * encoder, GstBuffer * buf)
+{
+  GstVideoInfo *info = &encoder->input_state->info;
+  GstVideoRegionOfInterestMeta *roi;
+  gpointer state = NULL;
+  gint mb_width, mb_height, size;
+  gint x, y, x0, y0, x1, y1;
+  gboolean found = FALSE;
+  gfloat delta;
+
+  mb_width = (GST_VIDEO_INFO_WIDTH (info) + 15) / 16;
+  mb_height = (GST_VIDEO_INFO_HEIGHT (info) + 15) / 16;
+  /* x264 encodes interlaced frames as macroblock pairs */
+  if (encoder->x264param.b_interlaced)
+    mb_height = GST_ROUND_UP_2 (mb_height);
+  size = mb_width * mb_height;
+
+  while ((roi = (GstVideoRegionOfInterestMeta *)
+          gst_buffer_iterate_meta_filtered (buf, &state,
+              GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+    if (!found) {
+      if (size != encoder->quant_offsets_size) {
+        encoder->quant_offsets = g_renew (gfloat, encoder->quant_offsets,
+            size);
+        encoder->quant_offsets_size = size;
+      }
+      memset (encoder->quant_offsets, 0, size * sizeof (gfloat));
+      found = TRUE;
+    }
+
+    delta = gst_x264_enc_roi_delta_qp (encoder, roi);
+    x0 = MIN ((gint) (roi->x / 16), mb_width);
+    y0 = MIN ((gint) (roi->y / 16), mb_height);
+    x1 = MIN ((gint) ((roi->x + roi->w + 15) / 16), mb_width);
+    y1 = MIN ((gint) ((roi->y + roi->h + 15) / 16), mb_height);
+
+    GST_LOG_OBJECT (encoder, "%s region %ux%u at %u,%u: delta QP %f",
+        g_quark_to_string (roi->roi_type), roi->w, roi->h, roi->x, roi->y,
+        delta);
+
+    for (y = y0; y < y1; y++) {
+      gfloat *offsets = encoder->quant_offsets + y * mb_width;
+
+      for (x = x0; x < x1; x++) {
+        if (offsets[x] == 0.0 || delta < offsets[x])
+          offsets[x] = delta;
+      }
+    }
+  }
+
+  return found ? encoder->quant_offsets : NULL;
 }
 
 static GstFlowReturn
@@ -2419,6 +4951,7 @@ gst_x264_enc_encode_frame (GstX264Enc * encoder, x264_picture_t * pic_in,
     GstVideoCodecFrame * input_frame, int *i_nal, gboolean send)
 {
   GstVideoCodecFrame *frame = NULL;
+  FrameData *fdata = NULL;
   GstBuffer *out_buf = NULL;
   x264_picture_t pic_out;
   x264_nal_t *nal;
@@ -2427,6 +4960,10 @@ gst_x264_enc_encode_frame (GstX264Enc * encoder, x264_picture_t * pic_in,
   GstFlowReturn ret = GST_FLOW_OK;
   guint8 *data;
   gboolean update_latency = FALSE;
+  GstClockTime start;
+  GstFlowReturn slice_ret = GST_FLOW_OK;
+  GstX264EncFrameStats stats;
+  gboolean have_stats = FALSE;
 
   if (G_UNLIKELY (encoder->x264enc == NULL)) {
     if (input_frame)
@@ -2446,19 +4983,48 @@ gst_x264_enc_encode_frame (GstX264Enc * encoder, x264_picture_t * pic_in,
   if (pic_in && input_frame) {
     if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (input_frame)) {
       GST_INFO_OBJECT (encoder, "Forcing key frame");
-      if (encoder->intra_refresh)
+      if (encoder->x264param.b_intra_refresh)
         encoder->vtable->x264_encoder_intra_refresh (encoder->x264enc);
       else
         pic_in->i_type = X264_TYPE_IDR;
     }
+
+    /* x264 takes these over into the frame right away, so lookahead and
+     * MB-tree see them too */
+    pic_in->prop.quant_offsets =
+        gst_x264_enc_roi_quant_offsets (encoder, input_frame->input_buffer);
   }
   GST_OBJECT_UNLOCK (encoder);
 
   if (G_UNLIKELY (update_latency))
     gst_x264_enc_set_latency (encoder);
 
+  if (encoder->x264param.nalu_process) {
+    GstPad *srcpad = GST_VIDEO_ENCODER_SRC_PAD (encoder);
+    GstEvent *segment;
+
+    gst_x264_enc_clear_slices (encoder);
+
+    /* the events that came before this frame go out with it */
+    if (encoder->events_pending && input_frame) {
+      encoder->events_frame = input_frame->system_frame_number;
+      encoder->events_pending = FALSE;
+    }
+
+    /* slices can only go out ahead of the frame once downstream has the
+     * caps and segment, and no events wait for a frame to finish */
+    segment = gst_pad_get_sticky_event (srcpad, GST_EVENT_SEGMENT, 0);
+    encoder->push_slices = send && !encoder->first_pass && segment
+        && gst_pad_has_current_caps (srcpad) && !encoder->events_pending
+        && encoder->events_frame < 0;
+    if (segment)
+      gst_event_unref (segment);
+  }
+
+  start = gst_util_get_timestamp ();
   encoder_return = encoder->vtable->x264_encoder_encode (encoder->x264enc,
       &nal, i_nal, pic_in, &pic_out);
+  encoder->encode_time += gst_util_get_timestamp () - start;
 
   if (encoder_return < 0) {
     GST_ELEMENT_ERROR (encoder, STREAM, ENCODE, ("Encode x264 frame failed."),
@@ -2466,6 +5032,8 @@ gst_x264_enc_encode_frame (GstX264Enc * encoder, x264_picture_t * pic_in,
     ret = GST_FLOW_ERROR;
     /* Make sure we finish this frame */
     frame = input_frame;
+    if (pic_in)
+      fdata = pic_in->opaque;
     goto out;
   }
 
@@ -2481,17 +5049,25 @@ gst_x264_enc_encode_frame (GstX264Enc * encoder, x264_picture_t * pic_in,
   i_size = encoder_return;
   data = nal[0].p_payload;
 
-  frame = gst_video_encoder_get_frame (GST_VIDEO_ENCODER (encoder),
-      GPOINTER_TO_INT (pic_out.opaque));
-  g_assert (frame || !send);
+  fdata = pic_out.opaque;
+  frame = gst_video_codec_frame_ref (fdata->frame);
+
+  /* the slices that didn't go out yet */
+  if (encoder->x264param.nalu_process)
+    out_buf = gst_x264_enc_take_slices (encoder, &slice_ret);
 
-  if (!send || !frame) {
+  if (!send || encoder->first_pass) {
+    if (out_buf)
+      gst_buffer_unref (out_buf);
     ret = GST_FLOW_OK;
     goto out;
   }
 
-  out_buf = gst_buffer_new_allocate (NULL, i_size, NULL);
-  gst_buffer_fill (out_buf, 0, data, i_size);
+  /* x264 reuses its bitstream buffer on the next call, so we need one copy */
+  if (!encoder->x264param.nalu_process) {
+    out_buf = gst_x264_enc_alloc_output_buffer (encoder, i_size);
+    gst_buffer_fill (out_buf, 0, data, i_size);
+  }
   frame->output_buffer = out_buf;
 
   GST_LOG_OBJECT (encoder,
@@ -2509,12 +5085,38 @@ gst_x264_enc_encode_frame (GstX264Enc * encoder, x264_picture_t * pic_in,
     GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
   }
 
+  gst_x264_enc_get_frame_stats (&stats, &encoder->x264param, &pic_out, i_size,
+      fdata->start);
+  have_stats = TRUE;
+
 out:
   if (frame) {
-    gst_x264_enc_dequeue_frame (encoder, frame);
-    ret = gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (encoder), frame);
+    if (fdata) {
+      /* renditions might still read the mapping */
+      gst_x264_enc_wait_jobs (encoder);
+      gst_x264_enc_dequeue_frame (encoder, fdata);
+    }
+    /* the held back events went out with this frame */
+    if (encoder->events_frame >= 0
+        && frame->system_frame_number >= encoder->events_frame)
+      encoder->events_frame = -1;
+
+    /* the second pass finishes it, unless it reads the input again */
+    if (encoder->first_pass && !encoder->two_pass_seek)
+      gst_video_codec_frame_unref (frame);
+    else
+      ret = gst_video_encoder_finish_frame (GST_VIDEO_ENCODER (encoder),
+          frame);
   }
 
+  if (have_stats && ret == GST_FLOW_OK)
+    gst_x264_enc_add_frame_stats (encoder, &stats,
+        encoder->vtable->x264_encoder_delayed_frames (encoder->x264enc));
+
+  /* pushing the earlier slices of the frame might have failed */
+  if (ret == GST_FLOW_OK)
+    ret = slice_ret;
+
   return ret;
 }
 
@@ -2524,12 +5126,22 @@ gst_x264_enc_flush_frames (GstX264Enc * encoder, gboolean send)
   GstFlowReturn flow_ret;
   gint i_nal;
 
+  if (encoder->chunk_workers) {
+    if (send)
+      gst_x264_enc_finish_chunks (encoder, TRUE);
+    else
+      gst_x264_enc_clear_chunks (encoder);
+  }
+
   /* first send the remaining frames */
   if (encoder->x264enc)
     do {
       flow_ret = gst_x264_enc_encode_frame (encoder, NULL, NULL, &i_nal, send);
     } while (flow_ret == GST_FLOW_OK
         && encoder->vtable->x264_encoder_delayed_frames (encoder->x264enc) > 0);
+
+  if (encoder->x264enc)
+    gst_x264_enc_flush_renditions (encoder, send);
 }
 
 static void
@@ -2550,6 +5162,7 @@ gst_x264_enc_reconfig (GstX264Enc * encoder)
     case GST_X264_ENC_PASS_PASS1:
     case GST_X264_ENC_PASS_PASS2:
     case GST_X264_ENC_PASS_PASS3:
+    case GST_X264_ENC_PASS_TWO_PASS:
     default:
       encoder->x264param.rc.i_bitrate = encoder->bitrate;
       encoder->x264param.rc.i_vbv_max_bitrate = encoder->bitrate;
@@ -2562,12 +5175,94 @@ gst_x264_enc_reconfig (GstX264Enc * encoder)
   encoder->reconfig = TRUE;
 }
 
+/* the options x264_encoder_reconfig() takes over, the others only take
+ * effect when the encoder is restarted */
+static const gchar *reconfig_options[] = {
+  "ref", "deblock", "filter", "nf", "partitions", "analyse", "8x8dct",
+  "direct", "direct-pred", "me", "merange", "me-range", "subme", "subq",
+  "trellis", "nr", "chroma-me", "mixed-refs", "dct-decimate", "fast-pskip",
+  "psy-rd", "crf", "crf-max", "bitrate", "vbv-maxrate", "vbv-bufsize", NULL
+};
+
+static gboolean
+gst_x264_enc_is_reconfig_option (const gchar * option)
+{
+  gchar *name = g_strndup (option, strcspn (option, "="));
+  const gchar *n = name;
+  gboolean ret = FALSE;
+  guint i;
+
+  /* spelled like x264_param_parse() accepts them */
+  g_strdelimit (name, "_", '-');
+  if (g_str_has_prefix (n, "no")) {
+    n += 2;
+    if (*n == '-')
+      n++;
+  }
+
+  for (i = 0; reconfig_options[i] && !ret; i++)
+    ret = !strcmp (n, reconfig_options[i]);
+  g_free (name);
+
+  return ret;
+}
+
+/* pass options that were set while playing on to the running encoders,
+ * as far as x264_encoder_reconfig() allows changing them */
+static void
+gst_x264_enc_reconfig_options (GstX264Enc * encoder, const gchar * options)
+{
+  GString *str;
+  GStrv kvpairs;
+  GList *l;
+  guint i;
+
+  if (!encoder->vtable || !options || !*options)
+    return;
+
+  str = g_string_new (NULL);
+  kvpairs = g_strsplit (options, ":", 0);
+  for (i = 0; kvpairs[i]; i++) {
+    if (!*kvpairs[i])
+      continue;
+    if (!gst_x264_enc_is_reconfig_option (kvpairs[i])) {
+      GST_DEBUG_OBJECT (encoder, "%s needs a restart to take effect",
+          kvpairs[i]);
+      continue;
+    }
+    g_string_append_printf (str, ":%s", kvpairs[i]);
+  }
+  g_strfreev (kvpairs);
+
+  if (str->len == 0)
+    goto done;
+
+  GST_DEBUG_OBJECT (encoder, "Reconfiguring with options: %s", str->str);
+
+  gst_x264_enc_parse_options (encoder, &encoder->x264param, str->str);
+  gst_x264_enc_parse_options (encoder, &encoder->speed_param, str->str);
+  encoder->reconfig = TRUE;
+
+  for (l = encoder->renditions; l; l = l->next) {
+    GstX264EncPad *pad = l->data;
+
+    if (!pad->x264enc)
+      continue;
+    gst_x264_enc_parse_options (encoder, &pad->x264param, str->str);
+    pad->reconfig = TRUE;
+  }
+
+done:
+  g_string_free (str, TRUE);
+}
+
 static void
 gst_x264_enc_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
 {
   GstX264Enc *encoder;
   GstState state;
+  gsize options_len;
 
   const gchar *partitions = NULL;
 
@@ -2582,6 +5277,8 @@ gst_x264_enc_set_property (GObject * object, guint prop_id,
       !(pspec->flags & GST_PARAM_MUTABLE_PLAYING))
     goto wrong_state;
 
+  options_len = encoder->option_string->len;
+
   switch (prop_id) {
     case ARG_PASS:
       encoder->pass = g_value_get_enum (value);
@@ -2609,6 +5306,9 @@ gst_x264_enc_set_property (GObject * object, guint prop_id,
       break;
     case ARG_OPTION_STRING:
       g_string_assign (encoder->option_string_prop, g_value_get_string (value));
+      /* element properties still take precedence */
+      gst_x264_enc_reconfig_options (encoder, encoder->option_string_prop->str);
+      gst_x264_enc_reconfig_options (encoder, encoder->option_string->str);
       break;
     case ARG_THREADS:
       encoder->threads = g_value_get_uint (value);
@@ -2763,10 +5463,50 @@ gst_x264_enc_set_property (GObject * object, guint prop_id,
     case ARG_INSERT_VUI:
       encoder->insert_vui = g_value_get_boolean (value);
       break;
+    case ARG_LOW_LATENCY:
+      encoder->low_latency = g_value_get_boolean (value);
+      break;
+    case ARG_SLICE_MAX_SIZE:
+      encoder->slice_max_size = g_value_get_uint (value);
+      break;
+    case ARG_ROI_DELTA_QP:
+      encoder->roi_delta_qp = g_value_get_float (value);
+      break;
+    case ARG_ROI_TYPES:
+      if (encoder->roi_types)
+        gst_structure_free (encoder->roi_types);
+      encoder->roi_types = g_value_dup_boxed (value);
+      break;
+    case ARG_CHUNK_FRAMES:
+      encoder->chunk_frames = g_value_get_uint (value);
+      break;
+    case ARG_CHUNK_ENCODERS:
+      encoder->chunk_encoders = g_value_get_uint (value);
+      break;
+    case ARG_FRAME_STATS:
+      encoder->frame_stats = g_value_get_boolean (value);
+      break;
+    case ARG_TWO_PASS_MAX_SIZE:
+      encoder->two_pass_max_size = g_value_get_uint64 (value);
+      break;
+    case ARG_ADAPTIVE_SPEED:
+      encoder->adaptive_speed = g_value_get_boolean (value);
+      /* back to the settings we started with */
+      if (!encoder->adaptive_speed && encoder->vtable
+          && encoder->speed_level >= 0
+          && encoder->speed_level != encoder->max_speed_level)
+        gst_x264_enc_set_speed_level (encoder, encoder->max_speed_level);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
+
+  /* a property that is mutable while playing added its option */
+  if (encoder->option_string->len > options_len)
+    gst_x264_enc_reconfig_options (encoder,
+        encoder->option_string->str + options_len);
+
   GST_OBJECT_UNLOCK (encoder);
   return;
 
@@ -2905,6 +5645,49 @@ gst_x264_enc_get_property (GObject * object, guint prop_id,
     case ARG_INSERT_VUI:
       g_value_set_boolean (value, encoder->insert_vui);
       break;
+    case ARG_ADAPTIVE_SPEED:
+      g_value_set_boolean (value, encoder->adaptive_speed);
+      break;
+    case ARG_LOW_LATENCY:
+      g_value_set_boolean (value, encoder->low_latency);
+      break;
+    case ARG_SLICE_MAX_SIZE:
+      g_value_set_uint (value, encoder->slice_max_size);
+      break;
+    case ARG_ROI_DELTA_QP:
+      g_value_set_float (value, encoder->roi_delta_qp);
+      break;
+    case ARG_ROI_TYPES:
+      g_value_set_boxed (value, encoder->roi_types);
+      break;
+    case ARG_CHUNK_FRAMES:
+      g_value_set_uint (value, encoder->chunk_frames);
+      break;
+    case ARG_CHUNK_ENCODERS:
+      g_value_set_uint (value, encoder->chunk_encoders);
+      break;
+    case ARG_FRAME_STATS:
+      g_value_set_boolean (value, encoder->frame_stats);
+      break;
+    case ARG_TWO_PASS_MAX_SIZE:
+      g_value_set_uint64 (value, encoder->two_pass_max_size);
+      break;
+    case ARG_ROLLING_STATS:
+      g_value_take_boxed (value, gst_x264_enc_get_rolling_stats (encoder));
+      break;
+    case ARG_TIMING_STATS:
+      g_value_take_boxed (value, gst_structure_new ("x264enc-timing",
+              "frames", G_TYPE_UINT64, encoder->stats_frames,
+              "last-encode-time", G_TYPE_UINT64, encoder->stats_last,
+              "average-encode-time", G_TYPE_UINT64, encoder->stats_average,
+              "max-encode-time", G_TYPE_UINT64, encoder->stats_max,
+              "budget", G_TYPE_UINT64, encoder->frame_budget,
+              "load", G_TYPE_DOUBLE, encoder->load,
+              "speed-level", G_TYPE_STRING,
+              gst_x264_enc_speed_level_name (encoder, encoder->speed_level),
+              "speed-changes", G_TYPE_UINT, encoder->stats_speed_changes,
+              NULL));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2936,6 +5719,7 @@ plugin_init (GstPlugin * plugin)
   default_vtable.x264_encoder_open = x264_encoder_open;
   default_vtable.x264_encoder_reconfig = x264_encoder_reconfig;
   default_vtable.x264_levels = &x264_levels;
+  default_vtable.x264_nal_encode = x264_nal_encode;
   default_vtable.x264_param_apply_fastfirstpass =
       x264_param_apply_fastfirstpass;
   default_vtable.x264_param_apply_profile = x264_param_apply_profile;
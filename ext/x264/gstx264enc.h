@@ -25,6 +25,7 @@
 #include <gst/gst.h>
 #include <gst/video/video.h>
 #include <gst/video/gstvideoencoder.h>
+#include <gst/base/gstflowcombiner.h>
 
 #ifdef HAVE_STDINT_H
 #include <stdint.h>
@@ -56,6 +57,84 @@ typedef struct _GstX264Enc GstX264Enc;
 typedef struct _GstX264EncClass GstX264EncClass;
 typedef struct _GstX264EncVTable GstX264EncVTable;
 
+#define GST_TYPE_X264_ENC_PAD \
+  (gst_x264_enc_pad_get_type())
+#define GST_X264_ENC_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_X264_ENC_PAD,GstX264EncPad))
+#define GST_IS_X264_ENC_PAD(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_X264_ENC_PAD))
+
+typedef struct _GstX264EncPad GstX264EncPad;
+typedef struct _GstX264EncPadClass GstX264EncPadClass;
+typedef struct _GstX264EncScaler GstX264EncScaler;
+typedef struct _GstX264EncChunk GstX264EncChunk;
+
+/* what x264 tells about an encoded frame. qp, ssim and psnr are negative
+ * when unknown */
+typedef struct
+{
+  GstClockTime pts;
+  gint type;
+  gdouble qp;
+  gsize size;
+  gdouble ssim;
+  gdouble psnr;
+  GstClockTime latency;
+} GstX264EncFrameStats;
+
+#define GST_X264_ENC_STATS_WINDOW 250
+
+/* a piece of work for the worker pool */
+typedef struct
+{
+  void (*func) (GstX264Enc * encoder, gpointer data);
+  gpointer data;
+} GstX264EncJob;
+
+/* duration of a frame in a rendition encoder, found by its PTS */
+typedef struct
+{
+  GstClockTime pts;
+  GstClockTime duration;
+} GstX264EncDuration;
+
+/* source pad of an additional rendition of the input */
+struct _GstX264EncPad
+{
+  GstPad pad;
+
+  /* properties */
+  guint bitrate;
+  gint width;
+  gint height;
+  gchar *profile;
+
+  /*< private >*/
+  x264_t *x264enc;
+  x264_param_t x264param;
+  GstCaps *caps;
+
+  /* options changed while playing, protected by the element lock */
+  gboolean reconfig;
+
+  /* scaled input, NULL at the input size */
+  GstX264EncScaler *scaler;
+
+  GstX264EncJob job;
+  GstBuffer *out_buf;
+  gint encoder_return;
+  GArray *durations;
+
+  gboolean need_stream_start;
+  gboolean need_caps;
+  gboolean need_segment;
+};
+
+struct _GstX264EncPadClass
+{
+  GstPadClass parent_class;
+};
+
 struct _GstX264Enc
 {
   GstVideoEncoder element;
@@ -66,9 +145,48 @@ struct _GstX264Enc
   x264_param_t x264param;
   gint current_byte_stream;
 
-  /* List of frame/buffer mapping structs for
-   * pending frames */
-  GList *pending_frames;
+  /* frame/buffer mapping structs for pending frames, and
+   * a pool of unused ones */
+  GQueue pending_frames;
+  GQueue free_frames;
+
+  /* output buffers, from the negotiated allocator */
+  GstBufferPool *output_pool;
+  gsize output_pool_size;
+
+  /* ABR ladder: request pads with encoders of their own, run together
+   * on a pool of workers. The list is protected by both the stream lock
+   * and the object lock */
+  GList *renditions;
+  guint next_rendition;
+  GstFlowCombiner *flow_combiner;
+  GList *scalers;
+  GThreadPool *workers;
+  GMutex jobs_lock;
+  GCond jobs_cond;
+  guint jobs_pending;
+
+  /* the input of the renditions while encoding a frame */
+  x264_picture_t rendition_pic;
+  gboolean rendition_pic_valid;
+  gboolean rendition_force_keyframe;
+  GstVideoFrame *rendition_src;
+  GstClockTimeDiff rendition_time_adjustment;
+  GstClockTime rendition_duration;
+
+  /* chunked encoding: the input is cut into closed chunks that are each
+   * encoded on an encoder of their own, on chunk_workers of the workers,
+   * and output in order. The chunks are protected by the jobs lock while
+   * encoding */
+  guint chunk_workers;
+  GstX264EncChunk *chunk;
+  GQueue chunks;
+  GstClockTimeDiff chunk_dts_offset;
+  gboolean chunk_dts_offset_valid;
+  /* set when flushing, the chunk encoders stop at the next frame */
+  gint chunks_abort;
+  guint8 *scene_luma;
+  gsize scene_luma_size;
 
   /* properties */
   guint threads;
@@ -113,6 +231,71 @@ struct _GstX264Enc
   gint frame_packing;
   gboolean insert_vui;
 
+  gboolean adaptive_speed;
+  gboolean low_latency;
+  guint slice_max_size;
+  gfloat roi_delta_qp;
+  GstStructure *roi_types;
+  guint chunk_frames;
+  guint chunk_encoders;
+  gboolean frame_stats;
+  guint64 two_pass_max_size;
+
+  /* per-macroblock quant offsets for the regions of interest, kept for
+   * the next frames of the same size */
+  gfloat *quant_offsets;
+  gint quant_offsets_size;
+
+  /* two-pass: all frames are encoded again at EOS, with the statistics
+   * in a private directory. They are read again from upstream when it is
+   * seekable, two_pass_seek, or kept during the first pass */
+  gboolean first_pass;
+  gboolean two_pass_seek;
+  guint64 first_pass_size;
+  gchar *stats_dir;
+  gchar *stats_file;
+
+  /* adaptive speed: the current and slowest speed level, the settings of
+   * the slowest level, the average share of the frame budget spent
+   * encoding and the frames since the last change */
+  gint speed_level;
+  gint max_speed_level;
+  x264_param_t speed_param;
+  guint max_ref;
+  gdouble load;
+  guint frames_since_switch;
+
+  /* encode timing of the current frame, and over the stream */
+  GstClockTime encode_time;
+  GstClockTime frame_budget;
+  guint64 stats_frames;
+  GstClockTime stats_last;
+  GstClockTime stats_average;
+  GstClockTime stats_max;
+  guint stats_speed_changes;
+
+  /* the statistics of the last frames, for rolling-stats, and the frames
+   * that were still in the encoder */
+  GstX264EncFrameStats stats_window[GST_X264_ENC_STATS_WINDOW];
+  guint stats_window_pos;
+  guint stats_window_len;
+  gint stats_delayed;
+
+  /* low-latency: slices from the x264 threads, in macroblock order. All
+   * but the last one of a frame go out as soon as they are ready, when
+   * push_slices, or are collected into slice_au */
+  GMutex slice_lock;
+  GList *pending_slices;
+  gint next_mb;
+  GstBuffer *held_slice;
+  GstBuffer *slice_au;
+  gboolean push_slices;
+  GstFlowReturn slice_flow;
+  /* the base class holds serialized events back until the next frame is
+   * finished, events_frame, and the slices can't go out before them */
+  gboolean events_pending;
+  gint64 events_frame;
+
   /* input description */
   GstVideoCodecState *input_state;
 
@@ -131,6 +314,7 @@ struct _GstX264EncClass
 };
 
 GType gst_x264_enc_get_type (void);
+GType gst_x264_enc_pad_get_type (void);
 
 G_END_DECLS
 
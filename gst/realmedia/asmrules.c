@@ -24,6 +24,16 @@
 
 #define MAX_RULE_LENGTH	2048
 
+/* the number of different variable sets for which we remember the matched
+ * rules, the cache is cleared when it grows bigger */
+#define MAX_CACHE_ENTRIES 64
+
+typedef struct
+{
+  gint n_matches;
+  gint matches[MAX_RULEMATCHES];
+} GstASMMatch;
+
 /* define to enable some more debug */
 #undef DEBUG
 
@@ -86,46 +96,6 @@ gst_asm_operator_eval (GstASMOp optype, gfloat left, gfloat right)
   return result;
 }
 
-static gfloat
-gst_asm_node_evaluate (GstASMNode * node, GHashTable * vars)
-{
-  gfloat result = 0.0;
-
-  if (node == NULL)
-    return 0.0;
-
-  switch (node->type) {
-    case GST_ASM_NODE_VARIABLE:
-    {
-      gchar *val;
-
-      val = g_hash_table_lookup (vars, node->data.varname);
-      if (val)
-        result = (gfloat) atof (val);
-      break;
-    }
-    case GST_ASM_NODE_INTEGER:
-      result = (gfloat) node->data.intval;
-      break;
-    case GST_ASM_NODE_FLOAT:
-      result = node->data.floatval;
-      break;
-    case GST_ASM_NODE_OPERATOR:
-    {
-      gfloat left, right;
-
-      left = gst_asm_node_evaluate (node->left, vars);
-      right = gst_asm_node_evaluate (node->right, vars);
-
-      result = gst_asm_operator_eval (node->data.optype, left, right);
-      break;
-    }
-    default:
-      break;
-  }
-  return result;
-}
-
 #define IS_SPACE(p) (((p) == ' ') || ((p) == '\n') || \
                      ((p) == '\r') || ((p) == '\t'))
 #define IS_RULE_DELIM(p) (((p) == ',') || ((p) == ';') || ((p) == ')'))
@@ -419,7 +389,7 @@ gst_asm_rule_new (void)
 {
   GstASMRule *rule;
 
-  rule = g_new (GstASMRule, 1);
+  rule = g_new0 (GstASMRule, 1);
   rule->root = NULL;
   rule->props = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
@@ -432,6 +402,7 @@ gst_asm_rule_free (GstASMRule * rule)
   g_hash_table_destroy (rule->props);
   if (rule->root)
     gst_asm_node_free (rule->root);
+  g_free (rule->code);
   g_free (rule);
 }
 
@@ -462,12 +433,12 @@ gst_asm_scan_parse_operand (GstASMScan * scan)
     case GST_ASM_TOKEN_INT:
       node = gst_asm_node_new ();
       node->type = GST_ASM_NODE_INTEGER;
-      node->data.intval = (gfloat) atof (scan->val);
+      node->data.intval = atoi (scan->val);
       break;
     case GST_ASM_TOKEN_FLOAT:
       node = gst_asm_node_new ();
       node->type = GST_ASM_NODE_FLOAT;
-      node->data.floatval = atoi (scan->val);
+      node->data.floatval = (gfloat) atof (scan->val);
       break;
     case GST_ASM_TOKEN_LPAREN:
       gst_asm_scan_next_token (scan);
@@ -578,17 +549,111 @@ gst_asm_scan_parse_rule (GstASMScan * scan)
   return rule;
 }
 
-static gboolean
-gst_asm_rule_evaluate (GstASMRule * rule, GHashTable * vars)
+static guint
+gst_asm_rule_book_get_slot (GstASMRuleBook * book, const gchar * varname)
 {
-  gboolean res;
+  guint i;
 
-  if (rule->root) {
-    res = (gboolean) gst_asm_node_evaluate (rule->root, vars);
-  } else
-    res = TRUE;
+  for (i = 0; i < book->vars->len; i++) {
+    if (strcmp (g_ptr_array_index (book->vars, i), varname) == 0)
+      return i;
+  }
+  g_ptr_array_add (book->vars, g_strdup (varname));
 
-  return res;
+  return i;
+}
+
+/* emit the instructions for @node in postfix order, returns the stack depth
+ * needed to evaluate @node */
+static guint
+gst_asm_node_compile (GstASMNode * node, GstASMRuleBook * book, GArray * code)
+{
+  GstASMInstr instr = { 0, };
+  guint left, right;
+
+  if (node == NULL) {
+    /* a missing operand evaluates to 0 */
+    instr.type = GST_ASM_INSTR_CONST;
+    instr.value = 0.0;
+    g_array_append_val (code, instr);
+    return 1;
+  }
+
+  switch (node->type) {
+    case GST_ASM_NODE_VARIABLE:
+      instr.type = GST_ASM_INSTR_VAR;
+      instr.slot = gst_asm_rule_book_get_slot (book, node->data.varname);
+      break;
+    case GST_ASM_NODE_INTEGER:
+      instr.type = GST_ASM_INSTR_CONST;
+      instr.value = (gfloat) node->data.intval;
+      break;
+    case GST_ASM_NODE_FLOAT:
+      instr.type = GST_ASM_INSTR_CONST;
+      instr.value = node->data.floatval;
+      break;
+    case GST_ASM_NODE_OPERATOR:
+      left = gst_asm_node_compile (node->left, book, code);
+      right = gst_asm_node_compile (node->right, book, code);
+      instr.type = GST_ASM_INSTR_OPERATOR;
+      instr.optype = node->data.optype;
+      g_array_append_val (code, instr);
+      return MAX (left, right + 1);
+    default:
+      instr.type = GST_ASM_INSTR_CONST;
+      instr.value = 0.0;
+      break;
+  }
+  g_array_append_val (code, instr);
+
+  return 1;
+}
+
+static void
+gst_asm_rule_compile (GstASMRule * rule, GstASMRuleBook * book)
+{
+  GArray *code;
+
+  /* rules without condition always match */
+  if (rule->root == NULL)
+    return;
+
+  code = g_array_new (FALSE, FALSE, sizeof (GstASMInstr));
+  rule->stack_size = gst_asm_node_compile (rule->root, book, code);
+  rule->n_code = code->len;
+  rule->code = (GstASMInstr *) g_array_free (code, FALSE);
+}
+
+static gboolean
+gst_asm_rule_evaluate (GstASMRule * rule, const gfloat * values)
+{
+  gfloat *stack;
+  guint i, sp;
+
+  if (rule->code == NULL)
+    return TRUE;
+
+  stack = g_newa (gfloat, rule->stack_size);
+  sp = 0;
+
+  for (i = 0; i < rule->n_code; i++) {
+    const GstASMInstr *instr = &rule->code[i];
+
+    switch (instr->type) {
+      case GST_ASM_INSTR_CONST:
+        stack[sp++] = instr->value;
+        break;
+      case GST_ASM_INSTR_VAR:
+        stack[sp++] = values[instr->slot];
+        break;
+      case GST_ASM_INSTR_OPERATOR:
+        sp--;
+        stack[sp - 1] =
+            gst_asm_operator_eval (instr->optype, stack[sp - 1], stack[sp]);
+        break;
+    }
+  }
+  return (gboolean) stack[0];
 }
 
 GstASMRuleBook *
@@ -601,6 +666,10 @@ gst_asm_rule_book_new (const gchar * rulebook)
 
   book = g_new0 (GstASMRuleBook, 1);
   book->rulebook = rulebook;
+  book->vars = g_ptr_array_new_with_free_func (g_free);
+  g_mutex_init (&book->lock);
+  book->cache = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+      (GDestroyNotify) g_bytes_unref, g_free);
 
   scan = gst_asm_scan_new (book->rulebook);
   gst_asm_scan_next_token (scan);
@@ -608,6 +677,7 @@ gst_asm_rule_book_new (const gchar * rulebook)
   do {
     rule = gst_asm_scan_parse_rule (scan);
     if (rule) {
+      gst_asm_rule_compile (rule, book);
       book->rules = g_list_append (book->rules, rule);
       book->n_rules++;
     }
@@ -630,26 +700,276 @@ gst_asm_rule_book_free (GstASMRuleBook * book)
     gst_asm_rule_free (rule);
   }
   g_list_free (book->rules);
+  g_ptr_array_free (book->vars, TRUE);
+  g_hash_table_destroy (book->cache);
+  g_mutex_clear (&book->lock);
   g_free (book);
 }
 
+/**
+ * gst_asm_rule_book_match:
+ * @book: a #GstASMRuleBook
+ * @vars: variable name to value string mapping
+ * @rulematches: array of at least MAX_RULEMATCHES entries
+ *
+ * Evaluate all rules of @book with the variables in @vars and store the
+ * indexes of the matching rules in @rulematches. The result is cached for
+ * the values of the variables used in @book, matching again with the same
+ * values doesn't evaluate the rules anymore.
+ *
+ * Returns: the number of matching rules
+ */
 gint
 gst_asm_rule_book_match (GstASMRuleBook * book, GHashTable * vars,
     gint * rulematches)
 {
   GList *walk;
-  gint i, n = 0;
+  gint i;
+  guint slot;
+  gfloat *values;
+  GBytes *key;
+  GstASMMatch *match;
+
+  /* resolve all variables once */
+  values = g_newa (gfloat, MAX (book->vars->len, 1));
+  for (slot = 0; slot < book->vars->len; slot++) {
+    gchar *val;
+
+    val = g_hash_table_lookup (vars, g_ptr_array_index (book->vars, slot));
+    values[slot] = val ? (gfloat) atof (val) : 0.0;
+  }
+  key = g_bytes_new (values, book->vars->len * sizeof (gfloat));
 
-  for (walk = book->rules, i = 0; walk; walk = g_list_next (walk), i++) {
-    GstASMRule *rule = (GstASMRule *) walk->data;
+  g_mutex_lock (&book->lock);
+  match = g_hash_table_lookup (book->cache, key);
+  if (match == NULL) {
+    match = g_new0 (GstASMMatch, 1);
+
+    for (walk = book->rules, i = 0; walk; walk = g_list_next (walk), i++) {
+      GstASMRule *rule = (GstASMRule *) walk->data;
 
-    if (gst_asm_rule_evaluate (rule, vars)) {
-      rulematches[n++] = i;
+      if (gst_asm_rule_evaluate (rule, values)) {
+        if (match->n_matches == MAX_RULEMATCHES)
+          break;
+        match->matches[match->n_matches++] = i;
+      }
     }
+
+    if (g_hash_table_size (book->cache) >= MAX_CACHE_ENTRIES)
+      g_hash_table_remove_all (book->cache);
+    g_hash_table_insert (book->cache, g_bytes_ref (key), match);
   }
+  memcpy (rulematches, match->matches, match->n_matches * sizeof (gint));
+  i = match->n_matches;
+  g_mutex_unlock (&book->lock);
+
+  g_bytes_unref (key);
+
+  return i;
+}
+
+/**
+ * gst_asm_rule_book_match_bandwidth:
+ * @book: a #GstASMRuleBook
+ * @bandwidth: value for $Bandwidth
+ * @rulematches: array of at least MAX_RULEMATCHES entries
+ *
+ * Match the rules of @book for a connection of @bandwidth bits per second.
+ *
+ * Returns: the number of matching rules
+ */
+gint
+gst_asm_rule_book_match_bandwidth (GstASMRuleBook * book, guint bandwidth,
+    gint * rulematches)
+{
+  GHashTable *vars;
+  gchar str[16];
+  gint n;
+
+  g_snprintf (str, sizeof (str), "%u", bandwidth);
+
+  vars = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_insert (vars, (gchar *) "Bandwidth", str);
+  n = gst_asm_rule_book_match (book, vars, rulematches);
+  g_hash_table_destroy (vars);
+
   return n;
 }
 
+/**
+ * gst_asm_rule_book_get_bandwidth:
+ * @book: a #GstASMRuleBook
+ * @rulematches: rules matched in @book
+ * @n: number of rules in @rulematches
+ *
+ * Returns: the sum of the AverageBandwidth properties of @rulematches, in
+ * bits per second
+ */
+guint
+gst_asm_rule_book_get_bandwidth (GstASMRuleBook * book,
+    const gint * rulematches, gint n)
+{
+  guint bandwidth = 0;
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    GstASMRule *rule;
+    const gchar *val;
+
+    rule = g_list_nth_data (book->rules, rulematches[i]);
+    if (rule == NULL)
+      continue;
+
+    val = g_hash_table_lookup (rule->props, "AverageBandwidth");
+    if (val)
+      bandwidth += atoi (val);
+  }
+  return bandwidth;
+}
+
+static guint
+gst_asm_rule_book_get_bandwidth_at (GstASMRuleBook * book, guint bandwidth)
+{
+  gint rulematches[MAX_RULEMATCHES];
+  gint n;
+
+  n = gst_asm_rule_book_match_bandwidth (book, bandwidth, rulematches);
+
+  return gst_asm_rule_book_get_bandwidth (book, rulematches, n);
+}
+
+static gboolean
+gst_asm_node_is_bandwidth (GstASMNode * node)
+{
+  return node && node->type == GST_ASM_NODE_VARIABLE &&
+      !strcmp (node->data.varname, "Bandwidth");
+}
+
+static void
+gst_asm_node_lower_bandwidth (GstASMNode * node, guint bandwidth,
+    guint * result)
+{
+  GstASMNode *other;
+  gfloat value;
+  guint c;
+
+  if (node == NULL || node->type != GST_ASM_NODE_OPERATOR)
+    return;
+
+  if (node->data.optype == GST_ASM_OP_AND ||
+      node->data.optype == GST_ASM_OP_OR) {
+    gst_asm_node_lower_bandwidth (node->left, bandwidth, result);
+    gst_asm_node_lower_bandwidth (node->right, bandwidth, result);
+    return;
+  }
+
+  /* only comparisons of $Bandwidth with a number are thresholds */
+  if (gst_asm_node_is_bandwidth (node->left))
+    other = node->right;
+  else if (gst_asm_node_is_bandwidth (node->right))
+    other = node->left;
+  else
+    return;
+
+  if (other == NULL)
+    return;
+  else if (other->type == GST_ASM_NODE_INTEGER)
+    value = other->data.intval;
+  else if (other->type == GST_ASM_NODE_FLOAT)
+    value = other->data.floatval;
+  else
+    return;
+
+  if (value <= 0.0)
+    return;
+
+  /* both sides of the threshold, for < and <= style comparisons */
+  c = (guint) value;
+  if (c < bandwidth)
+    *result = MAX (*result, c);
+  else if (c - 1 < bandwidth)
+    *result = MAX (*result, c - 1);
+}
+
+/* get the biggest value below @bandwidth at which the result of a
+ * comparison with $Bandwidth in @book can change, 0 if there is none */
+static guint
+gst_asm_rule_book_lower_bandwidth (GstASMRuleBook * book, guint bandwidth)
+{
+  GList *walk;
+  guint result = 0;
+
+  for (walk = book->rules; walk; walk = g_list_next (walk)) {
+    GstASMRule *rule = (GstASMRule *) walk->data;
+
+    gst_asm_node_lower_bandwidth (rule->root, bandwidth, &result);
+  }
+  return result;
+}
+
+/**
+ * gst_asm_rule_books_allocate:
+ * @books: the rule books of the streams, entries can be %NULL
+ * @n_books: the number of entries in @books
+ * @bandwidth: the available bandwidth in bits per second
+ * @stream_bandwidth: array of @n_books entries for the result
+ *
+ * Divide @bandwidth between the streams. All streams start with the
+ * complete @bandwidth. As long as the AverageBandwidth of all matched rules
+ * together is more than @bandwidth, the stream that uses the most is moved
+ * to its next lower rule.
+ *
+ * The result is the value of $Bandwidth to match the rule book of each
+ * stream with.
+ */
+void
+gst_asm_rule_books_allocate (GstASMRuleBook ** books, guint n_books,
+    guint bandwidth, guint * stream_bandwidth)
+{
+  guint *rates;
+  gboolean *pinned;
+  guint i;
+
+  rates = g_newa (guint, MAX (n_books, 1));
+  pinned = g_newa (gboolean, MAX (n_books, 1));
+
+  for (i = 0; i < n_books; i++) {
+    stream_bandwidth[i] = bandwidth;
+    pinned[i] = (books[i] == NULL);
+    rates[i] = pinned[i] ? 0 :
+        gst_asm_rule_book_get_bandwidth_at (books[i], bandwidth);
+  }
+
+  while (TRUE) {
+    guint64 total = 0;
+    gint k = -1;
+    guint bw, rate;
+
+    for (i = 0; i < n_books; i++) {
+      total += rates[i];
+      if (!pinned[i] && rates[i] > 0 && (k == -1 || rates[i] > rates[k]))
+        k = i;
+    }
+    if (total <= bandwidth || k == -1)
+      break;
+
+    /* step down to the next threshold until the stream uses less */
+    bw = stream_bandwidth[k];
+    do {
+      bw = gst_asm_rule_book_lower_bandwidth (books[k], bw);
+      rate = gst_asm_rule_book_get_bandwidth_at (books[k], bw);
+    } while (bw > 0 && rate >= rates[k]);
+
+    if (rate >= rates[k]) {
+      /* this is the lowest this stream can go */
+      pinned[k] = TRUE;
+      continue;
+    }
+    stream_bandwidth[k] = bw;
+    rates[k] = rate;
+  }
+}
+
 #ifdef TEST
 gint
 main (gint argc, gchar * argv[])
@@ -658,6 +978,9 @@ main (gint argc, gchar * argv[])
   gint rulematch[MAX_RULEMATCHES];
   GHashTable *vars;
   gint i, n;
+  static const gchar *bandwidths[] = { "10000", "15000", "20000", "30000",
+    "150000", "200000"
+  };
 
   static const gchar rules1[] =
       "#($Bandwidth < 67959),TimestampDelivery=T,DropByN=T,"
@@ -697,14 +1020,50 @@ main (gint argc, gchar * argv[])
 
   book = gst_asm_rule_book_new (rules3);
   n = gst_asm_rule_book_match (book, vars, rulematch);
-  gst_asm_rule_book_free (book);
-
 
   g_print ("%d rules matched\n", n);
   for (i = 0; i < n; i++) {
     g_print ("rule %d matched\n", rulematch[i]);
   }
 
+  /* matching again for the same bandwidths must give the cached result */
+  for (i = 0; i < 2 * G_N_ELEMENTS (bandwidths); i++) {
+    const gchar *bw = bandwidths[i % G_N_ELEMENTS (bandwidths)];
+    gint j;
+
+    g_hash_table_insert (vars, (gchar *) "Bandwidth", (gchar *) bw);
+    n = gst_asm_rule_book_match (book, vars, rulematch);
+
+    g_print ("bandwidth %s: %d rules matched:", bw, n);
+    for (j = 0; j < n; j++)
+      g_print (" %d", rulematch[j]);
+    g_print ("\n");
+  }
+  gst_asm_rule_book_free (book);
+
+  /* an audio and a video stream sharing a 300kbit link */
+  {
+    GstASMRuleBook *books[2];
+    guint stream_bw[2];
+
+    books[0] = gst_asm_rule_book_new (rules3);
+    books[1] = gst_asm_rule_book_new (rules1);
+    gst_asm_rule_books_allocate (books, 2, 300000, stream_bw);
+
+    for (i = 0; i < 2; i++) {
+      gint j;
+
+      n = gst_asm_rule_book_match_bandwidth (books[i], stream_bw[i],
+          rulematch);
+      g_print ("stream %d: bandwidth %u, %u used, rules", i, stream_bw[i],
+          gst_asm_rule_book_get_bandwidth (books[i], rulematch, n));
+      for (j = 0; j < n; j++)
+        g_print (" %d", rulematch[j]);
+      g_print ("\n");
+      gst_asm_rule_book_free (books[i]);
+    }
+  }
+
   g_hash_table_destroy (vars);
 
   return 0;
@@ -92,9 +92,32 @@ struct _GstASMNode {
   GstASMNode     *right;
 };
 
+typedef enum {
+  GST_ASM_INSTR_CONST,
+  GST_ASM_INSTR_VAR,
+  GST_ASM_INSTR_OPERATOR
+} GstASMInstrType;
+
+typedef struct _GstASMInstr GstASMInstr;
+
+/* one instruction of the stack machine a rule condition is compiled to.
+ * CONST pushes @value, VAR pushes the value of variable @slot of the book
+ * and OPERATOR replaces the two topmost values with @optype applied to them */
+struct _GstASMInstr {
+  GstASMInstrType type;
+  GstASMOp        optype;
+  guint           slot;
+  gfloat          value;
+};
+
 struct _GstASMRule {
   GstASMNode *root;
   GHashTable *props;
+
+  /* compiled condition */
+  GstASMInstr *code;
+  guint        n_code;
+  guint        stack_size;
 };
 
 struct _GstASMRuleBook {
@@ -102,6 +125,13 @@ struct _GstASMRuleBook {
 
   guint        n_rules;
   GList       *rules;
+
+  /* names of the variables used by the rules, indexed by slot */
+  GPtrArray   *vars;
+
+  /* variable values -> GstASMMatch */
+  GMutex       lock;
+  GHashTable  *cache;
 };
 
 G_END_DECLS
@@ -111,5 +141,12 @@ void              gst_asm_rule_book_free    (GstASMRuleBook *book);
 
 gint              gst_asm_rule_book_match   (GstASMRuleBook *book, GHashTable *vars, 
 		                             gint *rulematches);
+gint              gst_asm_rule_book_match_bandwidth (GstASMRuleBook *book, guint bandwidth,
+                                             gint *rulematches);
+guint             gst_asm_rule_book_get_bandwidth   (GstASMRuleBook *book,
+                                             const gint *rulematches, gint n);
+
+void              gst_asm_rule_books_allocate (GstASMRuleBook **books, guint n_books,
+                                             guint bandwidth, guint *stream_bandwidth);
 
 #endif /* __GST_ASM_RULES_H__ */
@@ -49,43 +49,32 @@ gst_rdt_buffer_get_packet_count (GstBuffer * buffer)
   return count;
 }
 
+/* figure out the type and length of the packet at @offset in @data */
 static gboolean
-read_packet_header (GstRDTPacket * packet)
+parse_packet_header (const guint8 * data, gsize size, guint offset,
+    GstRDTType * type, guint16 * length)
 {
-  GstMapInfo map;
-  guint8 *data;
-  gsize size;
-  guint offset;
-  guint length;
+  guint len;
   guint length_offset;
 
-  g_return_val_if_fail (packet != NULL, FALSE);
-  g_return_val_if_fail (GST_IS_BUFFER (packet->buffer), FALSE);
-
-  gst_buffer_map (packet->buffer, &map, GST_MAP_READ);
-  data = map.data;
-  size = map.size;
-
-  offset = packet->offset;
-
   /* check if we are at the end of the buffer, we add 3 because we also want to
    * ensure we can read the type, which is always at offset 1 and 2 bytes long. */
   if (offset + 3 > size)
-    goto packet_end;
+    return FALSE;
 
   /* read type */
-  packet->type = GST_READ_UINT16_BE (&data[offset + 1]);
+  *type = GST_READ_UINT16_BE (&data[offset + 1]);
 
-  length = -1;
+  len = -1;
   length_offset = -1;
 
   /* figure out the length of the packet, this depends on the type */
-  if (GST_RDT_IS_DATA_TYPE (packet->type)) {
+  if (GST_RDT_IS_DATA_TYPE (*type)) {
     if (data[offset] & 0x80)
       /* length is present */
       length_offset = 3;
   } else {
-    switch (packet->type) {
+    switch (*type) {
       case GST_RDT_TYPE_ASMACTION:
         if (data[offset] & 0x80)
           length_offset = 5;
@@ -99,25 +88,25 @@ read_packet_header (GstRDTPacket * packet)
           length_offset = 3;
         break;
       case GST_RDT_TYPE_RTTREQ:
-        length = 3;
+        len = 3;
         break;
       case GST_RDT_TYPE_RTTRESP:
-        length = 11;
+        len = 11;
         break;
       case GST_RDT_TYPE_CONGESTION:
-        length = 11;
+        len = 11;
         break;
       case GST_RDT_TYPE_STREAMEND:
-        length = 9;
+        len = 9;
         /* total_reliable */
         if (data[offset] & 0x80)
-          length += 2;
+          len += 2;
         /* stream_id_expansion */
         if ((data[offset] & 0x7c) == 0x7c)
-          length += 2;
+          len += 2;
         /* ext_flag, FIXME, get string length */
         if ((data[offset] & 0x1) == 0x1)
-          length += 7;
+          len += 7;
         break;
       case GST_RDT_TYPE_REPORT:
         if (data[offset] & 0x80)
@@ -128,24 +117,24 @@ read_packet_header (GstRDTPacket * packet)
           length_offset = 3;
         break;
       case GST_RDT_TYPE_INFOREQ:
-        length = 3;
+        len = 3;
         /* request_time_ms */
         if (data[offset] & 0x2)
-          length += 2;
+          len += 2;
         break;
       case GST_RDT_TYPE_INFORESP:
-        length = 3;
+        len = 3;
         /* has_rtt_info */
         if (data[offset] & 0x4) {
-          length += 4;
+          len += 4;
           /* is_delayed */
           if (data[offset] & 0x2) {
-            length += 4;
+            len += 4;
           }
         }
         if (data[offset] & 0x1) {
           /* buffer_info_count, FIXME read and skip */
-          length += 2;
+          len += 2;
         }
         break;
       case GST_RDT_TYPE_AUTOBW:
@@ -158,44 +147,56 @@ read_packet_header (GstRDTPacket * packet)
     }
   }
 
-  if (length != -1) {
+  if (len != -1) {
     /* we have a fixed length */
-    packet->length = length;
+    *length = len;
   } else if (length_offset != -1) {
     /* we can read the length from an offset */
-    packet->length = GST_READ_UINT16_BE (&data[length_offset]);
+    if (offset + length_offset + 2 > size)
+      goto invalid_length;
+    *length = GST_READ_UINT16_BE (&data[offset + length_offset]);
   } else {
     /* length is remainder of packet */
-    packet->length = size - offset;
+    *length = size - offset;
   }
-  gst_buffer_unmap (packet->buffer, &map);
 
   /* the length should be smaller than the remaining size */
-  if (packet->length + offset > size)
+  if (*length == 0 || *length + offset > size)
     goto invalid_length;
 
   return TRUE;
 
   /* ERRORS */
-packet_end:
-  {
-    gst_buffer_unmap (packet->buffer, &map);
-    return FALSE;
-  }
 unknown_packet:
   {
-    packet->type = GST_RDT_TYPE_INVALID;
-    gst_buffer_unmap (packet->buffer, &map);
+    *type = GST_RDT_TYPE_INVALID;
     return FALSE;
   }
 invalid_length:
   {
-    packet->type = GST_RDT_TYPE_INVALID;
-    packet->length = 0;
+    *type = GST_RDT_TYPE_INVALID;
+    *length = 0;
     return FALSE;
   }
 }
 
+static gboolean
+read_packet_header (GstRDTPacket * packet)
+{
+  GstMapInfo map;
+  gboolean res;
+
+  g_return_val_if_fail (packet != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_BUFFER (packet->buffer), FALSE);
+
+  gst_buffer_map (packet->buffer, &map, GST_MAP_READ);
+  res = parse_packet_header (map.data, map.size, packet->offset,
+      &packet->type, &packet->length);
+  gst_buffer_unmap (packet->buffer, &map);
+
+  return res;
+}
+
 gboolean
 gst_rdt_buffer_get_first_packet (GstBuffer * buffer, GstRDTPacket * packet)
 {
@@ -475,3 +476,193 @@ gst_rdt_packet_data_get_flags (GstRDTPacket * packet)
 
   return result;
 }
+
+/* decode all the fields of the data packet header in @info */
+static gboolean
+parse_data_header (const guint8 * data, GstRDTPacketInfo * info)
+{
+  const guint8 *packet;
+  gboolean length_included_flag;
+  gboolean need_reliable_flag;
+  guint header;
+
+  packet = data + info->offset;
+
+  length_included_flag = (packet[0] & 0x80) == 0x80;
+  need_reliable_flag = (packet[0] & 0x40) == 0x40;
+  info->stream_id = (packet[0] & 0x3e) >> 1;
+
+  /* the minimal header: header bits, seq_no, flags and timestamp */
+  header = 8;
+  if (length_included_flag)
+    header += 2;
+  if (info->length < header)
+    goto too_short;
+
+  /* seq_no */
+  info->seqnum = GST_READ_UINT16_BE (&packet[1]);
+
+  /* skip seq_no and header bits */
+  header = 3;
+  if (length_included_flag) {
+    /* skip length */
+    header += 2;
+  }
+  info->flags = packet[header];
+  info->asm_rule = packet[header] & 0x3f;
+  info->timestamp = GST_READ_UINT32_BE (&packet[header + 1]);
+
+  /* skip timestamp and asm_rule_number */
+  header += 5;
+
+  if (info->stream_id == 31) {
+    if (info->length < header + 2)
+      goto too_short;
+    /* stream_id_expansion */
+    info->stream_id = GST_READ_UINT16_BE (&packet[header]);
+    header += 2;
+  }
+  if (need_reliable_flag) {
+    /* skip total_reliable */
+    header += 2;
+  }
+  if (info->asm_rule == 63) {
+    if (info->length < header + 2)
+      goto too_short;
+    /* asm_rule_number_expansion */
+    info->asm_rule = GST_READ_UINT16_BE (&packet[header]);
+    header += 2;
+  }
+  if (info->length < header)
+    goto too_short;
+
+  info->payload_offset = info->offset + header;
+  info->payload_size = info->length - header;
+  info->payload = data + info->payload_offset;
+
+  return TRUE;
+
+  /* ERRORS */
+too_short:
+  {
+    return FALSE;
+  }
+}
+
+/**
+ * gst_rdt_packet_iter_init:
+ * @iter: a #GstRDTPacketIter
+ * @buffer: a buffer with RDT packets
+ *
+ * Map @buffer and prepare @iter to walk its packets with
+ * gst_rdt_packet_iter_next(). The buffer stays mapped until
+ * gst_rdt_packet_iter_clear() is called.
+ *
+ * Returns: %TRUE when @buffer could be mapped.
+ */
+gboolean
+gst_rdt_packet_iter_init (GstRDTPacketIter * iter, GstBuffer * buffer)
+{
+  g_return_val_if_fail (iter != NULL, FALSE);
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), FALSE);
+
+  iter->buffer = buffer;
+  iter->offset = 0;
+
+  if (!gst_buffer_map (buffer, &iter->map, GST_MAP_READ)) {
+    iter->buffer = NULL;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * gst_rdt_packet_iter_next:
+ * @iter: a #GstRDTPacketIter
+ * @info: a #GstRDTPacketInfo to fill
+ *
+ * Decode the header of the next packet in one go. For data packets all
+ * header fields and the location of the payload are filled in, for other
+ * packets only the type, offset and length are valid.
+ *
+ * Returns: %FALSE when there are no more valid packets.
+ */
+gboolean
+gst_rdt_packet_iter_next (GstRDTPacketIter * iter, GstRDTPacketInfo * info)
+{
+  g_return_val_if_fail (iter != NULL, FALSE);
+  g_return_val_if_fail (info != NULL, FALSE);
+
+  if (iter->buffer == NULL)
+    return FALSE;
+
+  memset (info, 0, sizeof (GstRDTPacketInfo));
+  info->offset = iter->offset;
+
+  if (!parse_packet_header (iter->map.data, iter->map.size, iter->offset,
+          &info->type, &info->length))
+    goto end;
+
+  if (GST_RDT_IS_DATA_TYPE (info->type) &&
+      !parse_data_header (iter->map.data, info))
+    goto end;
+
+  iter->offset += info->length;
+
+  return TRUE;
+
+  /* ERRORS */
+end:
+  {
+    /* an invalid packet must be the last */
+    info->type = GST_RDT_TYPE_INVALID;
+    iter->offset = iter->map.size;
+    return FALSE;
+  }
+}
+
+/**
+ * gst_rdt_packet_iter_clear:
+ * @iter: a #GstRDTPacketIter
+ *
+ * Unmap the buffer of @iter. The payload pointers of the packets returned
+ * by @iter are invalid after this.
+ */
+void
+gst_rdt_packet_iter_clear (GstRDTPacketIter * iter)
+{
+  g_return_if_fail (iter != NULL);
+
+  if (iter->buffer) {
+    gst_buffer_unmap (iter->buffer, &iter->map);
+    iter->buffer = NULL;
+  }
+}
+
+/**
+ * gst_rdt_packet_info_to_buffer:
+ * @iter: a #GstRDTPacketIter
+ * @info: a packet returned by @iter
+ *
+ * Make a buffer of the packet described by @info. The memory of the
+ * buffer of @iter is shared, not copied.
+ *
+ * Returns: a new #GstBuffer
+ */
+GstBuffer *
+gst_rdt_packet_info_to_buffer (GstRDTPacketIter * iter,
+    const GstRDTPacketInfo * info)
+{
+  GstBuffer *result;
+
+  g_return_val_if_fail (iter != NULL, NULL);
+  g_return_val_if_fail (iter->buffer != NULL, NULL);
+  g_return_val_if_fail (info != NULL, NULL);
+
+  result = gst_buffer_copy_region (iter->buffer, GST_BUFFER_COPY_ALL,
+      info->offset, info->length);
+  /* timestamp applies to all packets in this buffer */
+  GST_BUFFER_TIMESTAMP (result) = GST_BUFFER_TIMESTAMP (iter->buffer);
+
+  return result;
+}
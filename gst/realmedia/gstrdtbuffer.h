@@ -89,6 +89,58 @@ struct _GstRDTPacket
   GstMapInfo   map;          /* last mapped data */
 };
 
+typedef struct _GstRDTPacketInfo GstRDTPacketInfo;
+
+/**
+ * GstRDTPacketInfo:
+ * @type: the packet type
+ * @offset: offset of the packet in the buffer
+ * @length: length of the packet in bytes
+ * @seqnum: the seq_no of a data packet
+ * @stream_id: the stream id of a data packet, expansion included
+ * @timestamp: the timestamp of a data packet
+ * @flags: the flags byte of a data packet
+ * @asm_rule: the ASM rule number of a data packet, expansion included
+ * @payload_offset: offset of the payload of a data packet in the buffer
+ * @payload_size: size of the payload of a data packet
+ * @payload: the payload of a data packet in the mapped buffer
+ *
+ * All header fields of a packet, decoded once by gst_rdt_packet_iter_next().
+ */
+struct _GstRDTPacketInfo
+{
+  GstRDTType    type;
+  guint         offset;
+  guint16       length;
+
+  /* data packets */
+  guint16       seqnum;
+  guint16       stream_id;
+  guint32       timestamp;
+  guint8        flags;
+  guint16       asm_rule;
+  guint         payload_offset;
+  guint         payload_size;
+  const guint8 *payload;
+};
+
+typedef struct _GstRDTPacketIter GstRDTPacketIter;
+
+/**
+ * GstRDTPacketIter:
+ * @buffer: the RDT buffer
+ * @map: the mapping of @buffer
+ * @offset: offset of the next packet
+ *
+ * Walks all packets in a buffer with a single mapping.
+ */
+struct _GstRDTPacketIter
+{
+  GstBuffer   *buffer;
+  GstMapInfo   map;
+  guint        offset;
+};
+
 /* validate buffers */
 gboolean        gst_rdt_buffer_validate_data      (guint8 *data, guint len);
 gboolean        gst_rdt_buffer_validate           (GstBuffer *buffer);
@@ -113,6 +165,12 @@ guint32         gst_rdt_packet_data_get_timestamp (GstRDTPacket *packet);
 
 guint8          gst_rdt_packet_data_get_flags     (GstRDTPacket * packet);
 
+/* iterating packets with a single mapping */
+gboolean        gst_rdt_packet_iter_init          (GstRDTPacketIter *iter, GstBuffer *buffer);
+gboolean        gst_rdt_packet_iter_next          (GstRDTPacketIter *iter, GstRDTPacketInfo *info);
+void            gst_rdt_packet_iter_clear         (GstRDTPacketIter *iter);
+GstBuffer*      gst_rdt_packet_info_to_buffer     (GstRDTPacketIter *iter, const GstRDTPacketInfo *info);
+
 /* utils */
 gint            gst_rdt_buffer_compare_seqnum     (guint16 seqnum1, guint16 seqnum2);
 
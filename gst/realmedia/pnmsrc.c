@@ -36,13 +36,31 @@ enum
 };
 
 #define DEFAULT_LOCATION	NULL
+#define DEFAULT_CACHE_TTL	300
 
 enum
 {
   PROP_0,
-  PROP_LOCATION
+  PROP_LOCATION,
+  PROP_CACHE_TTL
 };
 
+/* the cache is cleared when it gets bigger than this */
+#define MAX_CACHE_ENTRIES	256
+/* number of cached redirects followed for one lookup */
+#define MAX_REDIRECTS		8
+
+/* what we learned about an RTSP url */
+typedef struct
+{
+  gchar *target;                /* url it redirects to, or NULL */
+  gint is_real;                 /* RealServer or not, -1 when unknown */
+  gint64 time;                  /* monotonic time of the last update */
+} GstPNMCacheEntry;
+
+static GMutex cache_lock;
+static GHashTable *cache;
+
 static GstStaticPadTemplate gst_pnm_src_template =
 GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SRC,
@@ -66,6 +84,104 @@ static void gst_pnm_src_set_property (GObject * object, guint prop_id,
 static void gst_pnm_src_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
 
+static void
+gst_pnm_cache_entry_free (GstPNMCacheEntry * entry)
+{
+  g_free (entry->target);
+  g_slice_free (GstPNMCacheEntry, entry);
+}
+
+/**
+ * gst_pnm_src_cache_update:
+ * @uri: an RTSP url
+ * @target: (allow-none): the url @uri redirects to
+ * @is_real: whether @uri is served by a RealServer, -1 when unknown
+ *
+ * Store what was learned about @uri while setting up an RTSP session so
+ * that following redirects of pnm:// urls can go to the final target
+ * directly.
+ */
+void
+gst_pnm_src_cache_update (const gchar * uri, const gchar * target,
+    gint is_real)
+{
+  GstPNMCacheEntry *entry;
+
+  g_return_if_fail (uri != NULL);
+
+  g_mutex_lock (&cache_lock);
+  if (cache == NULL)
+    cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify) gst_pnm_cache_entry_free);
+
+  entry = g_hash_table_lookup (cache, uri);
+  if (entry == NULL) {
+    if (g_hash_table_size (cache) >= MAX_CACHE_ENTRIES)
+      g_hash_table_remove_all (cache);
+
+    entry = g_slice_new0 (GstPNMCacheEntry);
+    entry->is_real = -1;
+    g_hash_table_insert (cache, g_strdup (uri), entry);
+  }
+  if (target && g_strcmp0 (target, entry->target)) {
+    g_free (entry->target);
+    entry->target = g_strdup (target);
+    /* a different server, what we knew about it is no longer valid */
+    entry->is_real = -1;
+  }
+  if (is_real != -1)
+    entry->is_real = is_real;
+  entry->time = g_get_monotonic_time ();
+  g_mutex_unlock (&cache_lock);
+}
+
+/* follow the cached redirects of @uri. Returns the final url or NULL when
+ * nothing that is younger than @ttl (in microseconds) is known about @uri */
+static gchar *
+gst_pnm_src_cache_lookup (const gchar * uri, gint64 ttl, gint * is_real)
+{
+  GstPNMCacheEntry *entry;
+  const gchar *result = NULL;
+  gchar *ret;
+  gint64 now;
+  guint i;
+
+  *is_real = -1;
+
+  g_mutex_lock (&cache_lock);
+  if (cache == NULL)
+    goto done;
+
+  now = g_get_monotonic_time ();
+  for (i = 0; i < MAX_REDIRECTS; i++) {
+    entry = g_hash_table_lookup (cache, uri);
+    if (entry == NULL)
+      break;
+
+    if (now - entry->time > ttl) {
+      g_hash_table_remove (cache, uri);
+      break;
+    }
+
+    result = uri;
+    *is_real = entry->is_real;
+
+    if (entry->target == NULL)
+      break;
+
+    uri = entry->target;
+    /* the target might not be in the cache itself */
+    result = uri;
+    *is_real = -1;
+  }
+
+done:
+  ret = g_strdup (result);
+  g_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
 static void
 gst_pnm_src_class_init (GstPNMSrcClass * klass)
 {
@@ -89,6 +205,20 @@ gst_pnm_src_class_init (GstPNMSrcClass * klass)
           "Location of the PNM url to read",
           DEFAULT_LOCATION, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstPNMSrc:cache-ttl:
+   *
+   * Seconds for which RTSP redirects and RealServer probe results, shared
+   * by all elements in the process, are used for the redirect of a pnm url.
+   * The redirect message then points to the final target and has a
+   * "real-server" field when the probe result is known. 0 disables the
+   * cache.
+   */
+  g_object_class_install_property (gobject_class, PROP_CACHE_TTL,
+      g_param_spec_uint ("cache-ttl", "Cache TTL",
+          "Seconds for which cached redirect targets are used (0 = disabled)",
+          0, G_MAXUINT, DEFAULT_CACHE_TTL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_add_static_pad_template (gstelement_class,
       &gst_pnm_src_template);
@@ -108,6 +238,7 @@ static void
 gst_pnm_src_init (GstPNMSrc * pnmsrc)
 {
   pnmsrc->location = g_strdup (DEFAULT_LOCATION);
+  pnmsrc->cache_ttl = DEFAULT_CACHE_TTL;
 }
 
 gboolean
@@ -142,6 +273,11 @@ gst_pnm_src_set_property (GObject * object, guint prop_id,
       g_free (src->location);
       src->location = g_value_dup_string (value);
       break;
+    case PROP_CACHE_TTL:
+      GST_OBJECT_LOCK (src);
+      src->cache_ttl = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -160,6 +296,11 @@ gst_pnm_src_get_property (GObject * object, guint prop_id,
     case PROP_LOCATION:
       g_value_set_string (value, src->location);
       break;
+    case PROP_CACHE_TTL:
+      GST_OBJECT_LOCK (src);
+      g_value_set_uint (value, src->cache_ttl);
+      GST_OBJECT_UNLOCK (src);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -171,7 +312,10 @@ gst_pnm_src_create (GstPushSrc * psrc, GstBuffer ** buf)
 {
   GstPNMSrc *src;
   GstMessage *m;
-  gchar *url;
+  GstStructure *s;
+  gchar *url, *target;
+  gint is_real = -1;
+  guint ttl;
 
   src = GST_PNM_SRC (psrc);
 
@@ -179,9 +323,24 @@ gst_pnm_src_create (GstPushSrc * psrc, GstBuffer ** buf)
     return GST_FLOW_ERROR;
   url = g_strdup_printf ("rtsp%s", &src->location[3]);
 
+  GST_OBJECT_LOCK (src);
+  ttl = src->cache_ttl;
+  GST_OBJECT_UNLOCK (src);
+
+  /* skip the redirects the RTSP server made us follow last time */
+  if (ttl > 0 && (target = gst_pnm_src_cache_lookup (url,
+              ttl * G_TIME_SPAN_SECOND, &is_real))) {
+    GST_DEBUG_OBJECT (src, "cached target for %s: %s, real %d", url, target,
+        is_real);
+    g_free (url);
+    url = target;
+  }
+
   /* the only thing we do is redirect to an RTSP url */
-  m = gst_message_new_element (GST_OBJECT_CAST (src),
-      gst_structure_new ("redirect", "new-location", G_TYPE_STRING, url, NULL));
+  s = gst_structure_new ("redirect", "new-location", G_TYPE_STRING, url, NULL);
+  if (is_real != -1)
+    gst_structure_set (s, "real-server", G_TYPE_BOOLEAN, is_real, NULL);
+  m = gst_message_new_element (GST_OBJECT_CAST (src), s);
   g_free (url);
 
   gst_element_post_message (GST_ELEMENT_CAST (src), m);
@@ -44,6 +44,7 @@ struct _GstPNMSrc
   GstPushSrc parent;
 
   gchar *location;
+  guint cache_ttl;
 };
 
 struct _GstPNMSrcClass
@@ -54,6 +55,9 @@ struct _GstPNMSrcClass
 GType gst_pnm_src_get_type (void);
 gboolean gst_pnm_src_plugin_init (GstPlugin * plugin);
 
+void gst_pnm_src_cache_update (const gchar * uri, const gchar * target,
+    gint is_real);
+
 G_END_DECLS
 
 #endif /* __GST_PNM_SRC_H__ */
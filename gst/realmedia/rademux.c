@@ -56,12 +56,24 @@ static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
     GST_PAD_SOMETIMES,
     GST_STATIC_CAPS_ANY);
 
+#define DEFAULT_FRAMES_PER_PUSH 1
+
+enum
+{
+  PROP_0,
+  PROP_FRAMES_PER_PUSH
+};
+
 GST_DEBUG_CATEGORY_STATIC (real_audio_demux_debug);
 #define GST_CAT_DEFAULT real_audio_demux_debug
 
 #define gst_real_audio_demux_parent_class parent_class
 G_DEFINE_TYPE (GstRealAudioDemux, gst_real_audio_demux, GST_TYPE_ELEMENT);
 
+static void gst_real_audio_demux_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_real_audio_demux_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
 static GstStateChangeReturn gst_real_audio_demux_change_state (GstElement * e,
     GstStateChange transition);
 static GstFlowReturn gst_real_audio_demux_chain (GstPad * pad,
@@ -95,6 +107,14 @@ gst_real_audio_demux_class_init (GstRealAudioDemuxClass * klass)
   GstElementClass *gstelement_class = (GstElementClass *) klass;
 
   gobject_class->finalize = gst_real_audio_demux_finalize;
+  gobject_class->set_property = gst_real_audio_demux_set_property;
+  gobject_class->get_property = gst_real_audio_demux_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_FRAMES_PER_PUSH,
+      g_param_spec_uint ("frames-per-push", "Frames per push",
+          "Number of frames to push downstream at once in a buffer list "
+          "(1 = push every frame separately)", 1, G_MAXUINT,
+          DEFAULT_FRAMES_PER_PUSH, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gst_element_class_add_static_pad_template (gstelement_class, &sink_template);
   gst_element_class_add_static_pad_template (gstelement_class, &src_template);
@@ -130,6 +150,8 @@ gst_real_audio_demux_reset (GstRealAudioDemux * demux)
   demux->state = REAL_AUDIO_DEMUX_STATE_MARKER;
   demux->ra_version = 0;
   demux->data_offset = 0;
+  demux->data_size = 0;
+  demux->data_end = 0;
   demux->packet_size = 0;
 
   demux->sample_rate = 0;
@@ -143,11 +165,13 @@ gst_real_audio_demux_reset (GstRealAudioDemux * demux)
 
   demux->byterate_num = 0;
   demux->byterate_denom = 0;
+  demux->bytes_per_minute = 0;
 
   demux->duration = 0;
   demux->upstream_size = 0;
 
   demux->offset = 0;
+  demux->discont = FALSE;
 
   demux->have_group_id = FALSE;
   demux->group_id = G_MAXUINT;
@@ -172,9 +196,42 @@ gst_real_audio_demux_init (GstRealAudioDemux * demux)
   gst_element_add_pad (GST_ELEMENT (demux), demux->sinkpad);
 
   demux->adapter = gst_adapter_new ();
+  demux->frames_per_push = DEFAULT_FRAMES_PER_PUSH;
   gst_real_audio_demux_reset (demux);
 }
 
+static void
+gst_real_audio_demux_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstRealAudioDemux *demux = GST_REAL_AUDIO_DEMUX (object);
+
+  switch (prop_id) {
+    case PROP_FRAMES_PER_PUSH:
+      demux->frames_per_push = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_real_audio_demux_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstRealAudioDemux *demux = GST_REAL_AUDIO_DEMUX (object);
+
+  switch (prop_id) {
+    case PROP_FRAMES_PER_PUSH:
+      g_value_set_uint (value, demux->frames_per_push);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static gboolean
 gst_real_audio_demux_sink_activate (GstPad * sinkpad, GstObject * parent)
 {
@@ -291,6 +348,43 @@ gst_real_demux_get_timestamp_from_offset (GstRealAudioDemux * demux,
   }
 }
 
+/* Interleaved codecs can only be decoded starting from the first packet of
+ * a block of height packets, so that's what we seek to */
+static guint
+gst_real_audio_demux_get_block_size (GstRealAudioDemux * demux)
+{
+  return MAX (demux->packet_size, 1) * MAX (demux->height, 1);
+}
+
+/* Returns the offset of the block containing @ts. .ra data carries no
+ * timestamps, so this follows from the byte rate */
+static guint64
+gst_real_audio_demux_get_offset_from_timestamp (GstRealAudioDemux * demux,
+    GstClockTime ts)
+{
+  guint64 offset, block_size;
+
+  block_size = gst_real_audio_demux_get_block_size (demux);
+
+  offset = gst_util_uint64_scale (ts, demux->byterate_num,
+      demux->byterate_denom * GST_SECOND);
+  offset = demux->data_offset + offset - (offset % block_size);
+
+  /* stay within the data, at the last complete block */
+  if (demux->data_end > 0 && offset + block_size > demux->data_end) {
+    guint64 n_blocks = 0;
+
+    if (demux->data_end > demux->data_offset)
+      n_blocks = (demux->data_end - demux->data_offset) / block_size;
+    offset = demux->data_offset + MAX (n_blocks, 1) * block_size - block_size;
+  }
+
+  GST_DEBUG_OBJECT (demux, "ts %" GST_TIME_FORMAT " -> offset %"
+      G_GUINT64_FORMAT, GST_TIME_ARGS (ts), offset);
+
+  return offset;
+}
+
 static gboolean
 gst_real_audio_demux_get_data_offset_from_header (GstRealAudioDemux * demux)
 {
@@ -355,6 +449,8 @@ gst_real_audio_demux_parse_header (GstRealAudioDemux * demux)
       demux->height = 0;
       break;
     case 4:
+      demux->data_size = GST_READ_UINT32_BE (data + 6);
+      demux->bytes_per_minute = GST_READ_UINT32_BE (data + 26);
       demux->flavour = GST_READ_UINT16_BE (data + 16);
       /* demux->frame_size = GST_READ_UINT32_BE (data + 36); */
       demux->leaf_size = GST_READ_UINT16_BE (data + 38);
@@ -475,6 +571,13 @@ gst_real_audio_demux_parse_header (GstRealAudioDemux * demux)
 
   gst_element_add_pad (GST_ELEMENT (demux), demux->srcpad);
 
+  /* for codecs where we can't derive it ourselves, use the header's */
+  if ((demux->byterate_num == 0 || demux->byterate_denom == 0) &&
+      demux->bytes_per_minute > 0) {
+    demux->byterate_num = demux->bytes_per_minute;
+    demux->byterate_denom = 60;
+  }
+
   if (demux->byterate_num > 0 && demux->byterate_denom > 0) {
     GstFormat bformat = GST_FORMAT_BYTES;
     gint64 size_bytes = 0;
@@ -484,11 +587,20 @@ gst_real_audio_demux_parse_header (GstRealAudioDemux * demux)
         demux->byterate_num / demux->byterate_denom);
 
     if (gst_pad_peer_query_duration (demux->sinkpad, bformat, &size_bytes)) {
-      demux->duration =
-          gst_real_demux_get_timestamp_from_offset (demux, size_bytes);
       demux->upstream_size = size_bytes;
+      demux->data_end = size_bytes;
+
+      /* anything after the data (e.g. trailing metadata) isn't audio */
+      if (demux->data_size > 0 &&
+          demux->data_offset + (guint64) demux->data_size < demux->data_end)
+        demux->data_end = demux->data_offset + (guint64) demux->data_size;
+
+      demux->duration =
+          gst_real_demux_get_timestamp_from_offset (demux, demux->data_end);
       GST_INFO_OBJECT (demux, "upstream_size = %" G_GUINT64_FORMAT,
           demux->upstream_size);
+      GST_INFO_OBJECT (demux, "data_end      = %" G_GUINT64_FORMAT,
+          demux->data_end);
       GST_INFO_OBJECT (demux, "duration      = %" GST_TIME_FORMAT,
           GST_TIME_ARGS (demux->duration));
     }
@@ -535,7 +647,9 @@ static GstFlowReturn
 gst_real_audio_demux_parse_data (GstRealAudioDemux * demux)
 {
   GstFlowReturn ret = GST_FLOW_OK;
-  guint avail, unit_size;
+  GstBufferList *list = NULL;
+  GstClockTime start_ts;
+  guint avail, unit_size, consumed = 0;
 
   avail = gst_adapter_available (demux->adapter);
 
@@ -546,6 +660,8 @@ gst_real_audio_demux_parse_data (GstRealAudioDemux * demux)
 
   GST_LOG_OBJECT (demux, "available = %u, unit_size = %u", avail, unit_size);
 
+  start_ts = gst_real_demux_get_timestamp_from_offset (demux, demux->offset);
+
   while (ret == GST_FLOW_OK && unit_size > 0 && avail >= unit_size) {
     GstClockTime ts;
     GstBuffer *buf;
@@ -569,14 +685,41 @@ gst_real_audio_demux_parse_data (GstRealAudioDemux * demux)
       buf = gst_rm_utils_descramble_dnet_buffer (buf);
     }
 
-    ts = gst_real_demux_get_timestamp_from_offset (demux, demux->offset);
+    /* we may be handling several frames pulled at once */
+    if (GST_CLOCK_TIME_IS_VALID (start_ts))
+      ts = gst_real_demux_get_timestamp_from_offset (demux,
+          demux->offset + consumed);
+    else
+      ts = GST_CLOCK_TIME_NONE;
+    consumed += unit_size;
+
     GST_BUFFER_TIMESTAMP (buf) = ts;
 
+    if (demux->discont) {
+      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+      demux->discont = FALSE;
+    }
+
     demux->segment.position = ts;
 
-    ret = gst_pad_push (demux->srcpad, buf);
+    if (demux->frames_per_push > 1) {
+      if (list == NULL)
+        list = gst_buffer_list_new_sized (demux->frames_per_push);
+      gst_buffer_list_add (list, buf);
+      if (gst_buffer_list_length (list) < demux->frames_per_push)
+        continue;
+
+      ret = gst_pad_push_list (demux->srcpad, list);
+      list = NULL;
+    } else {
+      ret = gst_pad_push (demux->srcpad, buf);
+    }
   }
 
+  /* push what we have of an incomplete batch */
+  if (list != NULL)
+    ret = gst_pad_push_list (demux->srcpad, list);
+
   return ret;
 }
 
@@ -616,10 +759,20 @@ static GstFlowReturn
 gst_real_audio_demux_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
 {
   GstRealAudioDemux *demux;
+  GstFlowReturn ret;
+  guint avail;
 
   demux = GST_REAL_AUDIO_DEMUX (parent);
 
-  return gst_real_audio_demux_handle_buffer (demux, buf);
+  avail = gst_adapter_available (demux->adapter) + gst_buffer_get_size (buf);
+
+  ret = gst_real_audio_demux_handle_buffer (demux, buf);
+
+  /* keep the offset at the start of what's left in the adapter, like the
+   * loop function does, the timestamps are derived from it */
+  demux->offset += avail - gst_adapter_available (demux->adapter);
+
+  return ret;
 }
 
 static void
@@ -628,6 +781,7 @@ gst_real_audio_demux_loop (GstRealAudioDemux * demux)
   GstFlowReturn ret;
   GstBuffer *buf;
   guint bytes_needed;
+  gboolean reverse = FALSE;
 
   /* check how much data we need */
   switch (demux->state) {
@@ -640,9 +794,21 @@ gst_real_audio_demux_loop (GstRealAudioDemux * demux)
       bytes_needed = demux->data_offset - (6 + 16);
       break;
     case REAL_AUDIO_DEMUX_STATE_DATA:
-      if (demux->packet_size > 0) {
+      if (demux->packet_size > 0 && demux->segment.rate < 0.0) {
+        /* reverse playback goes back one decodable block at a time */
+        bytes_needed = gst_real_audio_demux_get_block_size (demux);
+        reverse = TRUE;
+      } else if (demux->packet_size > 0) {
         /* TODO: should probably take into account width/height as well? */
-        bytes_needed = demux->packet_size;
+        bytes_needed = demux->packet_size * demux->frames_per_push;
+
+        /* don't lose the last frames to a short read at the end */
+        if (demux->frames_per_push > 1 && demux->data_end > 0 &&
+            demux->offset + bytes_needed > demux->data_end) {
+          bytes_needed = (demux->data_end - MIN (demux->offset,
+                  demux->data_end)) / demux->packet_size;
+          bytes_needed = MAX (bytes_needed, 1) * demux->packet_size;
+        }
       } else {
         bytes_needed = 1024;
       }
@@ -655,7 +821,7 @@ gst_real_audio_demux_loop (GstRealAudioDemux * demux)
   GST_LOG_OBJECT (demux, "getting data: %5u bytes @ %8" G_GINT64_MODIFIER "u",
       bytes_needed, demux->offset);
 
-  if (demux->upstream_size > 0 && demux->offset >= demux->upstream_size)
+  if (demux->data_end > 0 && demux->offset >= demux->data_end)
     goto eos;
 
   buf = NULL;
@@ -671,7 +837,21 @@ gst_real_audio_demux_loop (GstRealAudioDemux * demux)
   if (ret != GST_FLOW_OK)
     goto handle_flow_error;
 
-  /* TODO: increase this in chain function too (for timestamps)? */
+  if (reverse) {
+    GstClockTime ts;
+
+    /* we pushed the block at offset, continue with the one before it */
+    ts = gst_real_demux_get_timestamp_from_offset (demux, demux->offset);
+    if (demux->offset <= demux->data_offset || (ts != GST_CLOCK_TIME_NONE &&
+            ts <= demux->segment.start)) {
+      GST_DEBUG_OBJECT (demux, "reached start of segment");
+      goto eos;
+    }
+    demux->offset -= MIN (bytes_needed, demux->offset - demux->data_offset);
+    demux->discont = TRUE;
+    return;
+  }
+
   demux->offset += bytes_needed;
 
   /* check for the end of the segment */
@@ -718,8 +898,11 @@ eos:
       gint64 stop;
 
       /* for segment playback we need to post when (in stream time)
-       * we stopped, this is either stop (when set) or the duration. */
-      if ((stop = demux->segment.stop) == -1)
+       * we stopped, this is either stop (when set) or the duration, or
+       * the start when playing backwards. */
+      if (demux->segment.rate < 0.0)
+        stop = demux->segment.start;
+      else if ((stop = demux->segment.stop) == -1)
         stop = demux->segment.duration;
 
       GST_DEBUG_OBJECT (demux, "sending segment done, at end of segment");
@@ -791,8 +974,12 @@ gst_real_audio_demux_handle_seek (GstRealAudioDemux * demux, GstEvent * event)
   if (format != GST_FORMAT_TIME)
     goto only_time_format_supported;
 
-  if (rate <= 0.0)
-    goto cannot_do_backwards_playback;
+  if (rate == 0.0)
+    goto invalid_rate;
+
+  /* going back needs blocks of a known size */
+  if (rate < 0.0 && demux->packet_size == 0)
+    goto no_reverse;
 
   flush = ((flags & GST_SEEK_FLAG_FLUSH) != 0);
 
@@ -813,12 +1000,18 @@ gst_real_audio_demux_handle_seek (GstRealAudioDemux * demux, GstEvent * event)
 
   GST_DEBUG_OBJECT (demux, "segment: %" GST_SEGMENT_FORMAT, &demux->segment);
 
-  seek_pos = gst_util_uint64_scale (demux->segment.start,
-      demux->byterate_num, demux->byterate_denom * GST_SECOND);
-  if (demux->packet_size > 0) {
-    seek_pos -= seek_pos % demux->packet_size;
+  if (demux->segment.rate < 0.0) {
+    GstClockTime end = demux->segment.stop;
+
+    if (!GST_CLOCK_TIME_IS_VALID (end))
+      end = demux->duration;
+    if (end > 0)
+      end--;
+    seek_pos = gst_real_audio_demux_get_offset_from_timestamp (demux, end);
+  } else {
+    seek_pos = gst_real_audio_demux_get_offset_from_timestamp (demux,
+        demux->segment.start);
   }
-  seek_pos += demux->data_offset;
 
   GST_DEBUG_OBJECT (demux, "seek_pos = %" G_GUINT64_FORMAT, seek_pos);
 
@@ -828,6 +1021,7 @@ gst_real_audio_demux_handle_seek (GstRealAudioDemux * demux, GstEvent * event)
 
   demux->offset = seek_pos;
   demux->need_newsegment = TRUE;
+  demux->discont = TRUE;
 
   /* notify start of new segment */
   if (demux->segment.flags & GST_SEEK_FLAG_SEGMENT) {
@@ -862,9 +1056,14 @@ only_time_format_supported:
     GST_DEBUG_OBJECT (demux, "can only seek in TIME format");
     return FALSE;
   }
-cannot_do_backwards_playback:
+invalid_rate:
+  {
+    GST_DEBUG_OBJECT (demux, "can't seek with rate 0");
+    return FALSE;
+  }
+no_reverse:
   {
-    GST_DEBUG_OBJECT (demux, "can only seek with positive rate, not %lf", rate);
+    GST_DEBUG_OBJECT (demux, "can't play backwards without a packet size");
     return FALSE;
   }
 }
@@ -60,6 +60,8 @@ struct _GstRealAudioDemux {
 
   guint                    ra_version;
   guint                    data_offset;
+  guint                    data_size;       /* from the header, 0 = unknown */
+  guint64                  data_end;        /* end of the audio data */
 
   guint                    packet_size;
   guint                    leaf_size;
@@ -78,6 +80,7 @@ struct _GstRealAudioDemux {
 
   guint                    byterate_num;    /* bytes per second */
   guint                    byterate_denom;
+  guint                    bytes_per_minute;
 
   gint64                   duration;
   gint64                   upstream_size;
@@ -89,6 +92,11 @@ struct _GstRealAudioDemux {
   GstSegment               segment;
 
   gboolean                 seekable;
+
+  /* number of frames per pushed buffer list */
+  guint                    frames_per_push;
+
+  gboolean                 discont;
 };
 
 struct _GstRealAudioDemuxClass {
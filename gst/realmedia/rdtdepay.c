@@ -37,9 +37,12 @@ enum
   LAST_SIGNAL
 };
 
+#define DEFAULT_BUFFER_LIST FALSE
+
 enum
 {
   PROP_0,
+  PROP_BUFFER_LIST
 };
 
 static GstStaticPadTemplate gst_rdt_depay_src_template =
@@ -68,6 +71,10 @@ GST_STATIC_PAD_TEMPLATE ("sink",
 G_DEFINE_TYPE (GstRDTDepay, gst_rdt_depay, GST_TYPE_ELEMENT);
 
 static void gst_rdt_depay_finalize (GObject * object);
+static void gst_rdt_depay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_rdt_depay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 
 static GstStateChangeReturn gst_rdt_depay_change_state (GstElement *
     element, GstStateChange transition);
@@ -89,6 +96,13 @@ gst_rdt_depay_class_init (GstRDTDepayClass * klass)
   parent_class = g_type_class_peek_parent (klass);
 
   gobject_class->finalize = gst_rdt_depay_finalize;
+  gobject_class->set_property = gst_rdt_depay_set_property;
+  gobject_class->get_property = gst_rdt_depay_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_BUFFER_LIST,
+      g_param_spec_boolean ("buffer-list", "Buffer List",
+          "Push all RealMedia packets of an RDT buffer in one buffer list",
+          DEFAULT_BUFFER_LIST, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   gstelement_class->change_state = gst_rdt_depay_change_state;
 
@@ -119,6 +133,8 @@ gst_rdt_depay_init (GstRDTDepay * rdtdepay)
   rdtdepay->srcpad =
       gst_pad_new_from_static_template (&gst_rdt_depay_src_template, "src");
   gst_element_add_pad (GST_ELEMENT_CAST (rdtdepay), rdtdepay->srcpad);
+
+  rdtdepay->buffer_list = DEFAULT_BUFFER_LIST;
 }
 
 static void
@@ -274,11 +290,9 @@ create_segment_event (GstRDTDepay * depay, gboolean update,
   return gst_event_new_segment (&segment);
 }
 
-static GstFlowReturn
-gst_rdt_depay_push (GstRDTDepay * rdtdepay, GstBuffer * buffer)
+static void
+gst_rdt_depay_check_segment (GstRDTDepay * rdtdepay)
 {
-  GstFlowReturn ret;
-
   if (rdtdepay->need_newsegment) {
     GstEvent *event;
 
@@ -287,6 +301,14 @@ gst_rdt_depay_push (GstRDTDepay * rdtdepay, GstBuffer * buffer)
 
     rdtdepay->need_newsegment = FALSE;
   }
+}
+
+static GstFlowReturn
+gst_rdt_depay_push (GstRDTDepay * rdtdepay, GstBuffer * buffer)
+{
+  GstFlowReturn ret;
+
+  gst_rdt_depay_check_segment (rdtdepay);
 
   if (rdtdepay->discont) {
     GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
@@ -297,14 +319,23 @@ gst_rdt_depay_push (GstRDTDepay * rdtdepay, GstBuffer * buffer)
   return ret;
 }
 
+static GstFlowReturn
+gst_rdt_depay_push_list (GstRDTDepay * rdtdepay, GstBufferList * list)
+{
+  gst_rdt_depay_check_segment (rdtdepay);
+
+  return gst_pad_push_list (rdtdepay->srcpad, list);
+}
+
 static GstFlowReturn
 gst_rdt_depay_handle_data (GstRDTDepay * rdtdepay, GstClockTime outtime,
-    GstRDTPacket * packet)
+    GstRDTPacketIter * iter, const GstRDTPacketInfo * packet,
+    GstBufferList * list)
 {
   GstFlowReturn ret;
   GstBuffer *outbuf;
   GstMapInfo outmap;
-  guint8 *data, *outdata;
+  guint8 *outdata;
   guint size;
   guint16 stream_id;
   guint32 timestamp;
@@ -313,21 +344,15 @@ gst_rdt_depay_handle_data (GstRDTDepay * rdtdepay, GstClockTime outtime,
   guint8 flags;
   guint16 outflags;
 
-  /* get pointers to the packet data */
-  data = gst_rdt_packet_data_map (packet, &size);
-
-  outbuf = gst_buffer_new_and_alloc (12 + size);
-  GST_BUFFER_TIMESTAMP (outbuf) = outtime;
+  /* all header fields were decoded by the iterator */
+  size = packet->payload_size;
+  stream_id = packet->stream_id;
+  timestamp = packet->timestamp;
+  flags = packet->flags;
+  seqnum = packet->seqnum;
 
   GST_DEBUG_OBJECT (rdtdepay, "have size %u", size);
 
-  /* copy over some things */
-  stream_id = gst_rdt_packet_data_get_stream_id (packet);
-  timestamp = gst_rdt_packet_data_get_timestamp (packet);
-  flags = gst_rdt_packet_data_get_flags (packet);
-
-  seqnum = gst_rdt_packet_data_get_seq (packet);
-
   GST_DEBUG_OBJECT (rdtdepay, "stream_id %u, timestamp %u, seqnum %d, flags %d",
       stream_id, timestamp, seqnum, flags);
 
@@ -366,6 +391,11 @@ gst_rdt_depay_handle_data (GstRDTDepay * rdtdepay, GstClockTime outtime,
   else
     outflags = 0;
 
+  /* only the RealMedia header is written, the payload memory of the RDT
+   * buffer is appended by reference */
+  outbuf = gst_buffer_new_and_alloc (12);
+  GST_BUFFER_TIMESTAMP (outbuf) = outtime;
+
   gst_buffer_map (outbuf, &outmap, GST_MAP_WRITE);
   outdata = outmap.data;
   GST_WRITE_UINT16_BE (outdata + 0, 0); /* version   */
@@ -373,11 +403,21 @@ gst_rdt_depay_handle_data (GstRDTDepay * rdtdepay, GstClockTime outtime,
   GST_WRITE_UINT16_BE (outdata + 4, stream_id); /* stream    */
   GST_WRITE_UINT32_BE (outdata + 6, timestamp); /* timestamp */
   GST_WRITE_UINT16_BE (outdata + 10, outflags); /* flags     */
-  memcpy (outdata + 12, data, size);
   gst_buffer_unmap (outbuf, &outmap);
-  gst_buffer_resize (outbuf, 0, 12 + size);
 
-  gst_rdt_packet_data_unmap (packet);
+  if (size > 0)
+    gst_buffer_copy_into (outbuf, iter->buffer, GST_BUFFER_COPY_MEMORY,
+        packet->payload_offset, size);
+
+  if (list) {
+    /* collected and pushed by the chain function */
+    if (rdtdepay->discont) {
+      GST_BUFFER_FLAG_SET (outbuf, GST_BUFFER_FLAG_DISCONT);
+      rdtdepay->discont = FALSE;
+    }
+    gst_buffer_list_add (list, outbuf);
+    return GST_FLOW_OK;
+  }
 
   GST_DEBUG_OBJECT (rdtdepay, "Pushing packet, outtime %" GST_TIME_FORMAT,
       GST_TIME_ARGS (outtime));
@@ -400,8 +440,9 @@ gst_rdt_depay_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
   GstRDTDepay *rdtdepay;
   GstFlowReturn ret;
   GstClockTime timestamp;
-  gboolean more;
-  GstRDTPacket packet;
+  GstRDTPacketIter iter;
+  GstRDTPacketInfo packet;
+  GstBufferList *list = NULL;
 
   rdtdepay = GST_RDT_DEPAY (parent);
 
@@ -428,17 +469,23 @@ gst_rdt_depay_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
   GST_LOG_OBJECT (rdtdepay, "received buffer timestamp %" GST_TIME_FORMAT,
       GST_TIME_ARGS (timestamp));
 
-  /* data is in RDT format. */
-  more = gst_rdt_buffer_get_first_packet (buf, &packet);
-  while (more) {
+  /* data is in RDT format, all packets are parsed from one mapping */
+  if (!gst_rdt_packet_iter_init (&iter, buf))
+    goto map_failed;
+
+  if (rdtdepay->buffer_list)
+    list = gst_buffer_list_new ();
+
+  while (gst_rdt_packet_iter_next (&iter, &packet)) {
     GstRDTType type;
 
-    type = gst_rdt_packet_get_type (&packet);
+    type = packet.type;
     GST_DEBUG_OBJECT (rdtdepay, "Have packet of type %04x", type);
 
     if (GST_RDT_IS_DATA_TYPE (type)) {
       GST_DEBUG_OBJECT (rdtdepay, "We have a data packet");
-      ret = gst_rdt_depay_handle_data (rdtdepay, timestamp, &packet);
+      ret = gst_rdt_depay_handle_data (rdtdepay, timestamp, &iter, &packet,
+          list);
     } else {
       switch (type) {
         default:
@@ -448,13 +495,67 @@ gst_rdt_depay_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
     }
     if (ret != GST_FLOW_OK)
       break;
+  }
+  gst_rdt_packet_iter_clear (&iter);
 
-    more = gst_rdt_packet_move_to_next (&packet);
+  if (list) {
+    if (gst_buffer_list_length (list) > 0) {
+      GST_DEBUG_OBJECT (rdtdepay, "Pushing list of %u packets",
+          gst_buffer_list_length (list));
+      ret = gst_rdt_depay_push_list (rdtdepay, list);
+    } else {
+      gst_buffer_list_unref (list);
+    }
   }
 
   gst_buffer_unref (buf);
 
   return ret;
+
+  /* ERRORS */
+map_failed:
+  {
+    GST_ELEMENT_ERROR (rdtdepay, RESOURCE, READ, (NULL),
+        ("Could not map RDT buffer"));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+}
+
+static void
+gst_rdt_depay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstRDTDepay *rdtdepay;
+
+  rdtdepay = GST_RDT_DEPAY (object);
+
+  switch (prop_id) {
+    case PROP_BUFFER_LIST:
+      rdtdepay->buffer_list = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_rdt_depay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstRDTDepay *rdtdepay;
+
+  rdtdepay = GST_RDT_DEPAY (object);
+
+  switch (prop_id) {
+    case PROP_BUFFER_LIST:
+      g_value_set_boolean (value, rdtdepay->buffer_list);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
 }
 
 static GstStateChangeReturn
@@ -58,6 +58,8 @@ struct _GstRDTDepay
   gboolean need_newsegment;
   GstSegment segment;
   GstBuffer *header;
+
+  gboolean buffer_list;
 };
 
 struct _GstRDTDepayClass
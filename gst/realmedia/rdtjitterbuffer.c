@@ -28,6 +28,13 @@ GST_DEBUG_CATEGORY_STATIC (rdt_jitter_buffer_debug);
 #define MAX_WINDOW	RDT_JITTER_BUFFER_MAX_WINDOW
 #define MAX_TIME	(2 * GST_SECOND)
 
+/* the ring grows by doubling, up to half the seqnum space, after which
+ * seqnums can't be ordered anymore */
+#define MIN_RING_SIZE	256
+#define MAX_RING_SIZE	32768
+
+#define RING_ITEM(jbuf,seq) (&(jbuf)->ring[(seq) & ((jbuf)->ring_size - 1)])
+
 /* signals and args */
 enum
 {
@@ -62,7 +69,9 @@ rdt_jitter_buffer_class_init (RDTJitterBufferClass * klass)
 static void
 rdt_jitter_buffer_init (RDTJitterBuffer * jbuf)
 {
-  jbuf->packets = g_queue_new ();
+  jbuf->ring_size = MIN_RING_SIZE;
+  jbuf->ring = g_new0 (RDTJitterBufferItem, jbuf->ring_size);
+  jbuf->num_packets = 0;
 
   rdt_jitter_buffer_reset_skew (jbuf);
 }
@@ -75,7 +84,7 @@ rdt_jitter_buffer_finalize (GObject * object)
   jbuf = RDT_JITTER_BUFFER_CAST (object);
 
   rdt_jitter_buffer_flush (jbuf);
-  g_queue_free (jbuf->packets);
+  g_free (jbuf->ring);
 
   G_OBJECT_CLASS (rdt_jitter_buffer_parent_class)->finalize (object);
 }
@@ -108,6 +117,8 @@ rdt_jitter_buffer_reset_skew (RDTJitterBuffer * jbuf)
   jbuf->window_min = 0;
   jbuf->skew = 0;
   jbuf->prev_send_diff = -1;
+  jbuf->prev_delta = G_MININT64;
+  jbuf->jitter = 0;
 }
 
 /* For the clock skew we use a windowed low point averaging algorithm as can be
@@ -243,6 +254,15 @@ again:
   /* measure the diff */
   delta = ((gint64) recv_diff) - ((gint64) send_diff);
 
+  /* the interarrival jitter is the smoothed change in transit time between
+   * consecutive packets, with the 1/16 gain of RFC 3550 */
+  if (jbuf->prev_delta != G_MININT64) {
+    gint64 d = ABS (delta - jbuf->prev_delta);
+
+    jbuf->jitter = (gint64) jbuf->jitter + (d - (gint64) jbuf->jitter) / 16;
+  }
+  jbuf->prev_delta = delta;
+
   pos = jbuf->window_pos;
 
   if (jbuf->window_filling) {
@@ -327,6 +347,40 @@ no_skew:
   return out_time;
 }
 
+/* make room for @size consecutive seqnums, starting from low_seq */
+static gboolean
+resize_ring (RDTJitterBuffer * jbuf, guint size)
+{
+  RDTJitterBufferItem *old_ring;
+  guint old_size, i;
+  guint16 seq;
+
+  old_ring = jbuf->ring;
+  old_size = jbuf->ring_size;
+
+  if (size <= old_size)
+    return TRUE;
+
+  if (size > MAX_RING_SIZE)
+    return FALSE;
+
+  while (jbuf->ring_size < size)
+    jbuf->ring_size <<= 1;
+
+  GST_DEBUG ("growing ring from %u to %u", old_size, jbuf->ring_size);
+
+  jbuf->ring = g_new0 (RDTJitterBufferItem, jbuf->ring_size);
+  for (i = 0, seq = jbuf->low_seq; i < old_size; i++, seq++) {
+    RDTJitterBufferItem *item = &old_ring[seq & (old_size - 1)];
+
+    if (item->buffer)
+      *RING_ITEM (jbuf, item->seqnum) = *item;
+  }
+  g_free (old_ring);
+
+  return TRUE;
+}
+
 /**
  * rdt_jitter_buffer_insert:
  * @jbuf: an #RDTJitterBuffer
@@ -340,70 +394,75 @@ no_skew:
  * @buf when the function returns %TRUE.
  * @buf should have writable metadata when calling this function.
  *
+ * The packet is stored at its seqnum in a ring, so this takes constant time
+ * no matter how many packets are queued. Packets that are too far away from
+ * the queued ones to be ordered are dropped.
+ *
  * Returns: %FALSE if a packet with the same number already existed.
  */
 gboolean
 rdt_jitter_buffer_insert (RDTJitterBuffer * jbuf, GstBuffer * buf,
     GstClockTime time, guint32 clock_rate, gboolean * tail)
 {
-  GList *list;
+  RDTJitterBufferItem *item;
   guint32 rtptime;
   guint16 seqnum;
-  GstRDTPacket packet;
-  gboolean more;
+  GstRDTPacketIter iter;
+  GstRDTPacketInfo packet;
+  gboolean more, is_tail;
 
   g_return_val_if_fail (jbuf != NULL, FALSE);
   g_return_val_if_fail (buf != NULL, FALSE);
 
-  more = gst_rdt_buffer_get_first_packet (buf, &packet);
+  more = gst_rdt_packet_iter_init (&iter, buf) &&
+      gst_rdt_packet_iter_next (&iter, &packet);
+  gst_rdt_packet_iter_clear (&iter);
   /* programmer error */
   g_return_val_if_fail (more == TRUE, FALSE);
 
-  seqnum = gst_rdt_packet_data_get_seq (&packet);
+  seqnum = packet.seqnum;
   /* do skew calculation by measuring the difference between rtptime and the
    * receive time, this function will retimestamp @buf with the skew corrected
    * running time. */
-  rtptime = gst_rdt_packet_data_get_timestamp (&packet);
-
-  /* loop the list to skip strictly smaller seqnum buffers */
-  for (list = jbuf->packets->head; list; list = g_list_next (list)) {
-    guint16 qseq;
-    gint gap;
-
-    more =
-        gst_rdt_buffer_get_first_packet (GST_BUFFER_CAST (list->data), &packet);
-    /* programmer error */
-    g_return_val_if_fail (more == TRUE, FALSE);
-
-    qseq = gst_rdt_packet_data_get_seq (&packet);
-
-    /* compare the new seqnum to the one in the buffer */
-    gap = gst_rdt_buffer_compare_seqnum (seqnum, qseq);
-
-    /* we hit a packet with the same seqnum, notify a duplicate */
-    if (G_UNLIKELY (gap == 0))
-      goto duplicate;
-
-    /* seqnum > qseq, we can stop looking */
-    if (G_LIKELY (gap < 0))
-      break;
+  rtptime = packet.timestamp;
+
+  if (jbuf->num_packets == 0) {
+    jbuf->low_seq = jbuf->high_seq = seqnum;
+    is_tail = TRUE;
+  } else if (gst_rdt_buffer_compare_seqnum (jbuf->low_seq, seqnum) < 0) {
+    /* older than anything we have, becomes the new tail */
+    if (!resize_ring (jbuf, (guint16) (jbuf->high_seq - seqnum) + 1))
+      goto too_old;
+    jbuf->low_seq = seqnum;
+    is_tail = TRUE;
+  } else {
+    if (gst_rdt_buffer_compare_seqnum (jbuf->high_seq, seqnum) > 0) {
+      if (!resize_ring (jbuf, (guint16) (seqnum - jbuf->low_seq) + 1))
+        goto too_new;
+      jbuf->high_seq = seqnum;
+    }
+    is_tail = FALSE;
   }
 
+  item = RING_ITEM (jbuf, seqnum);
+  /* we hit a packet with the same seqnum, notify a duplicate */
+  if (G_UNLIKELY (item->buffer != NULL))
+    goto duplicate;
 
   if (clock_rate) {
     time = calculate_skew (jbuf, rtptime, time, clock_rate);
     GST_BUFFER_TIMESTAMP (buf) = time;
   }
 
-  if (list)
-    g_queue_insert_before (jbuf->packets, list, buf);
-  else
-    g_queue_push_tail (jbuf->packets, buf);
+  item->buffer = buf;
+  item->seqnum = seqnum;
+  item->rtptime = rtptime;
+  jbuf->num_packets++;
 
   /* tail was changed when we did not find a previous packet, we set the return
    * flag when requested. */
   if (tail)
-    *tail = (list == NULL);
+    *tail = is_tail;
 
   return TRUE;
 
@@ -413,6 +472,18 @@ duplicate:
     GST_WARNING ("duplicate packet %d found", (gint) seqnum);
     return FALSE;
   }
+too_old:
+  {
+    GST_WARNING ("packet %d is too old, dropping", (gint) seqnum);
+    gst_buffer_unref (buf);
+    return TRUE;
+  }
+too_new:
+  {
+    GST_WARNING ("packet %d is too far ahead, dropping", (gint) seqnum);
+    gst_buffer_unref (buf);
+    return TRUE;
+  }
 }
 
 /**
@@ -428,11 +499,26 @@ duplicate:
 GstBuffer *
 rdt_jitter_buffer_pop (RDTJitterBuffer * jbuf)
 {
+  RDTJitterBufferItem *item;
   GstBuffer *buf;
 
   g_return_val_if_fail (jbuf != NULL, FALSE);
 
-  buf = g_queue_pop_tail (jbuf->packets);
+  if (jbuf->num_packets == 0)
+    return NULL;
+
+  item = RING_ITEM (jbuf, jbuf->low_seq);
+  buf = item->buffer;
+  item->buffer = NULL;
+  jbuf->num_packets--;
+
+  /* skip the holes of missing packets to the next oldest one, each slot is
+   * skipped only once so this is constant time on average */
+  if (jbuf->num_packets > 0) {
+    do {
+      jbuf->low_seq++;
+    } while (RING_ITEM (jbuf, jbuf->low_seq)->buffer == NULL);
+  }
 
   return buf;
 }
@@ -450,13 +536,12 @@ rdt_jitter_buffer_pop (RDTJitterBuffer * jbuf)
 GstBuffer *
 rdt_jitter_buffer_peek (RDTJitterBuffer * jbuf)
 {
-  GstBuffer *buf;
-
   g_return_val_if_fail (jbuf != NULL, FALSE);
 
-  buf = g_queue_peek_tail (jbuf->packets);
+  if (jbuf->num_packets == 0)
+    return NULL;
 
-  return buf;
+  return RING_ITEM (jbuf, jbuf->low_seq)->buffer;
 }
 
 /**
@@ -468,12 +553,17 @@ rdt_jitter_buffer_peek (RDTJitterBuffer * jbuf)
 void
 rdt_jitter_buffer_flush (RDTJitterBuffer * jbuf)
 {
-  GstBuffer *buffer;
+  guint i;
 
   g_return_if_fail (jbuf != NULL);
 
-  while ((buffer = g_queue_pop_head (jbuf->packets)))
-    gst_buffer_unref (buffer);
+  for (i = 0; i < jbuf->ring_size; i++) {
+    if (jbuf->ring[i].buffer) {
+      gst_buffer_unref (jbuf->ring[i].buffer);
+      jbuf->ring[i].buffer = NULL;
+    }
+  }
+  jbuf->num_packets = 0;
 }
 
 /**
@@ -489,7 +579,7 @@ rdt_jitter_buffer_num_packets (RDTJitterBuffer * jbuf)
 {
   g_return_val_if_fail (jbuf != NULL, 0);
 
-  return jbuf->packets->length;
+  return jbuf->num_packets;
 }
 
 /**
@@ -505,21 +595,15 @@ guint32
 rdt_jitter_buffer_get_ts_diff (RDTJitterBuffer * jbuf)
 {
   guint64 high_ts, low_ts;
-  GstBuffer *high_buf, *low_buf;
   guint32 result;
 
   g_return_val_if_fail (jbuf != NULL, 0);
 
-  high_buf = g_queue_peek_head (jbuf->packets);
-  low_buf = g_queue_peek_tail (jbuf->packets);
-
-  if (!high_buf || !low_buf || high_buf == low_buf)
+  if (jbuf->num_packets < 2)
     return 0;
 
-  //high_ts = gst_rtp_buffer_get_timestamp (high_buf);
-  //low_ts = gst_rtp_buffer_get_timestamp (low_buf);
-  high_ts = 0;
-  low_ts = 0;
+  high_ts = RING_ITEM (jbuf, jbuf->high_seq)->rtptime;
+  low_ts = RING_ITEM (jbuf, jbuf->low_seq)->rtptime;
 
   /* it needs to work if ts wraps */
   if (high_ts >= low_ts) {
@@ -529,3 +613,63 @@ rdt_jitter_buffer_get_ts_diff (RDTJitterBuffer * jbuf)
   }
   return result;
 }
+
+/**
+ * rdt_jitter_buffer_get_jitter:
+ * @jbuf: an #RDTJitterBuffer
+ *
+ * Get the smoothed interarrival jitter of the packets inserted in @jbuf.
+ *
+ * Returns: the jitter in nanoseconds.
+ */
+GstClockTime
+rdt_jitter_buffer_get_jitter (RDTJitterBuffer * jbuf)
+{
+  g_return_val_if_fail (jbuf != NULL, 0);
+
+  return jbuf->jitter;
+}
+
+static gint
+compare_delta (gconstpointer a, gconstpointer b)
+{
+  gint64 da = *(const gint64 *) a;
+  gint64 db = *(const gint64 *) b;
+
+  return (da > db) - (da < db);
+}
+
+/**
+ * rdt_jitter_buffer_get_delay_percentile:
+ * @jbuf: an #RDTJitterBuffer
+ * @percentile: the percentile, between 0 and 100
+ *
+ * Get how late the packets in the skew window arrived compared to the
+ * fastest one. Packets are output at the time of the fastest packet plus the
+ * skew, so this is the amount of buffering needed to have @percentile percent
+ * of the recent packets arrive in time.
+ *
+ * Returns: the delay in nanoseconds.
+ */
+GstClockTime
+rdt_jitter_buffer_get_delay_percentile (RDTJitterBuffer * jbuf,
+    guint percentile)
+{
+  gint64 sorted[MAX_WINDOW];
+  guint n;
+  gint64 delay;
+
+  g_return_val_if_fail (jbuf != NULL, 0);
+
+  /* while filling, the valid values are the ones before window_pos */
+  n = jbuf->window_filling ? jbuf->window_pos : jbuf->window_size;
+  if (n == 0)
+    return 0;
+
+  memcpy (sorted, jbuf->window, n * sizeof (gint64));
+  qsort (sorted, n, sizeof (gint64), compare_delta);
+
+  delay = sorted[(n - 1) * MIN (percentile, 100) / 100] - jbuf->window_min;
+
+  return MAX (delay, 0);
+}
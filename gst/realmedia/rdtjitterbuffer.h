@@ -42,6 +42,24 @@ typedef struct _RDTJitterBufferClass RDTJitterBufferClass;
 typedef void (*RTPTailChanged) (RDTJitterBuffer *jbuf, gpointer user_data);
 
 #define RDT_JITTER_BUFFER_MAX_WINDOW 512
+
+typedef struct _RDTJitterBufferItem RDTJitterBufferItem;
+
+/**
+ * RDTJitterBufferItem:
+ * @buffer: the queued buffer, %NULL for an empty slot
+ * @seqnum: seqnum of the first packet in @buffer
+ * @rtptime: timestamp of the first packet in @buffer
+ *
+ * A slot in the packet ring of an #RDTJitterBuffer. The seqnum and timestamp
+ * are parsed once when the buffer is inserted.
+ */
+struct _RDTJitterBufferItem {
+  GstBuffer     *buffer;
+  guint16        seqnum;
+  guint32        rtptime;
+};
+
 /**
  * RDTJitterBuffer:
  *
@@ -50,7 +68,12 @@ typedef void (*RTPTailChanged) (RDTJitterBuffer *jbuf, gpointer user_data);
 struct _RDTJitterBuffer {
   GObject        object;
 
-  GQueue        *packets;
+  /* packets, stored at their seqnum modulo ring_size */
+  RDTJitterBufferItem *ring;
+  guint          ring_size;
+  guint          num_packets;
+  guint16        low_seq;
+  guint16        high_seq;
 
   /* for calculating skew */
   GstClockTime   base_time;
@@ -63,6 +86,10 @@ struct _RDTJitterBuffer {
   gint64         window_min;
   gint64         skew;
   gint64         prev_send_diff;
+
+  /* interarrival jitter, RFC 3550 style */
+  gint64         prev_delta;
+  GstClockTime   jitter;
 };
 
 struct _RDTJitterBufferClass {
@@ -88,4 +115,8 @@ void                  rdt_jitter_buffer_flush            (RDTJitterBuffer *jbuf)
 guint                 rdt_jitter_buffer_num_packets      (RDTJitterBuffer *jbuf);
 guint32               rdt_jitter_buffer_get_ts_diff      (RDTJitterBuffer *jbuf);
 
+GstClockTime          rdt_jitter_buffer_get_jitter       (RDTJitterBuffer *jbuf);
+GstClockTime          rdt_jitter_buffer_get_delay_percentile (RDTJitterBuffer *jbuf,
+                                                          guint percentile);
+
 #endif /* __RDT_JITTER_BUFFER_H__ */
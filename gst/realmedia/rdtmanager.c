@@ -58,6 +58,7 @@
 #include <gst/glib-compat-private.h>
 
 #include <stdio.h>
+#include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (rdtmanager_debug);
 #define GST_CAT_DEFAULT (rdtmanager_debug)
@@ -81,11 +82,33 @@ enum
 };
 
 #define DEFAULT_LATENCY_MS      200
+#define DEFAULT_ADAPTIVE_LATENCY FALSE
+#define DEFAULT_MIN_LATENCY_MS  20
+#define DEFAULT_MAX_LATENCY_MS  2000
+#define DEFAULT_LATENCY_PERCENTILE 95
+#define DEFAULT_ACK_INTERVAL_MS 0
+
+/* RDT seqnums wrap at 0xff00, the values above are packet types */
+#define RDT_SEQ_WRAP            0xff00
+/* number of seqnums we keep track of for ACKs, this must divide
+ * RDT_SEQ_WRAP so that the bitmap index doesn't jump when seqnums wrap */
+#define ACK_WINDOW              256
+
+/* how often the adaptive latency is recalculated */
+#define ADAPT_INTERVAL          (GST_SECOND)
+/* don't bother lowering the latency for less than this */
+#define ADAPT_HYSTERESIS        (10 * GST_MSECOND)
 
 enum
 {
   PROP_0,
-  PROP_LATENCY
+  PROP_LATENCY,
+  PROP_ADAPTIVE_LATENCY,
+  PROP_MIN_LATENCY,
+  PROP_MAX_LATENCY,
+  PROP_LATENCY_PERCENTILE,
+  PROP_ACK_INTERVAL,
+  PROP_STATS
 };
 
 static GstStaticPadTemplate gst_rdt_manager_recv_rtp_sink_template =
@@ -216,21 +239,42 @@ struct _GstRDTManagerSession
   /* some accounting */
   guint64 num_late;
   guint64 num_duplicates;
+
+  /* adaptive latency, target_latency is protected with the object lock */
+  GstClockTime last_adapt_time;
+  GstClockTime target_latency;
+
+  /* receiver statistics */
+  gboolean have_seq;
+  guint16 base_seq;
+  guint16 max_seq;
+  guint32 cycles;
+  guint64 num_received;
+  guint64 num_reordered;
+
+  /* ACK generation, a bit is set for each received seqnum */
+  guint16 stream_id;
+  guint8 ack_bitmap[ACK_WINDOW / 8];
+  GstClockTime last_ack_time;
+  gboolean rtcp_started;
+  guint64 num_acks;
 };
 
+#define ACK_BIT_SET(sess,seq)   ((sess)->ack_bitmap[((seq) % ACK_WINDOW) >> 3] |= (1 << ((seq) & 7)))
+#define ACK_BIT_CLEAR(sess,seq) ((sess)->ack_bitmap[((seq) % ACK_WINDOW) >> 3] &= ~(1 << ((seq) & 7)))
+#define ACK_BIT_IS_SET(sess,seq) (((sess)->ack_bitmap[((seq) % ACK_WINDOW) >> 3] & (1 << ((seq) & 7))) != 0)
+
 /* find a session with the given id */
 static GstRDTManagerSession *
 find_session_by_id (GstRDTManager * rdtmanager, gint id)
 {
-  GSList *walk;
+  GstRDTManagerSession *sess;
 
-  for (walk = rdtmanager->sessions; walk; walk = g_slist_next (walk)) {
-    GstRDTManagerSession *sess = (GstRDTManagerSession *) walk->data;
+  GST_OBJECT_LOCK (rdtmanager);
+  sess = g_hash_table_lookup (rdtmanager->sessions, GINT_TO_POINTER (id));
+  GST_OBJECT_UNLOCK (rdtmanager);
 
-    if (sess->id == id)
-      return sess;
-  }
-  return NULL;
+  return sess;
 }
 
 /* create a session with the given id */
@@ -245,7 +289,13 @@ create_session (GstRDTManager * rdtmanager, gint id)
   sess->jbuf = rdt_jitter_buffer_new ();
   g_mutex_init (&sess->jbuf_lock);
   g_cond_init (&sess->jbuf_cond);
-  rdtmanager->sessions = g_slist_prepend (rdtmanager->sessions, sess);
+  sess->last_adapt_time = GST_CLOCK_TIME_NONE;
+  sess->target_latency = 0;
+  sess->last_ack_time = GST_CLOCK_TIME_NONE;
+
+  GST_OBJECT_LOCK (rdtmanager);
+  g_hash_table_insert (rdtmanager->sessions, GINT_TO_POINTER (id), sess);
+  GST_OBJECT_UNLOCK (rdtmanager);
 
   return sess;
 }
@@ -426,6 +476,61 @@ gst_rdt_manager_class_init (GstRDTManagerClass * g_class)
           "Amount of ms to buffer", 0, G_MAXUINT, DEFAULT_LATENCY_MS,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstRDTManager:adaptive-latency:
+   *
+   * Measure the network jitter and adjust the latency between
+   * #GstRDTManager:min-latency and #GstRDTManager:max-latency, starting from
+   * #GstRDTManager:latency. A latency message is posted on the bus every time
+   * the latency changes.
+   */
+  g_object_class_install_property (gobject_class, PROP_ADAPTIVE_LATENCY,
+      g_param_spec_boolean ("adaptive-latency", "Adaptive latency",
+          "Adjust the latency to the measured network jitter",
+          DEFAULT_ADAPTIVE_LATENCY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MIN_LATENCY,
+      g_param_spec_uint ("min-latency", "Minimum latency in ms",
+          "Lower bound of the adaptive latency", 0, G_MAXUINT,
+          DEFAULT_MIN_LATENCY_MS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_MAX_LATENCY,
+      g_param_spec_uint ("max-latency", "Maximum latency in ms",
+          "Upper bound of the adaptive latency", 0, G_MAXUINT,
+          DEFAULT_MAX_LATENCY_MS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class, PROP_LATENCY_PERCENTILE,
+      g_param_spec_uint ("latency-percentile", "Latency percentile",
+          "Percentage of packets the adaptive latency should get in time",
+          50, 100, DEFAULT_LATENCY_PERCENTILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstRDTManager:ack-interval:
+   *
+   * Send an RDT ACK packet on the rtcp_src pad of a session every this many
+   * milliseconds. The packet marks the missing packets among the last 256
+   * seqnums so that the server can retransmit them. 0 disables ACKs.
+   */
+  g_object_class_install_property (gobject_class, PROP_ACK_INTERVAL,
+      g_param_spec_uint ("ack-interval", "ACK interval in ms",
+          "Interval between RDT ACK packets on the rtcp_src pads "
+          "(0 = disabled)", 0, G_MAXUINT, DEFAULT_ACK_INTERVAL_MS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstRDTManager:stats:
+   *
+   * Various statistics. The structure contains the current latency in
+   * nanoseconds and a "session-stats" array with one structure per session,
+   * sorted by session id.
+   */
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Various statistics of the sessions", GST_TYPE_STRUCTURE,
+          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
   /**
    * GstRDTManager::request-pt-map:
    * @rdtmanager: the object which received the signal
@@ -540,6 +645,15 @@ gst_rdt_manager_init (GstRDTManager * rdtmanager)
 {
   rdtmanager->provided_clock = gst_system_clock_obtain ();
   rdtmanager->latency = DEFAULT_LATENCY_MS;
+  rdtmanager->adaptive_latency = DEFAULT_ADAPTIVE_LATENCY;
+  rdtmanager->min_latency = DEFAULT_MIN_LATENCY_MS;
+  rdtmanager->max_latency = DEFAULT_MAX_LATENCY_MS;
+  rdtmanager->latency_percentile = DEFAULT_LATENCY_PERCENTILE;
+  rdtmanager->current_latency = DEFAULT_LATENCY_MS * GST_MSECOND;
+  rdtmanager->last_adapt_time = GST_CLOCK_TIME_NONE;
+  rdtmanager->ack_interval = DEFAULT_ACK_INTERVAL_MS;
+  rdtmanager->sessions = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) free_session);
   GST_OBJECT_FLAG_SET (rdtmanager, GST_ELEMENT_FLAG_PROVIDE_CLOCK);
 }
 
@@ -550,8 +664,7 @@ gst_rdt_manager_finalize (GObject * object)
 
   rdtmanager = GST_RDT_MANAGER (object);
 
-  g_slist_foreach (rdtmanager->sessions, (GFunc) free_session, NULL);
-  g_slist_free (rdtmanager->sessions);
+  g_hash_table_destroy (rdtmanager->sessions);
   g_clear_object (&rdtmanager->provided_clock);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
@@ -570,7 +683,9 @@ gst_rdt_manager_query_src (GstPad * pad, GstObject * parent, GstQuery * query)
     {
       GstClockTime latency;
 
-      latency = rdtmanager->latency * GST_MSECOND;
+      GST_OBJECT_LOCK (rdtmanager);
+      latency = rdtmanager->current_latency;
+      GST_OBJECT_UNLOCK (rdtmanager);
 
       /* we pretend to be live with a 3 second latency */
       gst_query_set_latency (query, TRUE, latency, -1);
@@ -645,34 +760,305 @@ gst_rdt_manager_src_activate_mode (GstPad * pad, GstObject * parent,
   return result;
 }
 
+/* start over from the configured latency, clamped to the adaptive bounds.
+ * Must be called with the object lock */
+static void
+reset_current_latency (GstRDTManager * rdtmanager)
+{
+  GstClockTime latency;
+
+  latency = rdtmanager->latency * GST_MSECOND;
+  if (rdtmanager->adaptive_latency)
+    latency = CLAMP (latency, rdtmanager->min_latency * GST_MSECOND,
+        rdtmanager->max_latency * GST_MSECOND);
+
+  rdtmanager->current_latency = latency;
+}
+
+/* recalculate the latency needed for the jitter measured in @session.
+ * Must be called with the JBUF_LOCK of @session. Returns TRUE when the
+ * latency of the element changed and a latency message should be posted. */
+static gboolean
+update_adaptive_latency (GstRDTManager * rdtmanager,
+    GstRDTManagerSession * session, GstClockTime timestamp)
+{
+  GstClockTime target, current, jitter;
+
+  if (!GST_CLOCK_TIME_IS_VALID (timestamp))
+    return FALSE;
+
+  if (GST_CLOCK_TIME_IS_VALID (session->last_adapt_time) &&
+      timestamp < session->last_adapt_time + ADAPT_INTERVAL)
+    return FALSE;
+  session->last_adapt_time = timestamp;
+
+  GST_OBJECT_LOCK (rdtmanager);
+  if (!rdtmanager->adaptive_latency)
+    goto not_adaptive;
+
+  /* buffer for the requested percentile of late packets, with some headroom
+   * for the jitter that was not seen in the window yet */
+  jitter = rdt_jitter_buffer_get_jitter (session->jbuf);
+  target = rdt_jitter_buffer_get_delay_percentile (session->jbuf,
+      rdtmanager->latency_percentile) + 2 * jitter;
+  session->target_latency = target;
+  target = CLAMP (target, rdtmanager->min_latency * GST_MSECOND,
+      rdtmanager->max_latency * GST_MSECOND);
+
+  current = rdtmanager->current_latency;
+  if (target > current) {
+    /* go up right away, we are dropping packets otherwise */
+  } else if (GST_CLOCK_TIME_IS_VALID (rdtmanager->last_adapt_time) &&
+      timestamp < rdtmanager->last_adapt_time + ADAPT_INTERVAL) {
+    /* some session already looked at lowering the latency recently */
+    target = current;
+  } else {
+    GHashTableIter iter;
+    GstRDTManagerSession *sess;
+
+    rdtmanager->last_adapt_time = timestamp;
+
+    /* all sessions are synchronized, the latency has to cover the worst
+     * one */
+    g_hash_table_iter_init (&iter, rdtmanager->sessions);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & sess))
+      target = MAX (target, sess->target_latency);
+    target = CLAMP (target, rdtmanager->min_latency * GST_MSECOND,
+        rdtmanager->max_latency * GST_MSECOND);
+
+    if (target > current) {
+      /* another session needs more */
+    } else if (current - target > ADAPT_HYSTERESIS) {
+      /* go down slowly so that a short calm period does not make us lose the
+       * next burst */
+      target = current - (current - target) / 4;
+    } else {
+      target = current;
+    }
+  }
+  rdtmanager->current_latency = target;
+  GST_OBJECT_UNLOCK (rdtmanager);
+
+  if (target == current)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (rdtmanager, "session %d: jitter %" GST_TIME_FORMAT
+      ", latency %" GST_TIME_FORMAT " -> %" GST_TIME_FORMAT, session->id,
+      GST_TIME_ARGS (jitter), GST_TIME_ARGS (current), GST_TIME_ARGS (target));
+
+  return TRUE;
+
+not_adaptive:
+  {
+    GST_OBJECT_UNLOCK (rdtmanager);
+    return FALSE;
+  }
+}
+
+/* update the receiver statistics with @seqnum. Called with the JBUF_LOCK of
+ * @session. Returns FALSE when @seqnum was already received. */
+static gboolean
+update_receive_stats (GstRDTManagerSession * session, guint16 seqnum)
+{
+  guint d, i;
+
+  if (G_UNLIKELY (!session->have_seq)) {
+    session->have_seq = TRUE;
+    session->base_seq = session->max_seq = seqnum;
+    session->cycles = 0;
+    memset (session->ack_bitmap, 0, sizeof (session->ack_bitmap));
+    goto received;
+  }
+
+  /* distance from the highest seqnum, modulo the seqnum range */
+  d = (seqnum + RDT_SEQ_WRAP - session->max_seq) % RDT_SEQ_WRAP;
+  if (d == 0)
+    return FALSE;
+
+  if (d < RDT_SEQ_WRAP / 2) {
+    /* newer packet, everything in between is missing for now */
+    if (d >= ACK_WINDOW) {
+      memset (session->ack_bitmap, 0, sizeof (session->ack_bitmap));
+    } else {
+      for (i = 1; i < d; i++)
+        ACK_BIT_CLEAR (session, (session->max_seq + i) % RDT_SEQ_WRAP);
+    }
+    if (seqnum < session->max_seq)
+      session->cycles++;
+    session->max_seq = seqnum;
+  } else {
+    /* older packet, either reordered or retransmitted */
+    if (RDT_SEQ_WRAP - d < ACK_WINDOW && ACK_BIT_IS_SET (session, seqnum))
+      return FALSE;
+    session->num_reordered++;
+  }
+
+received:
+  ACK_BIT_SET (session, seqnum);
+  session->num_received++;
+
+  return TRUE;
+}
+
+static guint64
+get_num_lost (GstRDTManagerSession * session)
+{
+  gint64 expected;
+
+  if (!session->have_seq)
+    return 0;
+
+  expected = (gint64) session->cycles * RDT_SEQ_WRAP + session->max_seq -
+      session->base_seq + 1;
+
+  return MAX (expected - (gint64) session->num_received, 0);
+}
+
+/* Make an ACK packet for the last ACK_WINDOW seqnums. Called with the
+ * JBUF_LOCK of @session.
+ *
+ *   0                   1                   2                   3
+ *   0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |L|H|  dummy    |        type (0xff02)          |  length ...   |
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |      ...      |           stream_id           |   last_seq ...|
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |      ...      |           first_seq           | bitmap_len ...|
+ *  +-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+ *  |      ...      |   bitmap ...
+ *  +-+-+-+-+-+-+-+-+-+-+-+
+ *
+ * L (length included) and H (lost high) are always set, a 1 bit in the
+ * bitmap means that the packet first_seq + bit index is lost. The bits
+ * are stored MSB first.
+ */
+static GstBuffer *
+create_ack_packet (GstRDTManagerSession * session)
+{
+  GstBuffer *buffer;
+  GstMapInfo map;
+  guint64 span;
+  guint count, bitmap_len, len, i, lost;
+  guint16 first;
+
+  span = (guint64) session->cycles * RDT_SEQ_WRAP + session->max_seq -
+      session->base_seq + 1;
+  count = MIN (span, ACK_WINDOW);
+  first = (session->max_seq + RDT_SEQ_WRAP - (count - 1)) % RDT_SEQ_WRAP;
+  bitmap_len = (count + 7) / 8;
+  len = 13 + bitmap_len;
+
+  buffer = gst_buffer_new_allocate (NULL, len, NULL);
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  map.data[0] = 0xc0;
+  GST_WRITE_UINT16_BE (map.data + 1, GST_RDT_TYPE_ACK);
+  GST_WRITE_UINT16_BE (map.data + 3, len);
+  GST_WRITE_UINT16_BE (map.data + 5, session->stream_id);
+  GST_WRITE_UINT16_BE (map.data + 7, session->max_seq);
+  GST_WRITE_UINT16_BE (map.data + 9, first);
+  GST_WRITE_UINT16_BE (map.data + 11, bitmap_len);
+  memset (map.data + 13, 0, bitmap_len);
+
+  for (i = 0, lost = 0; i < count; i++) {
+    if (!ACK_BIT_IS_SET (session, (first + i) % RDT_SEQ_WRAP)) {
+      map.data[13 + i / 8] |= 0x80 >> (i % 8);
+      lost++;
+    }
+  }
+  gst_buffer_unmap (buffer, &map);
+
+  GST_LOG ("session %d: ACK for %u-%u, %u lost", session->id, first,
+      session->max_seq, lost);
+
+  session->num_acks++;
+
+  return buffer;
+}
+
+static void
+gst_rdt_manager_push_ack (GstRDTManager * rdtmanager,
+    GstRDTManagerSession * session, GstBuffer * ack)
+{
+  GstFlowReturn res;
+
+  if (!session->rtcp_started) {
+    GstSegment segment;
+    GstCaps *caps;
+    gchar *stream_id;
+
+    stream_id = gst_pad_create_stream_id (session->rtcp_src,
+        GST_ELEMENT_CAST (rdtmanager), "rtcp");
+    gst_pad_push_event (session->rtcp_src,
+        gst_event_new_stream_start (stream_id));
+    g_free (stream_id);
+
+    caps = gst_pad_get_pad_template_caps (session->rtcp_src);
+    gst_pad_push_event (session->rtcp_src, gst_event_new_caps (caps));
+    gst_caps_unref (caps);
+
+    gst_segment_init (&segment, GST_FORMAT_TIME);
+    gst_pad_push_event (session->rtcp_src, gst_event_new_segment (&segment));
+
+    session->rtcp_started = TRUE;
+  }
+
+  res = gst_pad_push (session->rtcp_src, ack);
+  if (res != GST_FLOW_OK)
+    GST_DEBUG_OBJECT (rdtmanager, "pushing ACK failed: %s",
+        gst_flow_get_name (res));
+}
+
 static GstFlowReturn
 gst_rdt_manager_handle_data_packet (GstRDTManagerSession * session,
-    GstClockTime timestamp, GstRDTPacket * packet)
+    GstClockTime timestamp, GstRDTPacketIter * iter,
+    const GstRDTPacketInfo * packet)
 {
   GstRDTManager *rdtmanager;
   guint16 seqnum;
   gboolean tail;
   GstFlowReturn res;
   GstBuffer *buffer;
+  GstBuffer *ack = NULL;
+  gboolean latency_changed = FALSE;
+  guint ack_interval;
 
   rdtmanager = session->dec;
 
   res = GST_FLOW_OK;
 
-  seqnum = 0;
+  seqnum = packet->seqnum;
   GST_DEBUG_OBJECT (rdtmanager,
       "Received packet #%d at time %" GST_TIME_FORMAT, seqnum,
       GST_TIME_ARGS (timestamp));
 
-  buffer = gst_rdt_packet_to_buffer (packet);
+  buffer = gst_rdt_packet_info_to_buffer (iter, packet);
 
   JBUF_LOCK_CHECK (session, out_flushing);
 
-  /* insert the packet into the queue now, FIXME, use seqnum */
+  /* this also catches duplicates of packets we already pushed out */
+  if (!update_receive_stats (session, seqnum))
+    goto duplicate;
+
+  /* insert the packet into the queue now */
   if (!rdt_jitter_buffer_insert (session->jbuf, buffer, timestamp,
           session->clock_rate, &tail))
     goto duplicate;
 
+  latency_changed = update_adaptive_latency (rdtmanager, session, timestamp);
+
+  /* time for an ACK */
+  ack_interval = rdtmanager->ack_interval;
+  if (ack_interval > 0 && session->rtcp_src != NULL &&
+      GST_CLOCK_TIME_IS_VALID (timestamp) &&
+      (!GST_CLOCK_TIME_IS_VALID (session->last_ack_time) ||
+          timestamp >= session->last_ack_time + ack_interval * GST_MSECOND)) {
+    session->stream_id = packet->stream_id;
+    ack = create_ack_packet (session);
+    GST_BUFFER_TIMESTAMP (ack) = timestamp;
+    session->last_ack_time = timestamp;
+  }
+
   /* signal addition of new buffer when the _loop is waiting. */
   if (session->waiting)
     JBUF_SIGNAL (session);
@@ -680,6 +1066,14 @@ gst_rdt_manager_handle_data_packet (GstRDTManagerSession * session,
 finished:
   JBUF_UNLOCK (session);
 
+  if (ack)
+    gst_rdt_manager_push_ack (rdtmanager, session, ack);
+
+  /* let the application recalculate and redistribute the latency */
+  if (latency_changed)
+    gst_element_post_message (GST_ELEMENT_CAST (rdtmanager),
+        gst_message_new_latency (GST_OBJECT_CAST (rdtmanager)));
+
   return res;
 
   /* ERRORS */
@@ -786,10 +1180,10 @@ gst_rdt_manager_chain_rdt (GstPad * pad, GstObject * parent, GstBuffer * buffer)
   GstRDTManager *rdtmanager;
   GstRDTManagerSession *session;
   GstClockTime timestamp;
-  GstRDTPacket packet;
+  GstRDTPacketIter iter;
+  GstRDTPacketInfo packet;
   guint32 ssrc;
   guint8 pt;
-  gboolean more;
 
   rdtmanager = GST_RDT_MANAGER (parent);
 
@@ -825,16 +1219,20 @@ gst_rdt_manager_chain_rdt (GstPad * pad, GstObject * parent, GstBuffer * buffer)
   timestamp = gst_segment_to_running_time (&session->segment, GST_FORMAT_TIME,
       timestamp);
 
-  more = gst_rdt_buffer_get_first_packet (buffer, &packet);
-  while (more) {
+  /* walk all packets with one mapping */
+  if (!gst_rdt_packet_iter_init (&iter, buffer))
+    goto map_failed;
+
+  while (gst_rdt_packet_iter_next (&iter, &packet)) {
     GstRDTType type;
 
-    type = gst_rdt_packet_get_type (&packet);
+    type = packet.type;
     GST_DEBUG_OBJECT (rdtmanager, "Have packet of type %04x", type);
 
     if (GST_RDT_IS_DATA_TYPE (type)) {
       GST_DEBUG_OBJECT (rdtmanager, "We have a data packet");
-      res = gst_rdt_manager_handle_data_packet (session, timestamp, &packet);
+      res = gst_rdt_manager_handle_data_packet (session, timestamp, &iter,
+          &packet);
     } else {
       switch (type) {
         default:
@@ -844,13 +1242,21 @@ gst_rdt_manager_chain_rdt (GstPad * pad, GstObject * parent, GstBuffer * buffer)
     }
     if (res != GST_FLOW_OK)
       break;
-
-    more = gst_rdt_packet_move_to_next (&packet);
   }
+  gst_rdt_packet_iter_clear (&iter);
 
   gst_buffer_unref (buffer);
 
   return res;
+
+  /* ERRORS */
+map_failed:
+  {
+    GST_ELEMENT_ERROR (rdtmanager, RESOURCE, READ, (NULL),
+        ("Could not map RDT buffer"));
+    gst_buffer_unref (buffer);
+    return GST_FLOW_ERROR;
+  }
 }
 
 /* push packets from the queue to the downstream demuxer */
@@ -1093,6 +1499,70 @@ bad_packet:
 #endif
 }
 
+static GstStructure *
+gst_rdt_manager_session_get_stats (GstRDTManagerSession * session)
+{
+  GstStructure *s;
+
+  JBUF_LOCK (session);
+  s = gst_structure_new ("application/x-rdt-session-stats",
+      "session-id", G_TYPE_UINT, (guint) session->id,
+      "num-queued", G_TYPE_UINT, rdt_jitter_buffer_num_packets (session->jbuf),
+      "num-received", G_TYPE_UINT64, session->num_received,
+      "num-lost", G_TYPE_UINT64, get_num_lost (session),
+      "num-reordered", G_TYPE_UINT64, session->num_reordered,
+      "num-late", G_TYPE_UINT64, session->num_late,
+      "num-duplicates", G_TYPE_UINT64, session->num_duplicates,
+      "jitter", G_TYPE_UINT64, rdt_jitter_buffer_get_jitter (session->jbuf),
+      "num-acks", G_TYPE_UINT64, session->num_acks, NULL);
+  JBUF_UNLOCK (session);
+
+  return s;
+}
+
+static gint
+compare_session_id (gconstpointer a, gconstpointer b)
+{
+  const GstRDTManagerSession *sa = a, *sb = b;
+
+  return sa->id - sb->id;
+}
+
+static GstStructure *
+gst_rdt_manager_create_stats (GstRDTManager * rdtmanager)
+{
+  GstStructure *s;
+  GValue array = G_VALUE_INIT;
+  GList *sessions, *walk;
+  GstClockTime latency;
+
+  /* sessions are only freed with the element, so we can release the object
+   * lock before taking the session locks */
+  GST_OBJECT_LOCK (rdtmanager);
+  sessions = g_hash_table_get_values (rdtmanager->sessions);
+  latency = rdtmanager->current_latency;
+  GST_OBJECT_UNLOCK (rdtmanager);
+
+  sessions = g_list_sort (sessions, compare_session_id);
+
+  g_value_init (&array, GST_TYPE_ARRAY);
+  for (walk = sessions; walk; walk = g_list_next (walk)) {
+    GValue val = G_VALUE_INIT;
+
+    g_value_init (&val, GST_TYPE_STRUCTURE);
+    g_value_take_boxed (&val, gst_rdt_manager_session_get_stats (walk->data));
+    gst_value_array_append_and_take_value (&array, &val);
+  }
+
+  s = gst_structure_new ("application/x-rdt-manager-stats",
+      "latency", G_TYPE_UINT64, latency,
+      "num-sessions", G_TYPE_UINT, g_list_length (sessions), NULL);
+  gst_structure_take_value (s, "session-stats", &array);
+  g_list_free (sessions);
+
+  return s;
+}
+
 static void
 gst_rdt_manager_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -1103,7 +1573,36 @@ gst_rdt_manager_set_property (GObject * object, guint prop_id,
 
   switch (prop_id) {
     case PROP_LATENCY:
+      GST_OBJECT_LOCK (src);
       src->latency = g_value_get_uint (value);
+      reset_current_latency (src);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_ADAPTIVE_LATENCY:
+      GST_OBJECT_LOCK (src);
+      src->adaptive_latency = g_value_get_boolean (value);
+      reset_current_latency (src);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_MIN_LATENCY:
+      GST_OBJECT_LOCK (src);
+      src->min_latency = g_value_get_uint (value);
+      reset_current_latency (src);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_MAX_LATENCY:
+      GST_OBJECT_LOCK (src);
+      src->max_latency = g_value_get_uint (value);
+      reset_current_latency (src);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_LATENCY_PERCENTILE:
+      GST_OBJECT_LOCK (src);
+      src->latency_percentile = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (src);
+      break;
+    case PROP_ACK_INTERVAL:
+      src->ack_interval = g_value_get_uint (value);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -1123,6 +1622,24 @@ gst_rdt_manager_get_property (GObject * object, guint prop_id, GValue * value,
     case PROP_LATENCY:
       g_value_set_uint (value, src->latency);
       break;
+    case PROP_ADAPTIVE_LATENCY:
+      g_value_set_boolean (value, src->adaptive_latency);
+      break;
+    case PROP_MIN_LATENCY:
+      g_value_set_uint (value, src->min_latency);
+      break;
+    case PROP_MAX_LATENCY:
+      g_value_set_uint (value, src->max_latency);
+      break;
+    case PROP_LATENCY_PERCENTILE:
+      g_value_set_uint (value, src->latency_percentile);
+      break;
+    case PROP_ACK_INTERVAL:
+      g_value_set_uint (value, src->ack_interval);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_rdt_manager_create_stats (src));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -61,7 +61,17 @@ struct _GstRDTManager {
   GstElement  element;
 
   guint       latency;
-  GSList     *sessions;
+  gboolean    adaptive_latency;
+  guint       min_latency;
+  guint       max_latency;
+  guint       latency_percentile;
+  /* the latency we report, protected with the object lock */
+  GstClockTime current_latency;
+  GstClockTime last_adapt_time;
+  guint       ack_interval;
+
+  /* session id -> GstRDTManagerSession, protected with the object lock */
+  GHashTable *sessions;
   GstClock   *provided_clock;
 };
 
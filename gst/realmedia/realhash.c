@@ -26,6 +26,7 @@
 #include <stdint.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <gst/gst.h>
@@ -36,289 +37,226 @@ void rtsp_ext_real_calc_response_and_checksum (char *response,
     char *chksum, char *challenge);
 
 /*
- * The following code has been copied from
+ * The challenge/response scheme comes from
  * xine-lib-1.1.1/src/input/libreal/real.c.
+ *
+ * The response is the MD5 digest of a single 64 byte block made from two
+ * constant words and the challenge XORed with a table. The message and its
+ * padding are therefore known up front and the digest can be computed on
+ * 32 bit words directly, without the generic buffering of xine.
  */
 
-static const unsigned char xor_table[] = {
-  0x05, 0x18, 0x74, 0xd0, 0x0d, 0x09, 0x02, 0x53,
-  0xc0, 0x01, 0x05, 0x05, 0x67, 0x03, 0x19, 0x70,
-  0x08, 0x27, 0x66, 0x10, 0x10, 0x72, 0x08, 0x09,
-  0x63, 0x11, 0x03, 0x71, 0x08, 0x08, 0x70, 0x02,
-  0x10, 0x57, 0x05, 0x18, 0x54, 0x00, 0x00, 0x00
+/* the xine xor_table, as little endian words, zero padded to 56 bytes */
+static const guint32 xor_words[14] = {
+  0xd0741805, 0x5302090d, 0x050501c0, 0x70190367,
+  0x10662708, 0x09087210, 0x71031163, 0x02700808,
+  0x18055710, 0x00000054, 0x00000000, 0x00000000,
+  0x00000000, 0x00000000
 };
 
-#define LE_32(x) GST_READ_UINT32_LE(x)
-#define BE_32C(x,y) GST_WRITE_UINT32_BE(x,y)
-#define LE_32C(x,y) GST_WRITE_UINT32_LE(x,y)
+/* the MD5 padding block for a message of 64 bytes */
+static const guint32 pad_words[16] = {
+  0x00000080, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 64 * 8, 0
+};
 
-static void
-hash (char *field, char *param)
-{
-  uint32_t a, b, c, d;
-
-  /* fill variables */
-  a = LE_32 (field);
-  b = LE_32 (field + 4);
-  c = LE_32 (field + 8);
-  d = LE_32 (field + 12);
-
-  a = ((b & c) | (~b & d)) + LE_32 ((param + 0x00)) + a - 0x28955B88;
-  a = ((a << 0x07) | (a >> 0x19)) + b;
-  d = ((a & b) | (~a & c)) + LE_32 ((param + 0x04)) + d - 0x173848AA;
-  d = ((d << 0x0c) | (d >> 0x14)) + a;
-  c = ((d & a) | (~d & b)) + LE_32 ((param + 0x08)) + c + 0x242070DB;
-  c = ((c << 0x11) | (c >> 0x0f)) + d;
-  b = ((c & d) | (~c & a)) + LE_32 ((param + 0x0c)) + b - 0x3E423112;
-  b = ((b << 0x16) | (b >> 0x0a)) + c;
-  a = ((b & c) | (~b & d)) + LE_32 ((param + 0x10)) + a - 0x0A83F051;
-  a = ((a << 0x07) | (a >> 0x19)) + b;
-  d = ((a & b) | (~a & c)) + LE_32 ((param + 0x14)) + d + 0x4787C62A;
-  d = ((d << 0x0c) | (d >> 0x14)) + a;
-  c = ((d & a) | (~d & b)) + LE_32 ((param + 0x18)) + c - 0x57CFB9ED;
-  c = ((c << 0x11) | (c >> 0x0f)) + d;
-  b = ((c & d) | (~c & a)) + LE_32 ((param + 0x1c)) + b - 0x02B96AFF;
-  b = ((b << 0x16) | (b >> 0x0a)) + c;
-  a = ((b & c) | (~b & d)) + LE_32 ((param + 0x20)) + a + 0x698098D8;
-  a = ((a << 0x07) | (a >> 0x19)) + b;
-  d = ((a & b) | (~a & c)) + LE_32 ((param + 0x24)) + d - 0x74BB0851;
-  d = ((d << 0x0c) | (d >> 0x14)) + a;
-  c = ((d & a) | (~d & b)) + LE_32 ((param + 0x28)) + c - 0x0000A44F;
-  c = ((c << 0x11) | (c >> 0x0f)) + d;
-  b = ((c & d) | (~c & a)) + LE_32 ((param + 0x2C)) + b - 0x76A32842;
-  b = ((b << 0x16) | (b >> 0x0a)) + c;
-  a = ((b & c) | (~b & d)) + LE_32 ((param + 0x30)) + a + 0x6B901122;
-  a = ((a << 0x07) | (a >> 0x19)) + b;
-  d = ((a & b) | (~a & c)) + LE_32 ((param + 0x34)) + d - 0x02678E6D;
-  d = ((d << 0x0c) | (d >> 0x14)) + a;
-  c = ((d & a) | (~d & b)) + LE_32 ((param + 0x38)) + c - 0x5986BC72;
-  c = ((c << 0x11) | (c >> 0x0f)) + d;
-  b = ((c & d) | (~c & a)) + LE_32 ((param + 0x3c)) + b + 0x49B40821;
-  b = ((b << 0x16) | (b >> 0x0a)) + c;
-
-  a = ((b & d) | (~d & c)) + LE_32 ((param + 0x04)) + a - 0x09E1DA9E;
-  a = ((a << 0x05) | (a >> 0x1b)) + b;
-  d = ((a & c) | (~c & b)) + LE_32 ((param + 0x18)) + d - 0x3FBF4CC0;
-  d = ((d << 0x09) | (d >> 0x17)) + a;
-  c = ((d & b) | (~b & a)) + LE_32 ((param + 0x2c)) + c + 0x265E5A51;
-  c = ((c << 0x0e) | (c >> 0x12)) + d;
-  b = ((c & a) | (~a & d)) + LE_32 ((param + 0x00)) + b - 0x16493856;
-  b = ((b << 0x14) | (b >> 0x0c)) + c;
-  a = ((b & d) | (~d & c)) + LE_32 ((param + 0x14)) + a - 0x29D0EFA3;
-  a = ((a << 0x05) | (a >> 0x1b)) + b;
-  d = ((a & c) | (~c & b)) + LE_32 ((param + 0x28)) + d + 0x02441453;
-  d = ((d << 0x09) | (d >> 0x17)) + a;
-  c = ((d & b) | (~b & a)) + LE_32 ((param + 0x3c)) + c - 0x275E197F;
-  c = ((c << 0x0e) | (c >> 0x12)) + d;
-  b = ((c & a) | (~a & d)) + LE_32 ((param + 0x10)) + b - 0x182C0438;
-  b = ((b << 0x14) | (b >> 0x0c)) + c;
-  a = ((b & d) | (~d & c)) + LE_32 ((param + 0x24)) + a + 0x21E1CDE6;
-  a = ((a << 0x05) | (a >> 0x1b)) + b;
-  d = ((a & c) | (~c & b)) + LE_32 ((param + 0x38)) + d - 0x3CC8F82A;
-  d = ((d << 0x09) | (d >> 0x17)) + a;
-  c = ((d & b) | (~b & a)) + LE_32 ((param + 0x0c)) + c - 0x0B2AF279;
-  c = ((c << 0x0e) | (c >> 0x12)) + d;
-  b = ((c & a) | (~a & d)) + LE_32 ((param + 0x20)) + b + 0x455A14ED;
-  b = ((b << 0x14) | (b >> 0x0c)) + c;
-  a = ((b & d) | (~d & c)) + LE_32 ((param + 0x34)) + a - 0x561C16FB;
-  a = ((a << 0x05) | (a >> 0x1b)) + b;
-  d = ((a & c) | (~c & b)) + LE_32 ((param + 0x08)) + d - 0x03105C08;
-  d = ((d << 0x09) | (d >> 0x17)) + a;
-  c = ((d & b) | (~b & a)) + LE_32 ((param + 0x1c)) + c + 0x676F02D9;
-  c = ((c << 0x0e) | (c >> 0x12)) + d;
-  b = ((c & a) | (~a & d)) + LE_32 ((param + 0x30)) + b - 0x72D5B376;
-  b = ((b << 0x14) | (b >> 0x0c)) + c;
-
-  a = (b ^ c ^ d) + LE_32 ((param + 0x14)) + a - 0x0005C6BE;
-  a = ((a << 0x04) | (a >> 0x1c)) + b;
-  d = (a ^ b ^ c) + LE_32 ((param + 0x20)) + d - 0x788E097F;
-  d = ((d << 0x0b) | (d >> 0x15)) + a;
-  c = (d ^ a ^ b) + LE_32 ((param + 0x2c)) + c + 0x6D9D6122;
-  c = ((c << 0x10) | (c >> 0x10)) + d;
-  b = (c ^ d ^ a) + LE_32 ((param + 0x38)) + b - 0x021AC7F4;
-  b = ((b << 0x17) | (b >> 0x09)) + c;
-  a = (b ^ c ^ d) + LE_32 ((param + 0x04)) + a - 0x5B4115BC;
-  a = ((a << 0x04) | (a >> 0x1c)) + b;
-  d = (a ^ b ^ c) + LE_32 ((param + 0x10)) + d + 0x4BDECFA9;
-  d = ((d << 0x0b) | (d >> 0x15)) + a;
-  c = (d ^ a ^ b) + LE_32 ((param + 0x1c)) + c - 0x0944B4A0;
-  c = ((c << 0x10) | (c >> 0x10)) + d;
-  b = (c ^ d ^ a) + LE_32 ((param + 0x28)) + b - 0x41404390;
-  b = ((b << 0x17) | (b >> 0x09)) + c;
-  a = (b ^ c ^ d) + LE_32 ((param + 0x34)) + a + 0x289B7EC6;
-  a = ((a << 0x04) | (a >> 0x1c)) + b;
-  d = (a ^ b ^ c) + LE_32 ((param + 0x00)) + d - 0x155ED806;
-  d = ((d << 0x0b) | (d >> 0x15)) + a;
-  c = (d ^ a ^ b) + LE_32 ((param + 0x0c)) + c - 0x2B10CF7B;
-  c = ((c << 0x10) | (c >> 0x10)) + d;
-  b = (c ^ d ^ a) + LE_32 ((param + 0x18)) + b + 0x04881D05;
-  b = ((b << 0x17) | (b >> 0x09)) + c;
-  a = (b ^ c ^ d) + LE_32 ((param + 0x24)) + a - 0x262B2FC7;
-  a = ((a << 0x04) | (a >> 0x1c)) + b;
-  d = (a ^ b ^ c) + LE_32 ((param + 0x30)) + d - 0x1924661B;
-  d = ((d << 0x0b) | (d >> 0x15)) + a;
-  c = (d ^ a ^ b) + LE_32 ((param + 0x3c)) + c + 0x1fa27cf8;
-  c = ((c << 0x10) | (c >> 0x10)) + d;
-  b = (c ^ d ^ a) + LE_32 ((param + 0x08)) + b - 0x3B53A99B;
-  b = ((b << 0x17) | (b >> 0x09)) + c;
-
-  a = ((~d | b) ^ c) + LE_32 ((param + 0x00)) + a - 0x0BD6DDBC;
-  a = ((a << 0x06) | (a >> 0x1a)) + b;
-  d = ((~c | a) ^ b) + LE_32 ((param + 0x1c)) + d + 0x432AFF97;
-  d = ((d << 0x0a) | (d >> 0x16)) + a;
-  c = ((~b | d) ^ a) + LE_32 ((param + 0x38)) + c - 0x546BDC59;
-  c = ((c << 0x0f) | (c >> 0x11)) + d;
-  b = ((~a | c) ^ d) + LE_32 ((param + 0x14)) + b - 0x036C5FC7;
-  b = ((b << 0x15) | (b >> 0x0b)) + c;
-  a = ((~d | b) ^ c) + LE_32 ((param + 0x30)) + a + 0x655B59C3;
-  a = ((a << 0x06) | (a >> 0x1a)) + b;
-  d = ((~c | a) ^ b) + LE_32 ((param + 0x0C)) + d - 0x70F3336E;
-  d = ((d << 0x0a) | (d >> 0x16)) + a;
-  c = ((~b | d) ^ a) + LE_32 ((param + 0x28)) + c - 0x00100B83;
-  c = ((c << 0x0f) | (c >> 0x11)) + d;
-  b = ((~a | c) ^ d) + LE_32 ((param + 0x04)) + b - 0x7A7BA22F;
-  b = ((b << 0x15) | (b >> 0x0b)) + c;
-  a = ((~d | b) ^ c) + LE_32 ((param + 0x20)) + a + 0x6FA87E4F;
-  a = ((a << 0x06) | (a >> 0x1a)) + b;
-  d = ((~c | a) ^ b) + LE_32 ((param + 0x3c)) + d - 0x01D31920;
-  d = ((d << 0x0a) | (d >> 0x16)) + a;
-  c = ((~b | d) ^ a) + LE_32 ((param + 0x18)) + c - 0x5CFEBCEC;
-  c = ((c << 0x0f) | (c >> 0x11)) + d;
-  b = ((~a | c) ^ d) + LE_32 ((param + 0x34)) + b + 0x4E0811A1;
-  b = ((b << 0x15) | (b >> 0x0b)) + c;
-  a = ((~d | b) ^ c) + LE_32 ((param + 0x10)) + a - 0x08AC817E;
-  a = ((a << 0x06) | (a >> 0x1a)) + b;
-  d = ((~c | a) ^ b) + LE_32 ((param + 0x2c)) + d - 0x42C50DCB;
-  d = ((d << 0x0a) | (d >> 0x16)) + a;
-  c = ((~b | d) ^ a) + LE_32 ((param + 0x08)) + c + 0x2AD7D2BB;
-  c = ((c << 0x0f) | (c >> 0x11)) + d;
-  b = ((~a | c) ^ d) + LE_32 ((param + 0x24)) + b - 0x14792C6F;
-  b = ((b << 0x15) | (b >> 0x0b)) + c;
-
-  a += LE_32 (field);
-  b += LE_32 (field + 4);
-  c += LE_32 (field + 8);
-  d += LE_32 (field + 12);
-
-  LE_32C (field, a);
-  LE_32C (field + 4, b);
-  LE_32C (field + 8, c);
-  LE_32C (field + 12, d);
-}
+#define F1(x,y,z) ((z) ^ ((x) & ((y) ^ (z))))
+#define F2(x,y,z) F1 (z, x, y)
+#define F3(x,y,z) ((x) ^ (y) ^ (z))
+#define F4(x,y,z) ((y) ^ ((x) | ~(z)))
+
+#define MD5_STEP(f,a,b,c,d,x,k,s) \
+  (a += f (b, c, d) + x + k, a = ((a << s) | (a >> (32 - s))) + b)
 
 static void
-call_hash (char *key, char *challenge, int len)
+md5_transform (guint32 state[4], const guint32 w[16])
 {
-  uint8_t *ptr1, *ptr2;
-  uint32_t a, b, c, d, tmp;
-
-  ptr1 = (uint8_t *) (key + 16);
-  ptr2 = (uint8_t *) (key + 20);
-
-  a = LE_32 (ptr1);
-  b = (a >> 3) & 0x3f;
-  a += len * 8;
-  LE_32C (ptr1, a);
-
-  if (a < (len << 3))
-    ptr2 += 4;
-
-  tmp = LE_32 (ptr2) + (len >> 0x1d);
-  LE_32C (ptr2, tmp);
-  a = 64 - b;
-  c = 0;
-  if (a <= len) {
-
-    memcpy (key + b + 24, challenge, a);
-    hash (key, key + 24);
-    c = a;
-    d = c + 0x3f;
-
-    while (d < len) {
-      hash (key, challenge + d - 0x3f);
-      d += 64;
-      c += 64;
-    }
-    b = 0;
-  }
-
-  memcpy (key + b + 24, challenge + c, len - c);
+  guint32 a, b, c, d;
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+
+  MD5_STEP (F1, a, b, c, d, w[0], 0xd76aa478, 7);
+  MD5_STEP (F1, d, a, b, c, w[1], 0xe8c7b756, 12);
+  MD5_STEP (F1, c, d, a, b, w[2], 0x242070db, 17);
+  MD5_STEP (F1, b, c, d, a, w[3], 0xc1bdceee, 22);
+  MD5_STEP (F1, a, b, c, d, w[4], 0xf57c0faf, 7);
+  MD5_STEP (F1, d, a, b, c, w[5], 0x4787c62a, 12);
+  MD5_STEP (F1, c, d, a, b, w[6], 0xa8304613, 17);
+  MD5_STEP (F1, b, c, d, a, w[7], 0xfd469501, 22);
+  MD5_STEP (F1, a, b, c, d, w[8], 0x698098d8, 7);
+  MD5_STEP (F1, d, a, b, c, w[9], 0x8b44f7af, 12);
+  MD5_STEP (F1, c, d, a, b, w[10], 0xffff5bb1, 17);
+  MD5_STEP (F1, b, c, d, a, w[11], 0x895cd7be, 22);
+  MD5_STEP (F1, a, b, c, d, w[12], 0x6b901122, 7);
+  MD5_STEP (F1, d, a, b, c, w[13], 0xfd987193, 12);
+  MD5_STEP (F1, c, d, a, b, w[14], 0xa679438e, 17);
+  MD5_STEP (F1, b, c, d, a, w[15], 0x49b40821, 22);
+
+  MD5_STEP (F2, a, b, c, d, w[1], 0xf61e2562, 5);
+  MD5_STEP (F2, d, a, b, c, w[6], 0xc040b340, 9);
+  MD5_STEP (F2, c, d, a, b, w[11], 0x265e5a51, 14);
+  MD5_STEP (F2, b, c, d, a, w[0], 0xe9b6c7aa, 20);
+  MD5_STEP (F2, a, b, c, d, w[5], 0xd62f105d, 5);
+  MD5_STEP (F2, d, a, b, c, w[10], 0x02441453, 9);
+  MD5_STEP (F2, c, d, a, b, w[15], 0xd8a1e681, 14);
+  MD5_STEP (F2, b, c, d, a, w[4], 0xe7d3fbc8, 20);
+  MD5_STEP (F2, a, b, c, d, w[9], 0x21e1cde6, 5);
+  MD5_STEP (F2, d, a, b, c, w[14], 0xc33707d6, 9);
+  MD5_STEP (F2, c, d, a, b, w[3], 0xf4d50d87, 14);
+  MD5_STEP (F2, b, c, d, a, w[8], 0x455a14ed, 20);
+  MD5_STEP (F2, a, b, c, d, w[13], 0xa9e3e905, 5);
+  MD5_STEP (F2, d, a, b, c, w[2], 0xfcefa3f8, 9);
+  MD5_STEP (F2, c, d, a, b, w[7], 0x676f02d9, 14);
+  MD5_STEP (F2, b, c, d, a, w[12], 0x8d2a4c8a, 20);
+
+  MD5_STEP (F3, a, b, c, d, w[5], 0xfffa3942, 4);
+  MD5_STEP (F3, d, a, b, c, w[8], 0x8771f681, 11);
+  MD5_STEP (F3, c, d, a, b, w[11], 0x6d9d6122, 16);
+  MD5_STEP (F3, b, c, d, a, w[14], 0xfde5380c, 23);
+  MD5_STEP (F3, a, b, c, d, w[1], 0xa4beea44, 4);
+  MD5_STEP (F3, d, a, b, c, w[4], 0x4bdecfa9, 11);
+  MD5_STEP (F3, c, d, a, b, w[7], 0xf6bb4b60, 16);
+  MD5_STEP (F3, b, c, d, a, w[10], 0xbebfbc70, 23);
+  MD5_STEP (F3, a, b, c, d, w[13], 0x289b7ec6, 4);
+  MD5_STEP (F3, d, a, b, c, w[0], 0xeaa127fa, 11);
+  MD5_STEP (F3, c, d, a, b, w[3], 0xd4ef3085, 16);
+  MD5_STEP (F3, b, c, d, a, w[6], 0x04881d05, 23);
+  MD5_STEP (F3, a, b, c, d, w[9], 0xd9d4d039, 4);
+  MD5_STEP (F3, d, a, b, c, w[12], 0xe6db99e5, 11);
+  MD5_STEP (F3, c, d, a, b, w[15], 0x1fa27cf8, 16);
+  MD5_STEP (F3, b, c, d, a, w[2], 0xc4ac5665, 23);
+
+  MD5_STEP (F4, a, b, c, d, w[0], 0xf4292244, 6);
+  MD5_STEP (F4, d, a, b, c, w[7], 0x432aff97, 10);
+  MD5_STEP (F4, c, d, a, b, w[14], 0xab9423a7, 15);
+  MD5_STEP (F4, b, c, d, a, w[5], 0xfc93a039, 21);
+  MD5_STEP (F4, a, b, c, d, w[12], 0x655b59c3, 6);
+  MD5_STEP (F4, d, a, b, c, w[3], 0x8f0ccc92, 10);
+  MD5_STEP (F4, c, d, a, b, w[10], 0xffeff47d, 15);
+  MD5_STEP (F4, b, c, d, a, w[1], 0x85845dd1, 21);
+  MD5_STEP (F4, a, b, c, d, w[8], 0x6fa87e4f, 6);
+  MD5_STEP (F4, d, a, b, c, w[15], 0xfe2ce6e0, 10);
+  MD5_STEP (F4, c, d, a, b, w[6], 0xa3014314, 15);
+  MD5_STEP (F4, b, c, d, a, w[13], 0x4e0811a1, 21);
+  MD5_STEP (F4, a, b, c, d, w[4], 0xf7537e82, 6);
+  MD5_STEP (F4, d, a, b, c, w[11], 0xbd3af235, 10);
+  MD5_STEP (F4, c, d, a, b, w[2], 0x2ad7d2bb, 15);
+  MD5_STEP (F4, b, c, d, a, w[9], 0xeb86d391, 21);
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
 }
 
 void
 gst_rtsp_ext_real_calc_response_and_checksum (char *response, char *chksum,
     char *challenge)
 {
-  int ch_len, table_len, resp_len;
-  int i;
-  char *ptr;
-  char buf[128];
-  char field[128];
-  char zres[20];
-  char buf1[128];
-  char buf2[128];
-
-  /* initialize return values */
-  memset (response, 0, 64);
-  memset (chksum, 0, 34);
-
-  /* initialize buffer */
-  memset (buf, 0, 128);
-  ptr = buf;
-  BE_32C (ptr, 0xa1e9149d);
-  ptr += 4;
-  BE_32C (ptr, 0x0e6b3b59);
-  ptr += 4;
-
-  if ((ch_len = MIN (strlen (challenge), 56)) == 40) {
-    challenge[32] = 0;
+  static const char hex[] = "0123456789abcdef";
+  guint32 state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  guint32 w[16];
+  gsize ch_len;
+  guint i, j;
+
+  /* only the first 32 bytes of a 40 byte challenge are used */
+  if ((ch_len = MIN (strlen (challenge), 56)) == 40)
     ch_len = 32;
+
+  /* make the message block, 0xa1e9149d 0x0e6b3b59 followed by the
+   * challenge XORed with the table */
+  w[0] = 0x9d14e9a1;
+  w[1] = 0x593b6b0e;
+  for (i = 0; i < 14; i++) {
+    guint32 v = 0;
+
+    if (i * 4 + 4 <= ch_len) {
+      v = GST_READ_UINT32_LE (challenge + i * 4);
+    } else {
+      for (j = i * 4; j < ch_len; j++)
+        v |= (guint32) (guint8) challenge[j] << (8 * (j & 3));
+    }
+    w[i + 2] = v ^ xor_words[i];
   }
-  memcpy (ptr, challenge, ch_len);
-
-  /* xor challenge bytewise with xor_table */
-  table_len = MIN (strlen ((char *) xor_table), 56);
-  for (i = 0; i < table_len; i++)
-    ptr[i] = ptr[i] ^ xor_table[i];
-
-  /* initialize our field */
-  BE_32C (field, 0x01234567);
-  BE_32C (field + 4, 0x89ABCDEF);
-  BE_32C (field + 8, 0xFEDCBA98);
-  BE_32C (field + 12, 0x76543210);
-  BE_32C (field + 16, 0x00000000);
-  BE_32C (field + 20, 0x00000000);
-
-  /* calculate response */
-  call_hash (field, buf, 64);
-  memset (buf1, 0, 64);
-  *buf1 = (char) 128;
-  memcpy (buf2, field + 16, 8);
-  i = (LE_32 ((buf2)) >> 3) & 0x3f;
-  if (i < 56)
-    i = 56 - i;
-  else
-    i = 120 - i;
-  call_hash (field, buf1, i);
-  call_hash (field, buf2, 8);
-  memcpy (zres, field, 16);
-
-  /* convert zres to ascii string */
-  for (i = 0; i < 16; i++) {
-    char a, b;
 
-    a = (zres[i] >> 4) & 15;
-    b = zres[i] & 15;
+  md5_transform (state, w);
+  md5_transform (state, pad_words);
+
+  /* convert the digest to an ascii string */
+  for (i = 0; i < 16; i++) {
+    guint8 byte = state[i >> 2] >> (8 * (i & 3));
 
-    response[i * 2] = ((a < 10) ? (a + 48) : (a + 87)) & 255;
-    response[i * 2 + 1] = ((b < 10) ? (b + 48) : (b + 87)) & 255;
+    response[i * 2] = hex[byte >> 4];
+    response[i * 2 + 1] = hex[byte & 15];
   }
 
   /* add tail */
-  resp_len = strlen (response);
-  strcpy (&response[resp_len], "01d0a8e3");
+  strcpy (&response[32], "01d0a8e3");
 
   /* calculate checksum */
-  for (i = 0; i < resp_len / 4; i++)
+  for (i = 0; i < 8; i++)
     chksum[i] = response[i * 4];
+  chksum[8] = '\0';
 }
+
+#ifdef TEST
+static const struct
+{
+  const gchar *challenge;
+  const gchar *response;
+  const gchar *chksum;
+} kat[] = {
+  {"", "b3d3bdb047de2d62e097e10d8444ada101d0a8e3", "bb42ee8a"},
+  {"a", "83289077208090d3cddbb09a7a9d614b01d0a8e3", "8929cb76"},
+  {"9e26d33f2984236010ef6253fb1887f7",
+      "48d13bd8ba807646230934c02003399701d0a8e3", "43b72323"},
+  {"3d6a1c2a2a1d7c8e9b2f2b6a1a6f3c57",
+      "9ed25c0d50b9cc7ba9a3dc903f052d5b01d0a8e3", "955cad32"},
+  /* 40 bytes, only the first 32 are used */
+  {"0123456789abcdef0123456789abcdef01234567",
+      "d52601bf779e648297fbc1a2d20b5f8a01d0a8e3", "d0769cd5"},
+  /* longer than 56 bytes, the rest is ignored */
+  {"fedcba9876543210fedcba9876543210fedcba9876543210fedcba98765432",
+      "f8b27ba4f0a9ca8cc7ab9b743ff4d72301d0a8e3", "f7fcc93d"},
+};
+
+gint
+main (gint argc, gchar * argv[])
+{
+  gchar challenge[64], response[64], chksum[34];
+  guint i, iterations = 1000000;
+  gint64 start, elapsed;
+  gint failed = 0;
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+
+  for (i = 0; i < G_N_ELEMENTS (kat); i++) {
+    g_strlcpy (challenge, kat[i].challenge, sizeof (challenge));
+    gst_rtsp_ext_real_calc_response_and_checksum (response, chksum,
+        challenge);
+
+    if (strcmp (response, kat[i].response) || strcmp (chksum, kat[i].chksum)) {
+      g_print ("FAIL \"%s\": got %s %s, expected %s %s\n",
+          kat[i].challenge, response, chksum, kat[i].response,
+          kat[i].chksum);
+      failed++;
+    }
+  }
+  g_print ("%u known answers, %d failed\n", i, failed);
+
+  g_strlcpy (challenge, kat[2].challenge, sizeof (challenge));
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++)
+    gst_rtsp_ext_real_calc_response_and_checksum (response, chksum,
+        challenge);
+  elapsed = g_get_monotonic_time () - start;
+
+  g_print ("%u responses in %" G_GINT64_FORMAT " us, %.1f per second\n",
+      iterations, elapsed, elapsed ? iterations * 1e6 / elapsed : 0.0);
+
+  return failed ? 1 : 0;
+}
+#endif
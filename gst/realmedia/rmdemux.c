@@ -39,6 +39,7 @@
 #define RMDEMUX_FOURCC_GET(a)   GST_READ_UINT32_LE(a)
 #define HEADER_SIZE 10
 #define DATA_SIZE 8
+#define PACKET_HEADER_SIZE 12
 
 #define MAX_FRAGS 256
 
@@ -95,6 +96,11 @@ struct _GstRMDemuxStream
   GstAdapter *adapter;
 
   GstTagList *pending_tags;
+
+  /* output thread, only used when stream-queue-size is non-zero */
+  GstDataQueue *queue;
+  guint queue_size;
+  GstFlowReturn last_flow;
 };
 
 struct _GstRMDemuxIndex
@@ -103,6 +109,14 @@ struct _GstRMDemuxIndex
   GstClockTime timestamp;
 };
 
+#define DEFAULT_STREAM_QUEUE_SIZE 0
+
+enum
+{
+  PROP_0,
+  PROP_STREAM_QUEUE_SIZE
+};
+
 static GstStaticPadTemplate gst_rmdemux_sink_template =
 GST_STATIC_PAD_TEMPLATE ("sink",
     GST_PAD_SINK,
@@ -131,6 +145,10 @@ static void gst_rmdemux_class_init (GstRMDemuxClass * klass);
 static void gst_rmdemux_base_init (GstRMDemuxClass * klass);
 static void gst_rmdemux_init (GstRMDemux * rmdemux);
 static void gst_rmdemux_finalize (GObject * object);
+static void gst_rmdemux_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_rmdemux_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 static GstStateChangeReturn gst_rmdemux_change_state (GstElement * element,
     GstStateChange transition);
 static GstFlowReturn gst_rmdemux_chain (GstPad * pad, GstObject * parent,
@@ -162,8 +180,8 @@ static void gst_rmdemux_parse_data (GstRMDemux * rmdemux, const guint8 * data,
     int length);
 static void gst_rmdemux_parse_cont (GstRMDemux * rmdemux, const guint8 * data,
     int length);
-static GstFlowReturn gst_rmdemux_parse_packet (GstRMDemux * rmdemux,
-    GstBuffer * in, guint16 version);
+static gboolean gst_rmdemux_parse_data_packets (GstRMDemux * rmdemux,
+    GstFlowReturn * ret);
 static void gst_rmdemux_parse_indx_data (GstRMDemux * rmdemux,
     const guint8 * data, int length);
 static void gst_rmdemux_stream_clear_cached_subpackets (GstRMDemux * rmdemux,
@@ -226,6 +244,16 @@ gst_rmdemux_class_init (GstRMDemuxClass * klass)
       0, "Demuxer for Realmedia streams");
 
   gobject_class->finalize = gst_rmdemux_finalize;
+  gobject_class->set_property = gst_rmdemux_set_property;
+  gobject_class->get_property = gst_rmdemux_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_QUEUE_SIZE,
+      g_param_spec_uint ("stream-queue-size", "Stream queue size",
+          "Push each stream from its own thread through a queue of at most "
+          "this many buffers (0 = push all streams from the demuxer thread). "
+          "Only takes effect for streams created after it is set",
+          0, G_MAXUINT, DEFAULT_STREAM_QUEUE_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -268,10 +296,214 @@ gst_rmdemux_init (GstRMDemux * rmdemux)
   rmdemux->have_group_id = FALSE;
   rmdemux->group_id = G_MAXUINT;
   rmdemux->flowcombiner = gst_flow_combiner_new ();
+  rmdemux->stream_queue_size = DEFAULT_STREAM_QUEUE_SIZE;
 
   gst_rm_utils_run_tests ();
 }
 
+static void
+gst_rmdemux_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstRMDemux *rmdemux = GST_RMDEMUX (object);
+
+  switch (prop_id) {
+    case PROP_STREAM_QUEUE_SIZE:
+      GST_OBJECT_LOCK (rmdemux);
+      rmdemux->stream_queue_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (rmdemux);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_rmdemux_get_property (GObject * object, guint prop_id, GValue * value,
+    GParamSpec * pspec)
+{
+  GstRMDemux *rmdemux = GST_RMDEMUX (object);
+
+  switch (prop_id) {
+    case PROP_STREAM_QUEUE_SIZE:
+      GST_OBJECT_LOCK (rmdemux);
+      g_value_set_uint (value, rmdemux->stream_queue_size);
+      GST_OBJECT_UNLOCK (rmdemux);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+gst_rmdemux_stream_queue_full (GstDataQueue * queue, guint visible,
+    guint bytes, guint64 time, gpointer checkdata)
+{
+  GstRMDemuxStream *stream = checkdata;
+
+  return visible >= stream->queue_size;
+}
+
+static void
+gst_rmdemux_queue_item_free (GstDataQueueItem * item)
+{
+  if (item->object)
+    gst_mini_object_unref (item->object);
+  g_slice_free (GstDataQueueItem, item);
+}
+
+/* Runs in the stream's own thread when stream-queue-size is set, pushing
+ * what the demuxer queued for this stream. The flow return is kept in
+ * last_flow so that the demuxer can combine it as if it had pushed itself. */
+static void
+gst_rmdemux_stream_loop (GstRMDemuxStream * stream)
+{
+  GstDataQueueItem *item;
+  GstFlowReturn ret;
+
+  if (!gst_data_queue_pop (stream->queue, &item))
+    goto flushing;
+
+  if (GST_IS_BUFFER (item->object)) {
+    ret = gst_pad_push (stream->pad, GST_BUFFER_CAST (item->object));
+    item->object = NULL;
+    item->destroy (item);
+
+    g_atomic_int_set (&stream->last_flow, ret);
+    if (ret != GST_FLOW_OK && ret != GST_FLOW_NOT_LINKED) {
+      GST_DEBUG_OBJECT (stream->pad, "pausing output thread, reason %s",
+          gst_flow_get_name (ret));
+      gst_data_queue_set_flushing (stream->queue, TRUE);
+      gst_pad_pause_task (stream->pad);
+    }
+  } else {
+    gst_pad_push_event (stream->pad, GST_EVENT_CAST (item->object));
+    item->object = NULL;
+    item->destroy (item);
+  }
+  return;
+
+flushing:
+  {
+    GST_DEBUG_OBJECT (stream->pad, "queue flushing, pausing output thread");
+    gst_pad_pause_task (stream->pad);
+    return;
+  }
+}
+
+static gboolean
+gst_rmdemux_src_activate_mode (GstPad * pad, GstObject * parent,
+    GstPadMode mode, gboolean active)
+{
+  GstRMDemuxStream *stream = GST_PAD_ELEMENT_PRIVATE (pad);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  if (active) {
+    g_atomic_int_set (&stream->last_flow, GST_FLOW_OK);
+    gst_data_queue_set_flushing (stream->queue, FALSE);
+    return gst_pad_start_task (pad, (GstTaskFunction) gst_rmdemux_stream_loop,
+        stream, NULL);
+  }
+
+  gst_data_queue_set_flushing (stream->queue, TRUE);
+  return gst_pad_stop_task (pad);
+}
+
+static GstFlowReturn
+gst_rmdemux_stream_queue_object (GstRMDemuxStream * stream,
+    GstMiniObject * object, gboolean visible)
+{
+  GstDataQueueItem *item;
+  GstFlowReturn ret;
+
+  item = g_slice_new0 (GstDataQueueItem);
+  item->object = object;
+  item->visible = visible;
+  if (GST_IS_BUFFER (object)) {
+    item->size = gst_buffer_get_size (GST_BUFFER_CAST (object));
+    item->duration = GST_BUFFER_DURATION (GST_BUFFER_CAST (object));
+  }
+  item->destroy = (GDestroyNotify) gst_rmdemux_queue_item_free;
+
+  ret = g_atomic_int_get (&stream->last_flow);
+
+  if (!gst_data_queue_push (stream->queue, item)) {
+    item->destroy (item);
+    if (ret == GST_FLOW_OK)
+      ret = GST_FLOW_FLUSHING;
+  }
+
+  return ret;
+}
+
+/* Pushes @buffer on the stream's pad, or hands it to the stream's output
+ * thread if it has one. In that case the flow return is the last one that
+ * thread got. */
+static GstFlowReturn
+gst_rmdemux_stream_push (GstRMDemuxStream * stream, GstBuffer * buffer)
+{
+  if (stream->queue == NULL)
+    return gst_pad_push (stream->pad, buffer);
+
+  return gst_rmdemux_stream_queue_object (stream, GST_MINI_OBJECT_CAST (buffer),
+      TRUE);
+}
+
+/* Serialized events go through the stream's queue to stay in order with
+ * the buffers, flushes are handled right away */
+static void
+gst_rmdemux_stream_push_event (GstRMDemuxStream * stream, GstEvent * event)
+{
+  if (stream->queue == NULL) {
+    gst_pad_push_event (stream->pad, event);
+    return;
+  }
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_START:
+      gst_data_queue_set_flushing (stream->queue, TRUE);
+      gst_pad_push_event (stream->pad, event);
+      gst_pad_pause_task (stream->pad);
+      break;
+    case GST_EVENT_FLUSH_STOP:
+      gst_pad_push_event (stream->pad, event);
+      gst_data_queue_flush (stream->queue);
+      g_atomic_int_set (&stream->last_flow, GST_FLOW_OK);
+      gst_data_queue_set_flushing (stream->queue, FALSE);
+      gst_pad_start_task (stream->pad,
+          (GstTaskFunction) gst_rmdemux_stream_loop, stream, NULL);
+      break;
+    default:
+      gst_rmdemux_stream_queue_object (stream, GST_MINI_OBJECT_CAST (event),
+          FALSE);
+      break;
+  }
+}
+
+/* An error or EOS pauses a stream's output thread and leaves its queue
+ * flushing. After a seek there is new data to push, so start them again */
+static void
+gst_rmdemux_restart_streams (GstRMDemux * rmdemux)
+{
+  GSList *cur;
+
+  for (cur = rmdemux->streams; cur; cur = cur->next) {
+    GstRMDemuxStream *stream = cur->data;
+
+    if (stream->queue == NULL)
+      continue;
+
+    g_atomic_int_set (&stream->last_flow, GST_FLOW_OK);
+    gst_data_queue_set_flushing (stream->queue, FALSE);
+    gst_pad_start_task (stream->pad,
+        (GstTaskFunction) gst_rmdemux_stream_loop, stream, NULL);
+  }
+}
+
 static gboolean
 gst_rmdemux_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
 {
@@ -578,6 +810,8 @@ gst_rmdemux_perform_seek (GstRMDemux * rmdemux, GstEvent * event)
     if (flush)
       gst_rmdemux_send_event (rmdemux, gst_event_new_flush_stop (TRUE));
 
+    gst_rmdemux_restart_streams (rmdemux);
+
     /* must send newsegment event from streaming thread, so just set flag */
     rmdemux->need_newsegment = TRUE;
 
@@ -687,6 +921,8 @@ gst_rmdemux_free_stream (GstRMDemux * rmdemux, GstRMDemuxStream * stream)
     gst_tag_list_unref (stream->pending_tags);
   if (stream->subpackets)
     g_ptr_array_free (stream->subpackets, TRUE);
+  if (stream->queue)
+    g_object_unref (stream->queue);
   g_free (stream->index);
   g_free (stream);
 }
@@ -992,7 +1228,6 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
 {
   GstFlowReturn ret = GST_FLOW_OK;
   const guint8 *data;
-  guint16 version;
   guint avail;
 
   GstRMDemux *rmdemux = GST_RMDEMUX (parent);
@@ -1019,10 +1254,14 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
     switch (rmdemux->state) {
       case RMDEMUX_STATE_HEADER:
       {
+        guint8 header[HEADER_SIZE];
+
         if (gst_adapter_available (rmdemux->adapter) < HEADER_SIZE)
           goto unlock;
 
-        data = gst_adapter_map (rmdemux->adapter, HEADER_SIZE);
+        /* copy rather than map, mapping could merge the adapter chunks */
+        gst_adapter_copy (rmdemux->adapter, header, 0, HEADER_SIZE);
+        data = header;
 
         rmdemux->object_id = RMDEMUX_FOURCC_GET (data + 0);
         rmdemux->size = RMDEMUX_GUINT32_GET (data + 4) - HEADER_SIZE;
@@ -1036,7 +1275,6 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
            * happen. */
           GST_WARNING_OBJECT (rmdemux, "Bogus looking header, unprintable "
               "FOURCC");
-          gst_adapter_unmap (rmdemux->adapter);
           gst_adapter_flush (rmdemux->adapter, 4);
 
           break;
@@ -1048,7 +1286,6 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
             GST_FOURCC_ARGS (rmdemux->object_id), rmdemux->size,
             rmdemux->object_version);
 
-        gst_adapter_unmap (rmdemux->adapter);
         gst_adapter_flush (rmdemux->adapter, HEADER_SIZE);
 
         switch (rmdemux->object_id) {
@@ -1145,6 +1382,8 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
       }
       case RMDEMUX_STATE_HEADER_DATA:
       {
+        guint8 header[DATA_SIZE];
+
         /* If we haven't already done so then signal there are no more pads */
         if (!rmdemux->have_pads) {
           GST_LOG_OBJECT (rmdemux, "no more pads");
@@ -1159,9 +1398,8 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
         if (gst_adapter_available (rmdemux->adapter) < rmdemux->size)
           goto unlock;
 
-        data = gst_adapter_map (rmdemux->adapter, rmdemux->size);
-        gst_rmdemux_parse_data (rmdemux, data, rmdemux->size);
-        gst_adapter_unmap (rmdemux->adapter);
+        gst_adapter_copy (rmdemux->adapter, header, 0, DATA_SIZE);
+        gst_rmdemux_parse_data (rmdemux, header, DATA_SIZE);
         gst_adapter_flush (rmdemux->adapter, rmdemux->size);
 
         rmdemux->state = RMDEMUX_STATE_DATA_PACKET;
@@ -1199,63 +1437,8 @@ gst_rmdemux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
       }
       case RMDEMUX_STATE_DATA_PACKET:
       {
-        guint8 header[4];
-
-        if (gst_adapter_available (rmdemux->adapter) < 2)
+        if (!gst_rmdemux_parse_data_packets (rmdemux, &ret))
           goto unlock;
-
-        gst_adapter_copy (rmdemux->adapter, header, 0, 2);
-        version = RMDEMUX_GUINT16_GET (header);
-        GST_LOG_OBJECT (rmdemux, "Data packet with version=%d", version);
-
-        if (version == 0 || version == 1) {
-          guint16 length;
-
-          if (gst_adapter_available (rmdemux->adapter) < 4)
-            goto unlock;
-
-          gst_adapter_copy (rmdemux->adapter, header, 0, 4);
-
-          length = RMDEMUX_GUINT16_GET (header + 2);
-          GST_LOG_OBJECT (rmdemux, "Got length %d", length);
-
-          if (length < 4) {
-            GST_LOG_OBJECT (rmdemux, "length too small, dropping");
-            /* Invalid, just drop it */
-            gst_adapter_flush (rmdemux->adapter, 4);
-          } else {
-            GstBuffer *buffer;
-
-            avail = gst_adapter_available (rmdemux->adapter);
-            if (avail < length)
-              goto unlock;
-
-            GST_LOG_OBJECT (rmdemux, "we have %u available and we needed %d",
-                avail, length);
-
-            /* flush version and length */
-            gst_adapter_flush (rmdemux->adapter, 4);
-            length -= 4;
-
-            buffer = gst_adapter_take_buffer (rmdemux->adapter, length);
-
-            ret = gst_rmdemux_parse_packet (rmdemux, buffer, version);
-            rmdemux->chunk_index++;
-          }
-
-          if (rmdemux->chunk_index == rmdemux->n_chunks || length == 0)
-            rmdemux->state = RMDEMUX_STATE_HEADER;
-        } else {
-          /* Stream done */
-          gst_adapter_flush (rmdemux->adapter, 2);
-
-          if (rmdemux->data_offset == 0) {
-            GST_LOG_OBJECT (rmdemux,
-                "No further data, internal demux state EOS");
-            rmdemux->state = RMDEMUX_STATE_EOS;
-          } else
-            rmdemux->state = RMDEMUX_STATE_HEADER;
-        }
         break;
       }
       case RMDEMUX_STATE_EOS:
@@ -1309,7 +1492,7 @@ gst_rmdemux_send_event (GstRMDemux * rmdemux, GstEvent * event)
         break;
     }
     gst_event_ref (event);
-    gst_pad_push_event (stream->pad, event);
+    gst_rmdemux_stream_push_event (stream, event);
   }
   gst_event_unref (event);
 }
@@ -1526,6 +1709,19 @@ gst_rmdemux_add_stream (GstRMDemux * rmdemux, GstRMDemuxStream * stream)
     gst_pad_set_query_function (stream->pad,
         GST_DEBUG_FUNCPTR (gst_rmdemux_src_query));
 
+    GST_OBJECT_LOCK (rmdemux);
+    stream->queue_size = rmdemux->stream_queue_size;
+    GST_OBJECT_UNLOCK (rmdemux);
+
+    if (stream->queue_size > 0) {
+      GST_DEBUG_OBJECT (rmdemux, "pushing stream %d from its own thread, "
+          "queue size %u", stream->id, stream->queue_size);
+      stream->queue = gst_data_queue_new (gst_rmdemux_stream_queue_full,
+          NULL, NULL, stream);
+      gst_pad_set_activatemode_function (stream->pad,
+          GST_DEBUG_FUNCPTR (gst_rmdemux_src_activate_mode));
+    }
+
     GST_DEBUG_OBJECT (rmdemux, "adding pad %s with caps %" GST_PTR_FORMAT
         ", stream_id=%d", GST_PAD_NAME (stream->pad), stream_caps, stream->id);
     gst_pad_set_active (stream->pad, TRUE);
@@ -2017,7 +2213,7 @@ gst_rmdemux_descramble_audio (GstRMDemux * rmdemux, GstRMDemuxStream * stream)
       stream->discont = FALSE;
     }
 
-    ret = gst_pad_push (stream->pad, subbuf);
+    ret = gst_rmdemux_stream_push (stream, subbuf);
     if (ret != GST_FLOW_OK)
       break;
   }
@@ -2045,7 +2241,7 @@ gst_rmdemux_descramble_dnet_audio (GstRMDemux * rmdemux,
     GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
     stream->discont = FALSE;
   }
-  return gst_pad_push (stream->pad, buf);
+  return gst_rmdemux_stream_push (stream, buf);
 }
 
 static GstFlowReturn
@@ -2085,7 +2281,7 @@ gst_rmdemux_descramble_mp4a_audio (GstRMDemux * rmdemux,
       GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
       stream->discont = FALSE;
     }
-    res = gst_pad_push (stream->pad, outbuf);
+    res = gst_rmdemux_stream_push (stream, outbuf);
     if (res != GST_FLOW_OK)
       break;
   }
@@ -2136,7 +2332,7 @@ gst_rmdemux_descramble_sipr_audio (GstRMDemux * rmdemux,
 
   outbuf = gst_rm_utils_descramble_sipr_buffer (outbuf);
 
-  ret = gst_pad_push (stream->pad, outbuf);
+  ret = gst_rmdemux_stream_push (stream, outbuf);
 
   gst_rmdemux_stream_clear_cached_subpackets (rmdemux, stream);
 
@@ -2390,7 +2586,7 @@ gst_rmdemux_parse_video_packet (GstRMDemux * rmdemux, GstRMDemuxStream * stream,
         GST_BUFFER_FLAG_SET (out, GST_BUFFER_FLAG_DELTA_UNIT);
       }
 
-      ret = gst_pad_push (stream->pad, out);
+      ret = gst_rmdemux_stream_push (stream, out);
       ret = gst_flow_combiner_update_flow (rmdemux->flowcombiner, ret);
       if (ret != GST_FLOW_OK)
         break;
@@ -2461,7 +2657,7 @@ gst_rmdemux_parse_audio_packet (GstRMDemux * rmdemux, GstRMDemuxStream * stream,
       GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
       stream->discont = FALSE;
     }
-    ret = gst_pad_push (stream->pad, buffer);
+    ret = gst_rmdemux_stream_push (stream, buffer);
   }
 
   gst_buffer_unref (in);
@@ -2470,36 +2666,26 @@ gst_rmdemux_parse_audio_packet (GstRMDemux * rmdemux, GstRMDemuxStream * stream,
 }
 
 static GstFlowReturn
-gst_rmdemux_parse_packet (GstRMDemux * rmdemux, GstBuffer * in, guint16 version)
+gst_rmdemux_handle_packet (GstRMDemux * rmdemux, GstBuffer * in,
+    guint16 version, guint16 id, guint32 ts, guint8 flags)
 {
-  guint16 id;
   GstRMDemuxStream *stream;
-  gsize size, offset;
+  gsize size;
   GstFlowReturn cret, ret;
   GstClockTime timestamp;
   gboolean key;
-  GstMapInfo map;
-  guint8 *data;
-  guint8 flags;
-  guint32 ts;
-
-  gst_buffer_map (in, &map, GST_MAP_READ);
-  data = map.data;
-  size = map.size;
-
-  /* stream number */
-  id = RMDEMUX_GUINT16_GET (data);
 
   stream = gst_rmdemux_get_stream_by_id (rmdemux, id);
   if (!stream || !stream->pad)
     goto unknown_stream;
 
   /* timestamp in Msec */
-  ts = RMDEMUX_GUINT32_GET (data + 2);
   timestamp = ts * GST_MSECOND;
 
   rmdemux->segment.position = timestamp;
 
+  size = gst_buffer_get_size (in);
+
   GST_LOG_OBJECT (rmdemux, "Parsing a packet for stream=%d, timestamp=%"
       GST_TIME_FORMAT ", size %" G_GSIZE_FORMAT ", version=%d, ts=%u", id,
       GST_TIME_ARGS (timestamp), size, version, ts);
@@ -2510,24 +2696,6 @@ gst_rmdemux_parse_packet (GstRMDemux * rmdemux, GstBuffer * in, guint16 version)
     rmdemux->first_ts = timestamp;
   }
 
-  /* skip stream_id and timestamp */
-  data += (2 + 4);
-  size -= (2 + 4);
-
-  /* get flags */
-  flags = GST_READ_UINT8 (data + 1);
-
-  data += 2;
-  size -= 2;
-
-  /* version 1 has an extra byte */
-  if (version == 1) {
-    data += 1;
-    size -= 1;
-  }
-  offset = data - map.data;
-  gst_buffer_unmap (in, &map);
-
   key = (flags & 0x02) != 0;
   GST_DEBUG_OBJECT (rmdemux, "flags %d, Keyframe %d", flags, key);
 
@@ -2551,7 +2719,8 @@ gst_rmdemux_parse_packet (GstRMDemux * rmdemux, GstBuffer * in, guint16 version)
 
   if (stream->pending_tags != NULL) {
     GST_LOG_OBJECT (stream->pad, "tags %" GST_PTR_FORMAT, stream->pending_tags);
-    gst_pad_push_event (stream->pad, gst_event_new_tag (stream->pending_tags));
+    gst_rmdemux_stream_push_event (stream,
+        gst_event_new_tag (stream->pending_tags));
     stream->pending_tags = NULL;
   }
 
@@ -2567,11 +2736,11 @@ gst_rmdemux_parse_packet (GstRMDemux * rmdemux, GstBuffer * in, guint16 version)
   /* do special headers */
   if (stream->subtype == GST_RMDEMUX_STREAM_VIDEO) {
     ret =
-        gst_rmdemux_parse_video_packet (rmdemux, stream, in, offset,
+        gst_rmdemux_parse_video_packet (rmdemux, stream, in, 0,
         version, timestamp, key);
   } else if (stream->subtype == GST_RMDEMUX_STREAM_AUDIO) {
     ret =
-        gst_rmdemux_parse_audio_packet (rmdemux, stream, in, offset,
+        gst_rmdemux_parse_audio_packet (rmdemux, stream, in, 0,
         version, timestamp, key);
   } else {
     gst_buffer_unref (in);
@@ -2589,12 +2758,94 @@ unknown_stream:
   {
     GST_WARNING_OBJECT (rmdemux, "No stream for stream id %d in parsing "
         "data packet", id);
-    gst_buffer_unmap (in, &map);
     gst_buffer_unref (in);
     return GST_FLOW_OK;
   }
 }
 
+/* Handles all complete data packets currently in the adapter. The packet
+ * headers are copied out of the adapter and the payloads are taken as
+ * (possibly multi-memory) buffers, so the adapter never has to merge its
+ * chunks for us. Returns FALSE when more data is needed. */
+static gboolean
+gst_rmdemux_parse_data_packets (GstRMDemux * rmdemux, GstFlowReturn * ret)
+{
+  guint8 header[PACKET_HEADER_SIZE + 1];
+  guint header_size;
+  guint16 version, length;
+  gsize avail;
+
+  avail = gst_adapter_available (rmdemux->adapter);
+
+  while (rmdemux->state == RMDEMUX_STATE_DATA_PACKET) {
+    if (avail < 2)
+      return FALSE;
+
+    gst_adapter_copy (rmdemux->adapter, header, 0, MIN (avail,
+            sizeof (header)));
+    version = RMDEMUX_GUINT16_GET (header);
+    GST_LOG_OBJECT (rmdemux, "Data packet with version=%d", version);
+
+    if (version != 0 && version != 1) {
+      /* Stream done */
+      gst_adapter_flush (rmdemux->adapter, 2);
+
+      if (rmdemux->data_offset == 0) {
+        GST_LOG_OBJECT (rmdemux, "No further data, internal demux state EOS");
+        rmdemux->state = RMDEMUX_STATE_EOS;
+      } else
+        rmdemux->state = RMDEMUX_STATE_HEADER;
+      break;
+    }
+
+    if (avail < 4)
+      return FALSE;
+
+    length = RMDEMUX_GUINT16_GET (header + 2);
+    GST_LOG_OBJECT (rmdemux, "Got length %d", length);
+
+    /* version 1 has an extra byte */
+    header_size = PACKET_HEADER_SIZE + version;
+
+    if (length < 4) {
+      GST_LOG_OBJECT (rmdemux, "length too small, dropping");
+      /* Invalid, just drop it */
+      gst_adapter_flush (rmdemux->adapter, 4);
+      avail -= 4;
+    } else {
+      GstBuffer *buffer;
+
+      if (avail < length)
+        return FALSE;
+
+      GST_LOG_OBJECT (rmdemux, "we have %" G_GSIZE_FORMAT
+          " available and we needed %d", avail, length);
+
+      if (length < header_size) {
+        GST_WARNING_OBJECT (rmdemux, "packet of %d bytes is shorter than its "
+            "header, dropping", length);
+        gst_adapter_flush (rmdemux->adapter, length);
+      } else {
+        gst_adapter_flush (rmdemux->adapter, header_size);
+        buffer = gst_adapter_take_buffer_fast (rmdemux->adapter,
+            length - header_size);
+
+        /* header + 4: stream id, timestamp, packet group and flags */
+        *ret = gst_rmdemux_handle_packet (rmdemux, buffer, version,
+            RMDEMUX_GUINT16_GET (header + 4), RMDEMUX_GUINT32_GET (header + 6),
+            GST_READ_UINT8 (header + 11));
+      }
+      avail -= length;
+      rmdemux->chunk_index++;
+    }
+
+    if (rmdemux->chunk_index == rmdemux->n_chunks || length == 0)
+      rmdemux->state = RMDEMUX_STATE_HEADER;
+  }
+
+  return TRUE;
+}
+
 gboolean
 gst_rmdemux_plugin_init (GstPlugin * plugin)
 {
@@ -23,6 +23,7 @@
 
 #include <gst/gst.h>
 #include <gst/base/gstadapter.h>
+#include <gst/base/gstdataqueue.h>
 #include <gst/base/gstflowcombiner.h>
 #include <gst/pbutils/descriptions.h>
 
@@ -94,6 +95,9 @@ struct _GstRMDemux {
 
   GstFlowCombiner *flowcombiner;
 
+  /* per-stream output threads when non-zero */
+  guint stream_queue_size;
+
   guint32 timescale;
   guint64 duration;
   guint32 avg_packet_size;
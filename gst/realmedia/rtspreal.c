@@ -36,16 +36,19 @@
 #include <string.h>
 
 #include <gst/rtsp/gstrtspextension.h>
+#include <gst/base/gstbytewriter.h>
 
 #include "realhash.h"
 #include "rtspreal.h"
 #include "asmrules.h"
+#include "pnmsrc.h"
 
 GST_DEBUG_CATEGORY_STATIC (rtspreal_debug);
 #define GST_CAT_DEFAULT (rtspreal_debug)
 
 #define SERVER_PREFIX "RealServer"
-#define DEFAULT_BANDWIDTH	"10485800"
+
+#define DEFAULT_BANDWIDTH	10485800
 
 static GstRTSPResult
 rtsp_ext_real_get_transports (GstRTSPExtension * ext,
@@ -112,8 +115,16 @@ rtsp_ext_real_before_send (GstRTSPExtension * ext, GstRTSPMessage * request)
     case GST_RTSP_DESCRIBE:
     {
       if (ctx->isreal) {
-        gst_rtsp_message_add_header (request, GST_RTSP_HDR_BANDWIDTH,
-            DEFAULT_BANDWIDTH);
+        gchar *bandwidth = NULL;
+
+        /* rtspsrc sends its connection-speed, if it has one */
+        gst_rtsp_message_get_header (request, GST_RTSP_HDR_BANDWIDTH,
+            &bandwidth, 0);
+        if (!bandwidth) {
+          bandwidth = g_strdup_printf ("%u", DEFAULT_BANDWIDTH);
+          gst_rtsp_message_take_header (request, GST_RTSP_HDR_BANDWIDTH,
+              bandwidth);
+        }
         gst_rtsp_message_add_header (request, GST_RTSP_HDR_GUID,
             "00000000-0000-0000-0000-000000000000");
         gst_rtsp_message_add_header (request, GST_RTSP_HDR_REGION_DATA, "0");
@@ -150,6 +161,17 @@ rtsp_ext_real_after_send (GstRTSPExtension * ext, GstRTSPMessage * req,
 {
   GstRTSPReal *ctx = (GstRTSPReal *) ext;
 
+  /* remember where the server sent us, pnmsrc can then redirect to the
+   * final url directly the next time */
+  if (resp->type_data.response.code == GST_RTSP_STS_MOVED_PERMANENTLY ||
+      resp->type_data.response.code == GST_RTSP_STS_MOVE_TEMPORARILY) {
+    gchar *location = NULL;
+
+    gst_rtsp_message_get_header (resp, GST_RTSP_HDR_LOCATION, &location, 0);
+    if (location && req->type_data.request.uri)
+      gst_pnm_src_cache_update (req->type_data.request.uri, location, -1);
+  }
+
   switch (req->type_data.request.method) {
     case GST_RTSP_OPTIONS:
     {
@@ -168,13 +190,27 @@ rtsp_ext_real_after_send (GstRTSPExtension * ext, GstRTSPMessage * req,
 
       GST_DEBUG_OBJECT (ctx, "Found Real challenge tag");
       ctx->isreal = TRUE;
+      if (req->type_data.request.uri)
+        gst_pnm_src_cache_update (req->type_data.request.uri, NULL, TRUE);
       break;
     }
     case GST_RTSP_DESCRIBE:
     {
       gchar *etag = NULL;
+      gchar *bandwidth = NULL;
       guint len;
 
+      /* the rules are selected for the bandwidth we announced */
+      ctx->bandwidth = DEFAULT_BANDWIDTH;
+      gst_rtsp_message_get_header (req, GST_RTSP_HDR_BANDWIDTH, &bandwidth, 0);
+      if (bandwidth) {
+        guint64 val = g_ascii_strtoull (bandwidth, NULL, 10);
+
+        if (val > 0)
+          ctx->bandwidth = MIN (val, G_MAXUINT);
+      }
+      GST_DEBUG_OBJECT (ctx, "bandwidth %u", ctx->bandwidth);
+
       gst_rtsp_message_get_header (resp, GST_RTSP_HDR_ETAG, &etag, 0);
       if (etag) {
         len = sizeof (ctx->etag);
@@ -193,18 +229,13 @@ no_challenge1:
   {
     GST_DEBUG_OBJECT (ctx, "Could not find challenge tag.");
     ctx->isreal = FALSE;
+    if (resp->type_data.response.code == GST_RTSP_STS_OK &&
+        req->type_data.request.uri)
+      gst_pnm_src_cache_update (req->type_data.request.uri, NULL, FALSE);
     return GST_RTSP_OK;
   }
 }
 
-#define ENSURE_SIZE(size)              \
-G_STMT_START {			       \
-  while (data_len < size) {            \
-    data_len += 1024;                  \
-    data = g_realloc (data, data_len); \
-  }                                    \
-} G_STMT_END
-
 #define READ_BUFFER_GEN(src, func, name, dest, dest_len)    \
 G_STMT_START {			                            \
   dest = (gchar *)func (src, name);                         \
@@ -252,19 +283,142 @@ G_STMT_START {			                              \
   }                                                           \
 } G_STMT_END
 
-#define WRITE_STRING1(datap, str, str_len)            \
-G_STMT_START {			                      \
-  *datap = str_len;                                   \
-  memcpy ((datap) + 1, str, str_len);                 \
-  datap += str_len + 1;                               \
-} G_STMT_END
+/* sizes of the header chunks without their strings */
+#define PROP_SIZE  50
+#define CONT_SIZE  18
+#define MDPR_SIZE  46
+#define DATA_SIZE  18
 
-#define WRITE_STRING2(datap, str, str_len)            \
-G_STMT_START {			                      \
-  GST_WRITE_UINT16_BE (datap, str_len);               \
-  memcpy (datap + 2, str, str_len);                   \
-  datap += str_len + 2;                               \
-} G_STMT_END
+static inline void
+write_string1 (GstByteWriter * bw, const gchar * str, guint len)
+{
+  gst_byte_writer_put_uint8_unchecked (bw, len);
+  gst_byte_writer_put_data_unchecked (bw, (const guint8 *) str, len);
+}
+
+static inline void
+write_string2 (GstByteWriter * bw, const gchar * str, guint len)
+{
+  gst_byte_writer_put_uint16_be_unchecked (bw, len);
+  gst_byte_writer_put_data_unchecked (bw, (const guint8 *) str, len);
+}
+
+static void
+gst_rtsp_real_write_mdpr (GstByteWriter * bw, GstRTSPRealStream * stream)
+{
+  guint size;
+
+  size = MDPR_SIZE + stream->stream_name_len + stream->mime_type_len +
+      stream->type_specific_data_len;
+
+  gst_byte_writer_put_data_unchecked (bw, (const guint8 *) "MDPR", 4);
+  gst_byte_writer_put_uint32_be_unchecked (bw, size);
+  gst_byte_writer_put_uint16_be_unchecked (bw, 0);
+  gst_byte_writer_put_uint16_be_unchecked (bw, stream->id);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->max_bit_rate);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->avg_bit_rate);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->max_packet_size);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->avg_packet_size);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->start_time);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->preroll);
+  gst_byte_writer_put_uint32_be_unchecked (bw, stream->duration);
+  write_string1 (bw, stream->stream_name, stream->stream_name_len);
+  write_string1 (bw, stream->mime_type, stream->mime_type_len);
+  gst_byte_writer_put_uint32_be_unchecked (bw,
+      stream->type_specific_data_len);
+  gst_byte_writer_put_data_unchecked (bw,
+      (const guint8 *) stream->type_specific_data,
+      stream->type_specific_data_len);
+
+  /* the strings point into the SDP, don't keep them around */
+  stream->stream_name = NULL;
+  stream->mime_type = NULL;
+  stream->type_specific_data = NULL;
+}
+
+static void
+gst_rtsp_stream_free (GstRTSPRealStream * stream)
+{
+  gst_asm_rule_book_free (stream->rulebook);
+
+  g_free (stream);
+}
+
+static void
+gst_rtsp_real_free_streams (GstRTSPReal * ctx)
+{
+  g_list_foreach (ctx->streams, (GFunc) gst_rtsp_stream_free, NULL);
+  g_list_free (ctx->streams);
+  ctx->streams = NULL;
+  g_free (ctx->rules);
+  ctx->rules = NULL;
+}
+
+/* Select the rules of all streams for @bandwidth and make the Subscribe
+ * string */
+static void
+gst_rtsp_real_select_rules (GstRTSPReal * ctx, guint bandwidth)
+{
+  GstRTSPRealStream *stream;
+  GstASMRuleBook **books;
+  guint *stream_bw;
+  guint16 *sel;
+  GString *rules;
+  GList *walk;
+  guint i, n_streams;
+
+  n_streams = g_list_length (ctx->streams);
+  books = g_newa (GstASMRuleBook *, n_streams + 1);
+  stream_bw = g_newa (guint, n_streams + 1);
+  sel = g_newa (guint16, n_streams + 1);
+
+  for (i = 0, walk = ctx->streams; walk; walk = g_list_next (walk), i++)
+    books[i] = ((GstRTSPRealStream *) walk->data)->rulebook;
+
+  gst_asm_rule_books_allocate (books, n_streams, bandwidth, stream_bw);
+
+  rules = g_string_new ("");
+  for (i = 0, walk = ctx->streams; walk; walk = g_list_next (walk), i++) {
+    gint rulematches[MAX_RULEMATCHES];
+    gint j, n;
+
+    stream = (GstRTSPRealStream *) walk->data;
+    n = gst_asm_rule_book_match_bandwidth (stream->rulebook, stream_bw[i],
+        rulematches);
+
+    GST_DEBUG_OBJECT (ctx, "stream %u: $Bandwidth %u, %d rules, %u bps",
+        stream->id, stream_bw[i], n,
+        gst_asm_rule_book_get_bandwidth (stream->rulebook, rulematches, n));
+
+    if (n == 0) {
+      GST_WARNING_OBJECT (ctx, "no rules matched for stream %u", stream->id);
+      sel[i] = 0;
+      continue;
+    }
+
+    /* the MLTI codec is taken from the first matched rule */
+    sel[i] = rulematches[0];
+
+    for (j = 0; j < n; j++) {
+      g_string_append_printf (rules, "stream=%u;rule=%u,", stream->id,
+          rulematches[j]);
+    }
+  }
+
+  /* strip final , if we added some stream rules */
+  if (rules->len > 0) {
+    rules = g_string_truncate (rules, rules->len - 1);
+  }
+
+  for (i = 0, walk = ctx->streams; walk; walk = g_list_next (walk), i++)
+    ((GstRTSPRealStream *) walk->data)->sel = sel[i];
+
+  /* and store rules in the context */
+  g_free (ctx->rules);
+  ctx->rules = g_string_free (rules, FALSE);
+
+  GST_DEBUG_OBJECT (ctx, "rules for bandwidth %u: %s", bandwidth, ctx->rules);
+}
 
 static GstRTSPResult
 rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
@@ -275,13 +429,12 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
   gint i;
   gchar *title, *author, *copyright, *comment;
   gsize title_len, author_len, copyright_len, comment_len;
-  guint8 *data = NULL, *datap;
-  guint data_len = 0, offset;
+  GstByteWriter bw;
+  guint8 *data;
   GstBuffer *buf;
   gchar *opaque_data;
   gsize opaque_data_len, asm_rule_book_len;
-  GHashTable *vars;
-  GString *rules;
+  GList *walk;
 
   /* don't bother for non-real formats */
   READ_INT (sdp, "IsRealDataType", ctx->isreal);
@@ -291,6 +444,9 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
   /* Force PAUSE | PLAY */
   //src->methods |= GST_RTSP_PLAY | GST_RTSP_PAUSE;
 
+  /* forget the streams of a previous SDP */
+  gst_rtsp_real_free_streams (ctx);
+
   ctx->n_streams = gst_sdp_message_medias_len (sdp);
 
   ctx->max_bit_rate = 0;
@@ -317,71 +473,53 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
     ctx->duration = MAX (ctx->duration, intval);
   }
 
-  /* FIXME: use GstByteWriter to write the header */
-  /* PROP */
-  offset = 0;
-  size = 50;
-  ENSURE_SIZE (size);
-  datap = data + offset;
-
-  memcpy (datap + 0, "PROP", 4);
-  GST_WRITE_UINT32_BE (datap + 4, size);
-  GST_WRITE_UINT16_BE (datap + 8, 0);
-  GST_WRITE_UINT32_BE (datap + 10, ctx->max_bit_rate);
-  GST_WRITE_UINT32_BE (datap + 14, ctx->avg_bit_rate);
-  GST_WRITE_UINT32_BE (datap + 18, ctx->max_packet_size);
-  GST_WRITE_UINT32_BE (datap + 22, ctx->avg_packet_size);
-  GST_WRITE_UINT32_BE (datap + 26, 0);
-  GST_WRITE_UINT32_BE (datap + 30, ctx->duration);
-  GST_WRITE_UINT32_BE (datap + 34, 0);
-  GST_WRITE_UINT32_BE (datap + 38, 0);
-  GST_WRITE_UINT32_BE (datap + 42, 0);
-  GST_WRITE_UINT16_BE (datap + 46, ctx->n_streams);
-  GST_WRITE_UINT16_BE (datap + 48, 0);
-  offset += size;
+  /* make the streams and parse their rule books first, the rules of all
+   * streams together have to fit in the bandwidth */
+  for (i = 0; i < ctx->n_streams; i++) {
+    const GstSDPMedia *media;
+    GstRTSPRealStream *stream;
+    gchar *str;
 
-  /* CONT */
+    media = gst_sdp_message_get_media (sdp, i);
+
+    if (media->media && !strcmp (media->media, "data"))
+      continue;
+
+    stream = g_new0 (GstRTSPRealStream, 1);
+    stream->id = i;
+    ctx->streams = g_list_append (ctx->streams, stream);
+
+    READ_STRING (media, "ASMRuleBook", str, asm_rule_book_len);
+    stream->rulebook = gst_asm_rule_book_new (str);
+  }
+
+  gst_rtsp_real_select_rules (ctx, ctx->bandwidth);
+
+  /* First pass: collect all parts of the header and calculate its size. The
+   * strings and opaque data are decoded in place and only referenced, they
+   * are copied once when the header is written. */
   READ_BUFFER (sdp, "Title", title, title_len);
   READ_BUFFER (sdp, "Author", author, author_len);
   READ_BUFFER (sdp, "Comment", comment, comment_len);
   READ_BUFFER (sdp, "Copyright", copyright, copyright_len);
 
-  size = 18 + title_len + author_len + comment_len + copyright_len;
-  ENSURE_SIZE (offset + size);
-  datap = data + offset;
-
-  memcpy (datap, "CONT", 4);
-  GST_WRITE_UINT32_BE (datap + 4, size);
-  GST_WRITE_UINT16_BE (datap + 8, 0);   /* Version */
-  datap += 10;
-  WRITE_STRING2 (datap, title, title_len);
-  WRITE_STRING2 (datap, author, author_len);
-  WRITE_STRING2 (datap, copyright, copyright_len);
-  WRITE_STRING2 (datap, comment, comment_len);
-  offset += size;
-
-  /* fix the hashtale for the rule parser */
-  rules = g_string_new ("");
-  vars = g_hash_table_new (g_str_hash, g_str_equal);
-  g_hash_table_insert (vars, (gchar *) "Bandwidth",
-      (gchar *) DEFAULT_BANDWIDTH);
+  size = PROP_SIZE;
+  size += CONT_SIZE + title_len + author_len + comment_len + copyright_len;
+  size += DATA_SIZE;
 
-  /* MDPR */
-  for (i = 0; i < ctx->n_streams; i++) {
+  for (i = 0, walk = ctx->streams; i < ctx->n_streams; i++) {
     const GstSDPMedia *media;
     guint32 len;
     GstRTSPRealStream *stream;
-    gchar *str;
-    gint rulematches[MAX_RULEMATCHES];
-    gint sel, j, n;
+    gint sel, j;
 
     media = gst_sdp_message_get_media (sdp, i);
 
     if (media->media && !strcmp (media->media, "data"))
       continue;
 
-    stream = g_new0 (GstRTSPRealStream, 1);
-    ctx->streams = g_list_append (ctx->streams, stream);
+    stream = (GstRTSPRealStream *) walk->data;
+    walk = g_list_next (walk);
 
     READ_INT_M (media, "MaxBitRate", stream->max_bit_rate);
     READ_INT_M (media, "AvgBitRate", stream->avg_bit_rate);
@@ -390,40 +528,12 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
     READ_INT_M (media, "StartTime", stream->start_time);
     READ_INT_M (media, "Preroll", stream->preroll);
     READ_INT_M (media, "Duration", stream->duration);
-    READ_STRING (media, "StreamName", str, stream->stream_name_len);
-    stream->stream_name = g_strndup (str, stream->stream_name_len);
-    READ_STRING (media, "mimetype", str, stream->mime_type_len);
-    stream->mime_type = g_strndup (str, stream->mime_type_len);
-
-    /* FIXME: Depending on the current bandwidth, we need to select one
-     * bandwith out of a list offered by the server. Someone needs to write
-     * a parser for strings like
-     *
-     * #($Bandwidth < 67959),TimestampDelivery=T,DropByN=T,priority=9;
-     * #($Bandwidth >= 67959) && ($Bandwidth < 167959),AverageBandwidth=67959,
-     * Priority=9;#($Bandwidth >= 67959) && ($Bandwidth < 167959),
-     * AverageBandwidth=0,Priority=5,OnDepend=\"1\";
-     * #($Bandwidth >= 167959) && ($Bandwidth < 267959),
-     * AverageBandwidth=167959,Priority=9;
-     * #($Bandwidth >= 167959) && ($Bandwidth < 267959),AverageBandwidth=0,
-     * Priority=5,OnDepend=\"3\";#($Bandwidth >= 267959),
-     * AverageBandwidth=267959,Priority=9;#($Bandwidth >= 267959),
-     * AverageBandwidth=0,Priority=5,OnDepend=\"5\";
-     *
-     * As I don't know how to do that, I just use the first entry (sel = 0).
-     * But to give you a starting point, I offer you above string
-     * in the variable 'asm_rule_book'.
-     */
-    READ_STRING (media, "ASMRuleBook", str, asm_rule_book_len);
-    stream->rulebook = gst_asm_rule_book_new (str);
+    READ_STRING (media, "StreamName", stream->stream_name,
+        stream->stream_name_len);
+    READ_STRING (media, "mimetype", stream->mime_type, stream->mime_type_len);
 
-    n = gst_asm_rule_book_match (stream->rulebook, vars, rulematches);
-    for (j = 0; j < n; j++) {
-      g_string_append_printf (rules, "stream=%u;rule=%u,", i, rulematches[j]);
-    }
-
-    /* get the MLTI for the first matched rules */
-    sel = rulematches[0];
+    /* get the MLTI for the first matched rule */
+    sel = stream->sel;
 
     READ_BUFFER_M (media, "OpaqueData", opaque_data, opaque_data_len);
 
@@ -435,7 +545,7 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
     if (strncmp (opaque_data, "MLTI", 4)) {
       GST_DEBUG_OBJECT (ctx, "no MLTI found, appending all");
       stream->type_specific_data_len = opaque_data_len;
-      stream->type_specific_data = g_memdup (opaque_data, opaque_data_len);
+      stream->type_specific_data = opaque_data;
       goto no_type_specific;
     }
     opaque_data += 4;
@@ -455,30 +565,15 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
       goto strange_opaque_data;
     }
 
-    if (opaque_data_len < 2 * sel) {
+    if (opaque_data_len < 2 * stream->num_rules) {
       GST_DEBUG_OBJECT (ctx, "opaque_data_len %" G_GSIZE_FORMAT
-          " < 2 * sel (%d)", opaque_data_len, 2 * sel);
-      goto strange_opaque_data;
-    }
-    opaque_data += 2 * sel;
-    opaque_data_len -= 2 * sel;
-
-    if (opaque_data_len < 2) {
-      GST_DEBUG_OBJECT (ctx, "opaque_data_len %" G_GSIZE_FORMAT " < 2",
-          opaque_data_len);
+          " < 2 * num_rules (%d)", opaque_data_len, 2 * stream->num_rules);
       goto strange_opaque_data;
     }
-    stream->codec = GST_READ_UINT16_BE (opaque_data);
-    opaque_data += 2;
-    opaque_data_len -= 2;
 
-    if (opaque_data_len < 2 * (stream->num_rules - sel - 1)) {
-      GST_DEBUG_OBJECT (ctx, "opaque_data_len %" G_GSIZE_FORMAT
-          " < %d", opaque_data_len, 2 * (stream->num_rules - sel - 1));
-      goto strange_opaque_data;
-    }
-    opaque_data += 2 * (stream->num_rules - sel - 1);
-    opaque_data_len -= 2 * (stream->num_rules - sel - 1);
+    stream->codec = GST_READ_UINT16_BE (opaque_data + 2 * sel);
+    opaque_data += 2 * stream->num_rules;
+    opaque_data_len -= 2 * stream->num_rules;
 
     if (opaque_data_len < 2) {
       GST_DEBUG_OBJECT (ctx, "opaque_data_len %" G_GSIZE_FORMAT " < 2",
@@ -528,61 +623,58 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
           opaque_data_len, stream->type_specific_data_len);
       goto strange_opaque_data;
     }
-    stream->type_specific_data =
-        g_memdup (opaque_data, stream->type_specific_data_len);
+    stream->type_specific_data = opaque_data;
 
   no_type_specific:
-    size =
-        46 + stream->stream_name_len + stream->mime_type_len +
+    size += MDPR_SIZE + stream->stream_name_len + stream->mime_type_len +
         stream->type_specific_data_len;
-    ENSURE_SIZE (offset + size);
-    datap = data + offset;
-
-    memcpy (datap, "MDPR", 4);
-    GST_WRITE_UINT32_BE (datap + 4, size);
-    GST_WRITE_UINT16_BE (datap + 8, 0);
-    GST_WRITE_UINT16_BE (datap + 10, i);
-    GST_WRITE_UINT32_BE (datap + 12, stream->max_bit_rate);
-    GST_WRITE_UINT32_BE (datap + 16, stream->avg_bit_rate);
-    GST_WRITE_UINT32_BE (datap + 20, stream->max_packet_size);
-    GST_WRITE_UINT32_BE (datap + 24, stream->avg_packet_size);
-    GST_WRITE_UINT32_BE (datap + 28, stream->start_time);
-    GST_WRITE_UINT32_BE (datap + 32, stream->preroll);
-    GST_WRITE_UINT32_BE (datap + 36, stream->duration);
-    datap += 40;
-    WRITE_STRING1 (datap, stream->stream_name, stream->stream_name_len);
-    WRITE_STRING1 (datap, stream->mime_type, stream->mime_type_len);
-    GST_WRITE_UINT32_BE (datap, stream->type_specific_data_len);
-    if (stream->type_specific_data_len)
-      memcpy (datap + 4, stream->type_specific_data,
-          stream->type_specific_data_len);
-    offset += size;
   }
 
-  /* destroy the rulebook hashtable now */
-  g_hash_table_destroy (vars);
+  /* Second pass: write everything into a buffer of the exact size */
+  data = g_malloc (size);
+  gst_byte_writer_init_with_data (&bw, data, size, FALSE);
 
-  /* strip final , if we added some stream rules */
-  if (rules->len > 0) {
-    rules = g_string_truncate (rules, rules->len - 1);
-  }
+  /* PROP */
+  gst_byte_writer_put_data_unchecked (&bw, (const guint8 *) "PROP", 4);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, PROP_SIZE);
+  gst_byte_writer_put_uint16_be_unchecked (&bw, 0);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, ctx->max_bit_rate);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, ctx->avg_bit_rate);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, ctx->max_packet_size);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, ctx->avg_packet_size);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, 0);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, ctx->duration);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, 0);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, 0);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, 0);
+  gst_byte_writer_put_uint16_be_unchecked (&bw, ctx->n_streams);
+  gst_byte_writer_put_uint16_be_unchecked (&bw, 0);
 
-  /* and store rules in the context */
-  ctx->rules = g_string_free (rules, FALSE);
+  /* CONT */
+  gst_byte_writer_put_data_unchecked (&bw, (const guint8 *) "CONT", 4);
+  gst_byte_writer_put_uint32_be_unchecked (&bw,
+      CONT_SIZE + title_len + author_len + comment_len + copyright_len);
+  gst_byte_writer_put_uint16_be_unchecked (&bw, 0);     /* Version */
+  write_string2 (&bw, title, title_len);
+  write_string2 (&bw, author, author_len);
+  write_string2 (&bw, copyright, copyright_len);
+  write_string2 (&bw, comment, comment_len);
+
+  /* MDPR */
+  for (walk = ctx->streams; walk; walk = g_list_next (walk))
+    gst_rtsp_real_write_mdpr (&bw, (GstRTSPRealStream *) walk->data);
 
   /* DATA */
-  size = 18;
-  ENSURE_SIZE (offset + size);
-  datap = data + offset;
+  gst_byte_writer_put_data_unchecked (&bw, (const guint8 *) "DATA", 4);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, DATA_SIZE);
+  gst_byte_writer_put_uint16_be_unchecked (&bw, 0);
+  gst_byte_writer_put_uint32_be_unchecked (&bw, 0);     /* number of packets */
+  gst_byte_writer_put_uint32_be_unchecked (&bw, 0);     /* next data header */
 
-  memcpy (datap, "DATA", 4);
-  GST_WRITE_UINT32_BE (datap + 4, size);
-  GST_WRITE_UINT16_BE (datap + 8, 0);
-  GST_WRITE_UINT32_BE (datap + 10, 0);  /* number of packets */
-  GST_WRITE_UINT32_BE (datap + 14, 0);  /* next data header */
-  offset += size;
+  if (gst_byte_writer_get_pos (&bw) != size)
+    goto wrong_size;
 
-  buf = gst_buffer_new_wrapped (data, offset);
+  buf = gst_buffer_new_wrapped (data, size);
 
   /* Set on caps */
   GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_HEADER);
@@ -598,13 +690,18 @@ rtsp_ext_real_parse_sdp (GstRTSPExtension * ext, GstSDPMessage * sdp,
   /* ERRORS */
 strange_opaque_data:
   {
-    g_string_free (rules, TRUE);
-    g_hash_table_destroy (vars);
-    g_free (data);
-
     GST_ELEMENT_ERROR (ctx, RESOURCE, WRITE, ("Strange opaque data."), (NULL));
     return FALSE;
   }
+wrong_size:
+  {
+    GST_ERROR_OBJECT (ctx, "wrote %u bytes of stream header, expected %u",
+        gst_byte_writer_get_pos (&bw), size);
+    g_free (data);
+    GST_ELEMENT_ERROR (ctx, RESOURCE, WRITE, (NULL),
+        ("Could not make the stream header."));
+    return FALSE;
+  }
 }
 
 static GstRTSPResult
@@ -694,17 +791,7 @@ static void
 gst_rtsp_real_init (GstRTSPReal * rtspreal)
 {
   rtspreal->isreal = FALSE;
-}
-
-static void
-gst_rtsp_stream_free (GstRTSPRealStream * stream)
-{
-  g_free (stream->stream_name);
-  g_free (stream->mime_type);
-  gst_asm_rule_book_free (stream->rulebook);
-  g_free (stream->type_specific_data);
-
-  g_free (stream);
+  rtspreal->bandwidth = DEFAULT_BANDWIDTH;
 }
 
 static void
@@ -712,9 +799,7 @@ gst_rtsp_real_finalize (GObject * obj)
 {
   GstRTSPReal *r = (GstRTSPReal *) obj;
 
-  g_list_foreach (r->streams, (GFunc) gst_rtsp_stream_free, NULL);
-  g_list_free (r->streams);
-  g_free (r->rules);
+  gst_rtsp_real_free_streams (r);
 
   G_OBJECT_CLASS (parent_class)->finalize (obj);
 }
@@ -737,3 +822,153 @@ gst_rtsp_real_plugin_init (GstPlugin * plugin)
   return gst_element_register (plugin, "rtspreal",
       GST_RANK_MARGINAL, GST_TYPE_RTSP_REAL);
 }
+
+#ifdef BENCHMARK
+/* SDPs in the layout RealServer sends them, one audio+video+data session
+ * with MLTI opaque data and one audio only session without */
+static const gchar *sdps[] = {
+  "v=0\r\n"
+      "o=- 1067447423 1067447423 IN IP4 127.0.0.1\r\n"
+      "s=<No title>\r\n"
+      "i=<No author> <No copyright>\r\n"
+      "c=IN IP4 0.0.0.0\r\n"
+      "t=0 0\r\n"
+      "a=SdpplinVersion:1610641560\r\n"
+      "a=IsRealDataType:integer;1\r\n"
+      "a=StreamCount:integer;3\r\n"
+      "a=Title:buffer;\"Q2hhbm5lbCA3IE5ld3M=\"\r\n"
+      "a=Author:buffer;\"UmVhbE5ldHdvcmtz\"\r\n"
+      "a=Copyright:buffer;\"KEMpIDIwMDM=\"\r\n"
+      "a=range:npt=0-3600.000\r\n"
+      "m=audio 0 RTP/AVP 101\r\n"
+      "b=AS:64\r\n"
+      "a=control:streamid=0\r\n"
+      "a=range:npt=0-3600.000\r\n"
+      "a=length:npt=3600.000\r\n"
+      "a=rtpmap:101 x-pn-realaudio/1000\r\n"
+      "a=mimetype:string;\"audio/x-pn-realaudio\"\r\n"
+      "a=StreamName:string;\"Audio Stream\"\r\n"
+      "a=MaxBitRate:integer;64000\r\n"
+      "a=AvgBitRate:integer;64000\r\n"
+      "a=MaxPacketSize:integer;640\r\n"
+      "a=AvgPacketSize:integer;640\r\n"
+      "a=Preroll:integer;4640\r\n"
+      "a=StartTime:integer;0\r\n"
+      "a=Duration:integer;3600000\r\n"
+      "a=ASMRuleBook:string;\"#($Bandwidth < 32000),AverageBandwidth=20000,Priority=9;"
+      "#($Bandwidth < 32000),AverageBandwidth=0,Priority=5,OnDepend=\\\"0\\\";"
+      "#($Bandwidth >= 32000) && ($Bandwidth < 64000),AverageBandwidth=32000,Priority=9;"
+      "#($Bandwidth >= 32000) && ($Bandwidth < 64000),AverageBandwidth=0,Priority=5,OnDepend=\\\"2\\\";"
+      "#($Bandwidth >= 64000),AverageBandwidth=64000,Priority=9;"
+      "#($Bandwidth >= 64000),AverageBandwidth=0,Priority=5,OnDepend=\\\"4\\\";\"\r\n"
+      "a=OpaqueData:buffer;\"TUxUSQAGAAAAAAABAAEAAgACAAMAAAAsLnJh/QAAAAAAAAAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAABALnJh/QAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAAAFQucmH9AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAAAAA=\"\r\n"
+      "m=video 0 RTP/AVP 101\r\n"
+      "b=AS:450\r\n"
+      "a=control:streamid=1\r\n"
+      "a=range:npt=0-3600.000\r\n"
+      "a=length:npt=3600.000\r\n"
+      "a=rtpmap:101 x-pn-realvideo/1000\r\n"
+      "a=mimetype:string;\"video/x-pn-realvideo\"\r\n"
+      "a=StreamName:string;\"Video Stream\"\r\n"
+      "a=MaxBitRate:integer;450000\r\n"
+      "a=AvgBitRate:integer;450000\r\n"
+      "a=MaxPacketSize:integer;1400\r\n"
+      "a=AvgPacketSize:integer;1200\r\n"
+      "a=Preroll:integer;4640\r\n"
+      "a=StartTime:integer;0\r\n"
+      "a=Duration:integer;3600000\r\n"
+      "a=ASMRuleBook:string;\"#($Bandwidth < 200000),AverageBandwidth=150000,Priority=9;"
+      "#($Bandwidth < 200000),AverageBandwidth=0,Priority=5,OnDepend=\\\"0\\\";"
+      "#($Bandwidth >= 200000),AverageBandwidth=450000,Priority=9;"
+      "#($Bandwidth >= 200000),AverageBandwidth=0,Priority=5,OnDepend=\\\"2\\\";\"\r\n"
+      "a=OpaqueData:buffer;\"TUxUSQAEAAAAAAABAAEAAgAAACJWSURPUlY0MAAAAAAAAAAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAAAAAAJlZJRE9SVjQwAAAAAAAAAAAAAAAAAAAAAAAA"
+      "AAAAAAAAAAAAAAAA\"\r\n"
+      "m=data 0 RTP/AVP 101\r\n"
+      "a=control:streamid=2\r\n"
+      "a=rtpmap:101 x-pn-realevent/1000\r\n"
+      "a=mimetype:string;\"application/x-pn-realevent\"\r\n",
+  "v=0\r\n"
+      "o=- 1067447424 1067447424 IN IP4 127.0.0.1\r\n"
+      "s=<No title>\r\n"
+      "c=IN IP4 0.0.0.0\r\n"
+      "t=0 0\r\n"
+      "a=IsRealDataType:integer;1\r\n"
+      "a=StreamCount:integer;1\r\n"
+      "a=Title:buffer;\"Q2hhbm5lbCA3IE5ld3M=\"\r\n"
+      "m=audio 0 RTP/AVP 101\r\n"
+      "b=AS:32\r\n"
+      "a=control:streamid=0\r\n"
+      "a=rtpmap:101 x-pn-realaudio/1000\r\n"
+      "a=mimetype:string;\"audio/x-pn-realaudio\"\r\n"
+      "a=StreamName:string;\"Audio Stream\"\r\n"
+      "a=MaxBitRate:integer;32000\r\n"
+      "a=AvgBitRate:integer;32000\r\n"
+      "a=MaxPacketSize:integer;320\r\n"
+      "a=AvgPacketSize:integer;320\r\n"
+      "a=Preroll:integer;4640\r\n"
+      "a=Duration:integer;0\r\n"
+      "a=ASMRuleBook:string;\"#($Bandwidth < 32000),AverageBandwidth=20000,Priority=9;"
+      "#($Bandwidth < 32000),AverageBandwidth=0,Priority=5,OnDepend=\\\"0\\\";"
+      "#($Bandwidth >= 32000) && ($Bandwidth < 64000),AverageBandwidth=32000,Priority=9;"
+      "#($Bandwidth >= 32000) && ($Bandwidth < 64000),AverageBandwidth=0,Priority=5,OnDepend=\\\"2\\\";"
+      "#($Bandwidth >= 64000),AverageBandwidth=64000,Priority=9;"
+      "#($Bandwidth >= 64000),AverageBandwidth=0,Priority=5,OnDepend=\\\"4\\\";\"\r\n"
+      "a=OpaqueData:buffer;\"LnJh/QAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA"
+      "AAA=\"\r\n"
+};
+
+gint
+main (gint argc, gchar * argv[])
+{
+  GstRTSPExtension *ext;
+  guint i, j, iterations = 10000;
+
+  gst_init (&argc, &argv);
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+
+  ext = g_object_new (GST_TYPE_RTSP_REAL, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (sdps); i++) {
+    gint64 elapsed = 0;
+    gsize header_size = 0;
+
+    for (j = 0; j < iterations; j++) {
+      GstSDPMessage *sdp;
+      GstStructure *props;
+      const GValue *config;
+      gint64 start;
+
+      /* the SDP is decoded in place, parse a new one every time */
+      gst_sdp_message_new (&sdp);
+      gst_sdp_message_parse_buffer ((const guint8 *) sdps[i],
+          strlen (sdps[i]), sdp);
+      props = gst_structure_new_empty ("application/x-unknown");
+
+      start = g_get_monotonic_time ();
+      rtsp_ext_real_parse_sdp (ext, sdp, props);
+      elapsed += g_get_monotonic_time () - start;
+
+      config = gst_structure_get_value (props, "config");
+      if (config)
+        header_size = gst_buffer_get_size (gst_value_get_buffer (config));
+
+      gst_structure_free (props);
+      gst_sdp_message_free (sdp);
+    }
+    g_print ("sdp %u: %" G_GSIZE_FORMAT " bytes header, rules %s, "
+        "%.3f us per header\n", i, header_size,
+        GST_RTSP_REAL (ext)->rules, (gdouble) elapsed / iterations);
+  }
+  gst_object_unref (ext);
+
+  return 0;
+}
+#endif
@@ -46,16 +46,17 @@ struct _GstRTSPRealStream {
   guint  start_time;
   guint  preroll;
   guint  duration;
+
+  /* point into the SDP, only valid while the header is made */
   gchar *stream_name;
   guint  stream_name_len;
   gchar *mime_type;
   guint  mime_type_len;
-
-  GstASMRuleBook *rulebook;
-
   gchar *type_specific_data;
   guint  type_specific_data_len;
 
+  GstASMRuleBook *rulebook;
+
   guint16 num_rules, j, sel, codec;
 };
 
@@ -77,6 +78,9 @@ struct _GstRTSPReal {
   guint  duration;
 
   gchar *rules;
+
+  /* Bandwidth header of the DESCRIBE request, in bits per second */
+  guint  bandwidth;
 };
 
 struct _GstRTSPRealClass {
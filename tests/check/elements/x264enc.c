@@ -23,6 +23,8 @@
 #include <unistd.h>
 
 #include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/video/video.h>
 
 /* For ease of programming we use globals to keep refs for our floating
  * src and sink pads we create; otherwise we always have to do get_pad,
@@ -285,6 +287,545 @@ GST_START_TEST (test_video_high444)
 
 GST_END_TEST;
 
+#define HARNESS_CAPS_STRING "video/x-raw, format = (string) I420, " \
+                           "width = (int) 384, height = (int) 288, " \
+                           "framerate = (fraction) 25/1"
+#define HARNESS_FRAME_SIZE (384 * 288 * 3 / 2)
+
+static GstHarness *
+setup_harness (const gchar * launch_line)
+{
+  GstHarness *h;
+
+  h = gst_harness_new_parse (launch_line);
+  gst_harness_set_src_caps_str (h, HARNESS_CAPS_STRING);
+
+  return h;
+}
+
+/* frame @i of a slowly changing input, filled with @i times @step */
+static GstFlowReturn
+push_frame (GstHarness * h, gint i, gint step)
+{
+  GstBuffer *buf;
+
+  buf = gst_harness_create_buffer (h, HARNESS_FRAME_SIZE);
+  gst_buffer_memset (buf, 0, i * step, HARNESS_FRAME_SIZE);
+  GST_BUFFER_PTS (buf) = i * GST_SECOND / 25;
+  GST_BUFFER_DURATION (buf) = GST_SECOND / 25;
+
+  return gst_harness_push (h, buf);
+}
+
+static void
+push_frames (GstHarness * h, gint first, gint n, gint step)
+{
+  gint i;
+
+  for (i = first; i < first + n; i++)
+    fail_unless_equals_int (push_frame (h, i, step), GST_FLOW_OK);
+}
+
+GST_START_TEST (test_video_reconfig)
+{
+  GstHarness *h;
+  guint subme, ref;
+  gint i;
+
+  h = setup_harness ("x264enc ref=3");
+
+  push_frames (h, 0, 10, 1);
+  /* properties the encoder can take on while running */
+  g_object_set (h->element, "subme", 2, "ref", 1, "trellis", FALSE,
+      "option-string", "deblock=-1,-1:psy-rd=0.5,0:keyint=5", NULL);
+  push_frames (h, 10, 10, 1);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  fail_unless_equals_int (gst_harness_buffers_received (h), 20);
+
+  /* the encoder was not restarted, so the only IDR is the first frame */
+  for (i = 0; i < 20; i++) {
+    GstBuffer *buf = gst_harness_pull (h);
+
+    if (i == 0)
+      fail_if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT));
+    else
+      fail_unless (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT));
+    gst_buffer_unref (buf);
+  }
+
+  g_object_get (h->element, "subme", &subme, "ref", &ref, NULL);
+  fail_unless_equals_int (subme, 2);
+  fail_unless_equals_int (ref, 1);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_timing_stats)
+{
+  GstHarness *h;
+  GstStructure *stats;
+  guint64 frames, average, max;
+  const gchar *level;
+
+  h = setup_harness ("x264enc adaptive-speed=true speed-preset=fast");
+  push_frames (h, 0, 10, 1);
+
+  g_object_get (h->element, "timing-stats", &stats, NULL);
+  fail_unless (stats != NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "frames", &frames));
+  fail_unless (gst_structure_get_uint64 (stats, "average-encode-time",
+          &average));
+  fail_unless (gst_structure_get_uint64 (stats, "max-encode-time", &max));
+  fail_unless_equals_uint64 (frames, 10);
+  fail_unless (average <= max);
+
+  /* never slower than the settings it started with */
+  level = gst_structure_get_string (stats, "speed-level");
+  fail_unless (level != NULL);
+  fail_if (g_str_equal (level, "medium") || g_str_equal (level, "slow")
+      || g_str_equal (level, "slower") || g_str_equal (level, "veryslow"));
+  gst_structure_free (stats);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_adaptive_speed)
+{
+  GstHarness *h;
+  GstStructure *stats;
+  guint changes;
+
+  h = setup_harness ("x264enc adaptive-speed=true qos=true "
+      "speed-preset=medium");
+
+  push_frames (h, 0, 1, 1);
+  /* downstream is far behind, so no frame fits in its budget */
+  gst_harness_push_upstream_event (h, gst_event_new_qos
+      (GST_QOS_TYPE_UNDERFLOW, 0.5, 100 * GST_SECOND, 0));
+  push_frames (h, 1, 29, 1);
+
+  g_object_get (h->element, "timing-stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint (stats, "speed-changes", &changes));
+  fail_unless (changes > 0);
+  fail_if (g_str_equal (gst_structure_get_string (stats, "speed-level"),
+          "configured"));
+  gst_structure_free (stats);
+
+  /* back to the settings the encoder was configured with */
+  g_object_set (h->element, "adaptive-speed", FALSE, NULL);
+  g_object_get (h->element, "timing-stats", &stats, NULL);
+  fail_unless_equals_string (gst_structure_get_string (stats, "speed-level"),
+      "configured");
+  gst_structure_free (stats);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+/* noise, so that frames need more than one slice */
+static void
+push_noise_frame (GstHarness * h, gint i)
+{
+  GstBuffer *buf;
+  GstMapInfo map;
+  gsize j;
+
+  buf = gst_harness_create_buffer (h, HARNESS_FRAME_SIZE);
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (j = 0; j < map.size; j++)
+    map.data[j] = g_random_int ();
+  gst_buffer_unmap (buf, &map);
+  GST_BUFFER_PTS (buf) = i * GST_SECOND / 25;
+  GST_BUFFER_DURATION (buf) = GST_SECOND / 25;
+  fail_unless_equals_int (gst_harness_push (h, buf), GST_FLOW_OK);
+}
+
+GST_START_TEST (test_video_low_latency)
+{
+  GstHarness *h;
+  GstBuffer *buf;
+  GstCaps *caps;
+  GstSegment segment;
+  const gchar *alignment;
+  guint markers = 0;
+  gint i;
+
+  h = setup_harness ("x264enc low-latency=true slice-max-size=500");
+
+  for (i = 0; i < 5; i++)
+    push_noise_frame (h, i);
+
+  caps = gst_pad_get_current_caps (h->sinkpad);
+  fail_unless (caps != NULL);
+  alignment = gst_structure_get_string (gst_caps_get_structure (caps, 0),
+      "alignment");
+  fail_unless_equals_string (alignment, "nal");
+  gst_caps_unref (caps);
+
+  /* every frame ends with a MARKER buffer, and they all came out without
+   * waiting for EOS */
+  fail_unless (gst_harness_buffers_in_queue (h) > 5);
+  while ((buf = gst_harness_try_pull (h))) {
+    if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER))
+      markers++;
+    gst_buffer_unref (buf);
+  }
+  fail_unless_equals_int (markers, 5);
+
+  /* the frame after a new segment goes out whole, after the segment */
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  segment.base = GST_SECOND;
+  fail_unless (gst_harness_push_event (h, gst_event_new_segment (&segment)));
+  push_noise_frame (h, 5);
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 1);
+  buf = gst_harness_pull (h);
+  fail_unless (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_MARKER));
+  gst_buffer_unref (buf);
+
+  /* and the next one in slices again */
+  push_noise_frame (h, 6);
+  fail_unless (gst_harness_buffers_in_queue (h) > 1);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static gsize
+encode_roi_frame (GstBuffer * frame, const gchar * roi_type)
+{
+  GstHarness *h;
+  GstBuffer *buf;
+  gsize size = 0;
+
+  h = setup_harness ("x264enc pass=qual quantizer=30 "
+      "roi-types=\"roi-types,face=(double)-12\"");
+
+  buf = gst_buffer_copy_deep (frame);
+  if (roi_type)
+    gst_buffer_add_video_region_of_interest_meta (buf, roi_type, 64, 64,
+        128, 96);
+  fail_unless_equals_int (gst_harness_push (h, buf), GST_FLOW_OK);
+  gst_harness_push_event (h, gst_event_new_eos ());
+
+  while ((buf = gst_harness_try_pull (h))) {
+    size += gst_buffer_get_size (buf);
+    gst_buffer_unref (buf);
+  }
+
+  gst_harness_teardown (h);
+
+  return size;
+}
+
+GST_START_TEST (test_video_roi)
+{
+  GstBuffer *frame;
+  GstMapInfo map;
+  gsize plain, face, other, j;
+  GRand *rand;
+
+  /* the same noise for every encoding */
+  rand = g_rand_new_with_seed (42);
+  frame = gst_buffer_new_allocate (NULL, HARNESS_FRAME_SIZE, NULL);
+  gst_buffer_map (frame, &map, GST_MAP_WRITE);
+  for (j = 0; j < map.size; j++)
+    map.data[j] = g_rand_int (rand);
+  gst_buffer_unmap (frame, &map);
+  g_rand_free (rand);
+  GST_BUFFER_PTS (frame) = 0;
+  GST_BUFFER_DURATION (frame) = GST_SECOND / 25;
+
+  plain = encode_roi_frame (frame, NULL);
+  face = encode_roi_frame (frame, "face");
+  /* falls back to roi-delta-qp */
+  other = encode_roi_frame (frame, "person");
+
+  fail_unless (face > other);
+  fail_unless (other > plain);
+
+  gst_buffer_unref (frame);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_two_pass)
+{
+  GstHarness *h;
+  GstBuffer *buf;
+  GstCaps *caps;
+  gint i;
+
+  h = setup_harness ("x264enc pass=two-pass bitrate=500");
+  push_frames (h, 0, 10, 20);
+
+  /* nothing before the second pass */
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 0);
+
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 10);
+
+  caps = gst_pad_get_current_caps (h->sinkpad);
+  fail_unless (caps != NULL);
+  gst_caps_unref (caps);
+
+  for (i = 0; i < 10; i++) {
+    buf = gst_harness_pull (h);
+    fail_unless (GST_BUFFER_PTS_IS_VALID (buf));
+    gst_buffer_unref (buf);
+  }
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_two_pass_max_size)
+{
+  GstHarness *h;
+
+  /* room for three frames */
+  h = setup_harness ("x264enc pass=two-pass two-pass-max-size=497664");
+
+  /* the fourth frame doesn't fit anymore */
+  push_frames (h, 0, 3, 20);
+  fail_unless_equals_int (push_frame (h, 3, 20), GST_FLOW_ERROR);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static GstPadProbeReturn
+answer_seekable (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstQuery *query = GST_PAD_PROBE_INFO_QUERY (info);
+
+  if (GST_QUERY_TYPE (query) != GST_QUERY_SEEKING)
+    return GST_PAD_PROBE_OK;
+
+  gst_query_set_seeking (query, GST_FORMAT_TIME, TRUE, 0, -1);
+  return GST_PAD_PROBE_HANDLED;
+}
+
+GST_START_TEST (test_video_two_pass_seek)
+{
+  GstHarness *h;
+  GstEvent *event;
+  GstEventType type = GST_EVENT_UNKNOWN;
+  GstSegment segment;
+  gint pass;
+
+  /* far too small to keep the input, but it's read again instead */
+  h = gst_harness_new_parse ("x264enc pass=two-pass bitrate=500 "
+      "two-pass-max-size=1");
+  gst_pad_add_probe (h->srcpad, GST_PAD_PROBE_TYPE_QUERY_UPSTREAM,
+      answer_seekable, NULL, NULL);
+  gst_harness_set_src_caps_str (h, HARNESS_CAPS_STRING);
+
+  for (pass = 0; pass < 2; pass++) {
+    push_frames (h, 0, 10, 20);
+    fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+
+    if (pass == 0) {
+      /* nothing out after the first pass, upstream is asked for the input
+       * again instead */
+      fail_unless_equals_int (gst_harness_buffers_in_queue (h), 0);
+      do {
+        event = gst_harness_pull_upstream_event (h);
+        fail_unless (event != NULL);
+        type = GST_EVENT_TYPE (event);
+        gst_event_unref (event);
+      } while (type != GST_EVENT_SEEK);
+
+      fail_unless (gst_harness_push_event (h, gst_event_new_flush_start ()));
+      fail_unless (gst_harness_push_event (h,
+              gst_event_new_flush_stop (TRUE)));
+      gst_segment_init (&segment, GST_FORMAT_TIME);
+      fail_unless (gst_harness_push_event (h,
+              gst_event_new_segment (&segment)));
+    }
+  }
+
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 10);
+  /* and the EOS only after the second */
+  while ((event = gst_harness_try_pull_event (h))) {
+    type = GST_EVENT_TYPE (event);
+    gst_event_unref (event);
+  }
+  fail_unless_equals_int (type, GST_EVENT_EOS);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_chunks)
+{
+  GstHarness *h;
+  GstBuffer *buf;
+  GstClockTime last_dts = GST_CLOCK_TIME_NONE;
+  gint i;
+
+  h = setup_harness ("x264enc chunk-frames=10 chunk-encoders=2 "
+      "key-int-max=250");
+
+  /* slowly changing, so that only full chunks end */
+  push_frames (h, 0, 35, 1);
+  /* frames wait for their chunk and the two chunks before it */
+  fail_unless (gst_harness_query_latency (h) >= 30 * GST_SECOND / 25);
+
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 35);
+
+  /* every chunk starts with a keyframe, and the DTS keep going up
+   * from one chunk to the next */
+  for (i = 0; i < 35; i++) {
+    buf = gst_harness_pull (h);
+    if (i % 10 == 0)
+      fail_if (GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT));
+    fail_unless (GST_BUFFER_DTS_IS_VALID (buf));
+    if (GST_CLOCK_TIME_IS_VALID (last_dts))
+      fail_unless (GST_BUFFER_DTS (buf) > last_dts);
+    last_dts = GST_BUFFER_DTS (buf);
+    gst_buffer_unref (buf);
+  }
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_chunks_flush)
+{
+  GstHarness *h;
+  GstBuffer *buf;
+  GstSegment segment;
+
+  h = setup_harness ("x264enc chunk-frames=10 chunk-encoders=2 "
+      "key-int-max=250");
+
+  push_frames (h, 0, 25, 1);
+  while ((buf = gst_harness_try_pull (h)))
+    gst_buffer_unref (buf);
+
+  /* the chunks that are still encoding are dropped */
+  fail_unless (gst_harness_push_event (h, gst_event_new_flush_start ()));
+  fail_unless (gst_harness_push_event (h, gst_event_new_flush_stop (TRUE)));
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  fail_unless (gst_harness_push_event (h, gst_event_new_segment (&segment)));
+
+  push_frames (h, 0, 10, 1);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 10);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_frame_stats)
+{
+  GstHarness *h;
+  GstEvent *event;
+  GstStructure *stats;
+  const GstStructure *s;
+  guint frames, n_events = 0;
+  guint64 bitrate;
+  gdouble qp;
+
+  h = setup_harness ("x264enc frame-stats=true option-string=ssim=1");
+  push_frames (h, 0, 10, 10);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 10);
+
+  while ((event = gst_harness_try_pull_event (h))) {
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM) {
+      s = gst_event_get_structure (event);
+      fail_unless (gst_structure_has_name (s, "x264enc-frame-stats"));
+      fail_unless (gst_structure_has_field (s, "type"));
+      fail_unless (gst_structure_has_field (s, "size"));
+      fail_unless (gst_structure_has_field (s, "latency"));
+      fail_unless (gst_structure_get_double (s, "qp", &qp));
+      fail_unless (qp >= 0 && qp <= 51);
+      fail_unless (gst_structure_has_field (s, "ssim"));
+      fail_if (gst_structure_has_field (s, "psnr"));
+      n_events++;
+    }
+    gst_event_unref (event);
+  }
+  fail_unless_equals_int (n_events, 10);
+
+  g_object_get (h->element, "rolling-stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint (stats, "frames", &frames));
+  fail_unless_equals_int (frames, 10);
+  fail_unless (gst_structure_get_uint64 (stats, "bitrate", &bitrate));
+  fail_unless (bitrate > 0);
+  fail_unless (gst_structure_get_double (stats, "average-qp", &qp));
+  fail_unless (qp >= 0 && qp <= 51);
+  fail_unless (gst_structure_has_field (stats, "average-ssim"));
+  fail_unless (gst_structure_has_field (stats, "latency-p99"));
+  fail_unless (gst_structure_has_field (stats, "delayed-frames"));
+  gst_structure_free (stats);
+
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_video_renditions)
+{
+  GstHarness *h, *hr;
+  GstPad *pad;
+  GstCaps *caps;
+  GstStructure *s;
+  gint i, width, height;
+
+  h = gst_harness_new ("x264enc");
+  hr = gst_harness_new_with_element (h->element, NULL, "src_%u");
+
+  pad = gst_pad_get_peer (hr->sinkpad);
+  fail_unless (pad != NULL);
+  g_object_set (pad, "width", 192, "bitrate", 256, NULL);
+
+  gst_harness_set_src_caps_str (h, HARNESS_CAPS_STRING);
+  push_frames (h, 0, 10, 1);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+
+  /* every frame in both the main stream and the rendition */
+  fail_unless_equals_int (gst_harness_buffers_received (h), 10);
+  fail_unless_equals_int (gst_harness_buffers_received (hr), 10);
+  for (i = 0; i < 10; i++) {
+    GstBuffer *buf = gst_harness_pull (hr);
+
+    fail_unless_equals_uint64 (GST_BUFFER_DURATION (buf), GST_SECOND / 25);
+    gst_buffer_unref (buf);
+  }
+
+  /* the height follows the aspect ratio of the input */
+  caps = gst_pad_get_current_caps (pad);
+  fail_unless (caps != NULL);
+  s = gst_caps_get_structure (caps, 0);
+  fail_unless (gst_structure_get_int (s, "width", &width));
+  fail_unless (gst_structure_get_int (s, "height", &height));
+  fail_unless_equals_int (width, 192);
+  fail_unless_equals_int (height, 144);
+  fail_unless_equals_string (gst_structure_get_string (s, "stream-format"),
+      "byte-stream");
+  gst_caps_unref (caps);
+  gst_object_unref (pad);
+
+  gst_harness_teardown (hr);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
 
 
 Suite *
@@ -299,6 +840,18 @@ x264enc_suite (void)
   tcase_add_test (tc_chain, test_video_high);
   tcase_add_test (tc_chain, test_video_high422);
   tcase_add_test (tc_chain, test_video_high444);
+  tcase_add_test (tc_chain, test_video_reconfig);
+  tcase_add_test (tc_chain, test_video_timing_stats);
+  tcase_add_test (tc_chain, test_video_adaptive_speed);
+  tcase_add_test (tc_chain, test_video_low_latency);
+  tcase_add_test (tc_chain, test_video_roi);
+  tcase_add_test (tc_chain, test_video_two_pass);
+  tcase_add_test (tc_chain, test_video_two_pass_max_size);
+  tcase_add_test (tc_chain, test_video_two_pass_seek);
+  tcase_add_test (tc_chain, test_video_chunks);
+  tcase_add_test (tc_chain, test_video_chunks_flush);
+  tcase_add_test (tc_chain, test_video_frame_stats);
+  tcase_add_test (tc_chain, test_video_renditions);
 
   return s;
 }